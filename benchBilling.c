@@ -0,0 +1,416 @@
+/*
+ * Benchmark and load-replay harness for the billing core.
+ *
+ *   gcc -O2 -pthread benchBilling.c -o billing_bench
+ *
+ * restaurantBilling.c is compiled into this file with its main() left out (BILLING_NO_MAIN), so the
+ * harness calls the same menu, order, billing and receipt functions the POS runs, with no command
+ * parsing or sockets in between. See usage() for the options.
+ */
+#define BILLING_NO_MAIN
+#include "restaurantBilling.c"
+
+#define BENCH_MAX_MENU_ITEMS 60000
+#define BENCH_MAX_VERBS 32
+#define BENCH_VERB_LEN 16
+
+typedef enum { OP_CREATE, OP_ADD, OP_QTY, OP_REMOVE, OP_PREVIEW, OP_BILL, OP_COUNT } BenchOp;
+
+static const char *benchOpNames[OP_COUNT] = { "create", "add", "qty", "remove", "preview", "bill" };
+
+typedef struct {
+    int days;
+    int ordersPerDay;
+    int menuItems;
+    int maxLines;
+    double dineInRatio;
+    int tables;
+    int openOrders;
+    uint32_t seed;
+    ReceiptMode receipts;
+    int receiptsOn;
+} ServiceDayConfig;
+
+/* One order in flight: the lines it still has to add before it is billed. */
+typedef struct {
+    int idx;
+    int linesLeft;
+} OpenOrder;
+
+typedef struct {
+    char name[BENCH_VERB_LEN];
+    LatencyHistogram hist;
+    uint64_t totalNs;
+} OpStats;
+
+static void usage(void) {
+    printf("Usage:\n");
+    printf("  billing_bench [--days N] [--orders N] [--menu-items N] [--items N] [--dine-in RATIO]\n");
+    printf("                [--tables N] [--open N] [--seed N] [--receipts file|segment|archive]\n");
+    printf("      synthetic service days (default 3 days x 20000 orders, 500 items, 1-8 lines, 60%% dine-in)\n");
+    printf("  billing_bench --replay <commands.txt>\n");
+    printf("      time every command of a --batch file, grouped by command\n");
+    printf("  billing_bench --micro batch|render|scan|pricing|menu|kitchen|sales|consolidate|stock\n");
+    printf("      the single-function benchmarks also reachable through --bench-* on the POS binary\n");
+    printf("  billing_bench --micro money\n");
+    printf("      integer bills vs the old float ones, on receipt_9001.txt (run from the repo) and 400 random orders\n");
+}
+
+static uint64_t timedOp(OpStats *s, uint64_t t0) {
+    uint64_t t1 = monotonicNs();
+    latencyRecord(&s->hist, t1 - t0);
+    s->totalNs += t1 - t0;
+    return t1;
+}
+
+static void printOpStats(const OpStats *ops, int n) {
+    printf("%-10s | %-10s | %-12s | %-8s | %-8s | %-8s | %s\n", "Operation", "Count", "ops/s", "p50 us", "p99 us",
+           "p99.9 us", "max us");
+    for (int i=0;i<n;i++) {
+        const OpStats *s = &ops[i];
+        if (s->hist.total == 0) continue;
+        printf("%-10s | %10llu | %12.0f | %8.2f | %8.2f | %8.2f | %.2f\n", s->name, (unsigned long long)s->hist.total,
+               s->totalNs > 0 ? s->hist.total * 1e9 / s->totalNs : 0.0,
+               latencyPercentile(&s->hist, 50) / 1e3, latencyPercentile(&s->hist, 99) / 1e3,
+               latencyPercentile(&s->hist, 99.9) / 1e3, s->hist.maxNs / 1e3);
+    }
+}
+
+/* Replaces the built-in menu with n generated items, cycling through the categories and 40-439 rupee prices. */
+static char (*buildSyntheticMenu(int n))[CODE_LEN] {
+    char (*codes)[CODE_LEN] = malloc(sizeof(*codes) * (size_t)n);
+    if (!codes) return NULL;
+    for (int i=0;i<n;i++) {
+        char name[NAME_LEN];
+        snprintf(codes[i], CODE_LEN, "Z%04X", (unsigned)i & 0xFFFFu);
+        snprintf(name, sizeof(name), "Bench Item %d", i);
+        addMenuItem(codes[i], name, (Category)(STARTER + i % 4), RUPEES(40 + i % 400) + i % 100, 1);
+    }
+    if (publishMenuDraft() != 0) {
+        free(codes);
+        return NULL;
+    }
+    return codes;
+}
+
+static int openSyntheticOrder(const ServiceDayConfig *cfg, uint32_t *seed, OpStats *ops, OpenOrder *slot) {
+    uint64_t t0 = monotonicNs();
+    int idx = -1;
+    if ((double)(loadgenRandom(seed) % 1000) < cfg->dineInRatio * 1000) {
+        int table = findFreeTable(1, 0);
+        if (table != -1) idx = createOrder(1, table);
+    }
+    if (idx == -1) idx = createOrder(0, 0);
+    timedOp(&ops[OP_CREATE], t0);
+    if (idx == -1) return -1;
+    slot->idx = idx;
+    slot->linesLeft = 1 + (int)(loadgenRandom(seed) % (uint32_t)cfg->maxLines);
+    return 0;
+}
+
+/*
+ * Keeps cfg->openOrders orders in flight and steps a random one each time: add its next line, now
+ * and then change or drop a line or preview the bill, and bill it once all its lines are in.
+ */
+static int runServiceDay(const ServiceDayConfig *cfg, char (*codes)[CODE_LEN], FILE *sink, uint32_t *seed, OpStats *ops) {
+    OpenOrder *open = calloc((size_t)cfg->openOrders, sizeof(OpenOrder));
+    if (!open) return -1;
+    int inFlight = 0, started = 0, billed = 0;
+    while (billed < cfg->ordersPerDay) {
+        while (inFlight < cfg->openOrders && started < cfg->ordersPerDay) {
+            if (openSyntheticOrder(cfg, seed, ops, &open[inFlight]) != 0) break;
+            inFlight++;
+            started++;
+        }
+        if (inFlight == 0) break;
+        int k = (int)(loadgenRandom(seed) % (uint32_t)inFlight);
+        OpenOrder *oo = &open[k];
+        Order *o = orderAt(oo->idx);
+        uint32_t roll = loadgenRandom(seed) % 100;
+        uint64_t t0 = monotonicNs();
+        if (oo->linesLeft > 0) {
+            const char *code = codes[loadgenRandom(seed) % (uint32_t)cfg->menuItems];
+            addItemToOrder(oo->idx, code, 1 + (int)(loadgenRandom(seed) % 3));
+            timedOp(&ops[OP_ADD], t0);
+            oo->linesLeft--;
+        } else if (roll < 15 && o->itemCount > 0) {
+            const char *code = menuCodes[o->items[loadgenRandom(seed) % o->itemCount].menuIdx];
+            updateItemQtyInOrder(oo->idx, code, 1 + (int)(loadgenRandom(seed) % 5));
+            timedOp(&ops[OP_QTY], t0);
+        } else if (roll < 20 && o->itemCount > 1) {
+            const char *code = menuCodes[o->items[loadgenRandom(seed) % o->itemCount].menuIdx];
+            removeItemFromOrder(oo->idx, code);
+            timedOp(&ops[OP_REMOVE], t0);
+        } else if (roll < 40) {
+            calculateBill(oo->idx);
+            timedOp(&ops[OP_PREVIEW], t0);
+        } else {
+            if (o->itemCount == 0) addItemToOrder(oo->idx, codes[0], 1);
+            t0 = monotonicNs();
+            printBill(sink, oo->idx);
+            timedOp(&ops[OP_BILL], t0);
+            billed++;
+            *oo = open[--inFlight];
+        }
+    }
+    free(open);
+    return billed;
+}
+
+static int runServiceDays(const ServiceDayConfig *cfg) {
+    char (*codes)[CODE_LEN] = buildSyntheticMenu(cfg->menuItems);
+    if (!codes) { printf("Cannot build a %d item menu.\n", cfg->menuItems); return 1; }
+    floorReset();
+    if (floorAddSection(0, "Bench", cfg->tables, FLOOR_DEFAULT_SEATS) != 0) {
+        printf("Cannot lay out %d tables.\n", cfg->tables);
+        free(codes);
+        return 1;
+    }
+    if (cfg->receiptsOn) {
+        if (receiptWriterStart(cfg->receipts) != 0) printf("Receipt writer unavailable; saving receipts inline.\n");
+        if (cfg->receipts != RECEIPTS_ARCHIVE) addReceiptSink(archiveReceiptSink, NULL);
+    }
+    FILE *sink = fopen("/dev/null", "w");
+    if (!sink) { printf("Cannot open /dev/null\n"); free(codes); return 1; }
+    OpStats ops[OP_COUNT];
+    memset(ops, 0, sizeof(ops));
+    for (int i=0;i<OP_COUNT;i++) snprintf(ops[i].name, sizeof(ops[i].name), "%s", benchOpNames[i]);
+    uint32_t seed = cfg->seed ? cfg->seed : 1;
+    printf("Service day benchmark: %d days x %d orders, %d menu items, 1-%d lines, %.0f%% dine-in, %d tables, %d open\n",
+           cfg->days, cfg->ordersPerDay, cfg->menuItems, cfg->maxLines, cfg->dineInRatio * 100, cfg->tables, cfg->openOrders);
+    for (int d=0;d<cfg->days;d++) {
+        uint64_t before = 0;
+        for (int i=0;i<OP_COUNT;i++) before += ops[i].hist.total;
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        int billed = runServiceDay(cfg, codes, sink, &seed, ops);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        uint64_t after = 0;
+        for (int i=0;i<OP_COUNT;i++) after += ops[i].hist.total;
+        double ms = elapsedMs(t0, t1);
+        printf("Day %d: %d orders billed, %llu ops in %.1f ms (%.0f ops/s, %.0f orders/s)\n", d + 1, billed,
+               (unsigned long long)(after - before), ms, ms > 0 ? (after - before) / ms * 1e3 : 0.0,
+               ms > 0 ? billed / ms * 1e3 : 0.0);
+        if (billed < cfg->ordersPerDay) { printf("Stopped early: orders could not be created.\n"); break; }
+    }
+    printOpStats(ops, OP_COUNT);
+    fclose(sink);
+    if (cfg->receiptsOn) receiptWriterStop();
+    free(codes);
+    return 0;
+}
+
+/* Times each line of a --batch command file through runCommand, grouped by the command word. */
+static int runReplay(const char *path) {
+    FILE *in = fopen(path, "r");
+    if (!in) { printf("Cannot open %s\n", path); return 1; }
+    FILE *sink = fopen("/dev/null", "w");
+    if (!sink) { fclose(in); printf("Cannot open /dev/null\n"); return 1; }
+    OpStats ops[BENCH_MAX_VERBS];
+    memset(ops, 0, sizeof(ops));
+    int verbs = 0, lines = 0;
+    char line[COMMAND_LINE_LEN];
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (fgets(line, sizeof(line), in)) {
+        char verb[BENCH_VERB_LEN] = "";
+        sscanf(line, "%15s", verb);
+        if (verb[0] == '\0' || verb[0] == '#') continue;
+        for (char *p = verb; *p; p++) if (*p >= 'a' && *p <= 'z') *p = (char)(*p - 'a' + 'A');
+        int v = 0;
+        while (v < verbs && strcmp(ops[v].name, verb) != 0) v++;
+        if (v == verbs) {
+            if (verbs == BENCH_MAX_VERBS) v = verbs - 1;
+            else snprintf(ops[verbs++].name, BENCH_VERB_LEN, "%s", verb);
+        }
+        uint64_t start = monotonicNs();
+        int quit = runCommand(line, sink);
+        timedOp(&ops[v], start);
+        lines++;
+        if (quit) break;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ms = elapsedMs(t0, t1);
+    printf("Replayed %d commands from %s in %.1f ms (%.0f commands/s)\n", lines, path, ms, ms > 0 ? lines / ms * 1e3 : 0.0);
+    printOpStats(ops, verbs);
+    fclose(sink);
+    fclose(in);
+    return 0;
+}
+
+/* What %.2f printed for a non-negative float amount, in paise. */
+static Money floatPaise(float x) {
+    char buf[MONEY_STR_LEN];
+    long long rupees;
+    int paise;
+    snprintf(buf, sizeof(buf), "%.2f", x);
+    sscanf(buf, "%lld.%d", &rupees, &paise);
+    return RUPEES(rupees) + paise;
+}
+
+/* The amounts calculateBill computed in float before they became integer paise. */
+typedef struct {
+    float subtotal;
+    float gst;
+    float serviceCharge;
+    float discount;
+    float total;
+} FloatBill;
+
+static FloatBill floatBill(const Order *o) {
+    FloatBill b;
+    float foodSubtotal = 0.0f;
+    b.subtotal = 0.0f;
+    for (int i=0;i<o->itemCount;i++) {
+        float line = (float)o->items[i].unitPrice / 100.0f * (float)o->items[i].qty;
+        b.subtotal += line;
+        if (o->items[i].category != BEVERAGE) foodSubtotal += line;
+    }
+    b.gst = foodSubtotal * 0.05f;
+    b.serviceCharge = o->dineIn ? b.subtotal * 0.10f : 0.0f;
+    float temp = b.subtotal + b.gst + b.serviceCharge;
+    b.discount = temp > 2000.0f ? temp * 0.15f : temp > 1000.0f ? temp * 0.10f : 0.0f;
+    b.total = temp - b.discount;
+    return b;
+}
+
+/*
+ * Whether an integer amount matches what the float path printed: exactly, or one paisa apart where
+ * the amount came to a half paisa, which applyRateBp rounds up and %.2f of the float rounded either way.
+ */
+static int moneyAgrees(float x, Money m) {
+    Money printed = floatPaise(x);
+    double cents = (double)x * 100.0;
+    double half = cents - (double)(long long)cents - 0.5;
+    return printed == m || (llabs(printed - m) == 1 && half > -1e-3 && half < 1e-3);
+}
+
+/*
+ * Differential check of the integer money path against the float one it replaced. Each part of the
+ * bill must agree as moneyAgrees says; TOTAL may also be one paisa off anywhere, since the float
+ * total was not the sum of its own printed parts. Returns the parts that disagree beyond that.
+ */
+static int countMoneyDiffs(const Order *o, const Bill *b, int *totalDrift) {
+    FloatBill f = floatBill(o);
+    Money total = floatPaise(f.total);
+    int diffs = !moneyAgrees(f.subtotal, b->subtotal) + !moneyAgrees(f.gst, b->gst)
+              + !moneyAgrees(f.serviceCharge, b->serviceCharge) + !moneyAgrees(f.discount, b->discount)
+              + (llabs(total - b->total) > 1);
+    *totalDrift += total != b->total;
+    if (diffs) {
+        char amt[2][MONEY_STR_LEN];
+        printf("KOT %d: float total %s, integer total %s\n", o->orderId, formatMoney(total, amt[0]), formatMoney(b->total, amt[1]));
+    }
+    return diffs;
+}
+
+static int runMoneyCheck(const char *samplePath) {
+    static char receipt[RECEIPT_BUF_LEN];
+    int failures = 0, drift = 0;
+    int idx = createOrder(1, 23);
+    if (idx == -1 || addItemToOrder(idx, "S01", 2) != 0 || addItemToOrder(idx, "M03", 3) != 0) {
+        printf("Cannot rebuild the sample order.\n");
+        return 1;
+    }
+    Bill b = calculateBill(idx);
+    failures += countMoneyDiffs(orderAt(idx), &b, &drift);
+    int len = renderReceipt(receipt, sizeof(receipt), orderAt(idx), b);
+    closeOrder(idx);
+    receipt[len] = '\0';
+    FILE *f = fopen(samplePath, "r");
+    if (!f) { printf("Cannot open %s\n", samplePath); return 1; }
+    char line[COMMAND_LINE_LEN];
+    const char *ours = receipt;
+    int lineNo = 0;
+    while (fgets(line, sizeof(line), f)) {
+        size_t n = strcspn(ours, "\n");
+        lineNo++;
+        /* the sample was billed at another time; everything else must match */
+        if (strncmp(line, "Date/Time:", 10) != 0 && (strlen(line) != n + 1 || strncmp(line, ours, n) != 0)) {
+            printf("%s line %d differs:\n  %s  %.*s\n", samplePath, lineNo, line, (int)n, ours);
+            failures++;
+        }
+        ours += n + (ours[n] == '\n');
+    }
+    fclose(f);
+    if (*ours) { printf("Receipt has lines past the end of %s\n", samplePath); failures++; }
+
+    const MenuCatalog *menu = menuPin();
+    uint32_t seed = 42;
+    const int orders = 400;
+    for (int k=0;k<orders;k++) {
+        idx = createOrder(0, 0);
+        if (idx == -1) { printf("Failed to create order.\n"); menuUnpin(); return 1; }
+        orderAt(idx)->dineIn = k & 1;
+        int lines = 1 + (int)(loadgenRandom(&seed) % 8);
+        for (int i=0;i<lines;i++) addItemToOrder(idx, menu->items[loadgenRandom(&seed) % (uint32_t)menu->itemCount].code, 1 + (int)(loadgenRandom(&seed) % 4));
+        b = calculateBill(idx);
+        failures += countMoneyDiffs(orderAt(idx), &b, &drift);
+        orderAt(idx)->dineIn = 0;
+        closeOrder(idx);
+    }
+    menuUnpin();
+    printf("Money check: %s and %d random orders, float vs integer paise: %d differences, %d one-paisa TOTAL drifts\n",
+           samplePath, orders, failures, drift);
+    return failures != 0;
+}
+
+static int runMicro(const char *name) {
+    if (strcmp(name, "batch") == 0) return runBatchBillingBenchmark();
+    if (strcmp(name, "render") == 0) return runRenderBenchmark();
+    if (strcmp(name, "scan") == 0) return runScanBenchmark();
+    if (strcmp(name, "pricing") == 0) return runPricingBenchmark();
+    if (strcmp(name, "menu") == 0) return runMenuBenchmark();
+    if (strcmp(name, "kitchen") == 0) return runKitchenBenchmark(KITCHEN_BENCH_TICKETS);
+    if (strcmp(name, "sales") == 0) return runSalesBenchmark(SALES_BENCH_ROWS);
+    if (strcmp(name, "consolidate") == 0) return runConsolidationBenchmark(CONSOLIDATE_BENCH_OUTLETS);
+    if (strcmp(name, "stock") == 0) return runStockBenchmark(STOCK_BENCH_OPS);
+    if (strcmp(name, "money") == 0) return runMoneyCheck("receipt_9001.txt");
+    printf("Unknown benchmark %s\n", name);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    ServiceDayConfig cfg = { 3, 20000, 500, 8, 0.6, 200, 0, 42, RECEIPTS_PER_FILE, 0 };
+    const char *replayFile = NULL;
+    initMenu();
+    kitchenStart();
+    for (int i=1;i<argc;i++) {
+        int *intOpt = NULL;
+        if (strcmp(argv[i], "--days") == 0) intOpt = &cfg.days;
+        else if (strcmp(argv[i], "--orders") == 0) intOpt = &cfg.ordersPerDay;
+        else if (strcmp(argv[i], "--menu-items") == 0) intOpt = &cfg.menuItems;
+        else if (strcmp(argv[i], "--items") == 0) intOpt = &cfg.maxLines;
+        else if (strcmp(argv[i], "--tables") == 0) intOpt = &cfg.tables;
+        else if (strcmp(argv[i], "--open") == 0) intOpt = &cfg.openOrders;
+        if (intOpt) {
+            if (i+1 >= argc || parseInt(argv[++i], intOpt) != 0 || *intOpt < 1) {
+                printf("%s needs a positive number\n", argv[i-1]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--dine-in") == 0 && i+1 < argc) {
+            char *end;
+            cfg.dineInRatio = strtod(argv[++i], &end);
+            if (*end != '\0' || cfg.dineInRatio < 0 || cfg.dineInRatio > 1) { printf("--dine-in takes 0..1\n"); return 1; }
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i+1 < argc) cfg.seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--receipts") == 0 && i+1 < argc) {
+            i++;
+            cfg.receiptsOn = 1;
+            if (strcmp(argv[i], "file") == 0) cfg.receipts = RECEIPTS_PER_FILE;
+            else if (strcmp(argv[i], "segment") == 0) cfg.receipts = RECEIPTS_SEGMENT;
+            else if (strcmp(argv[i], "archive") == 0) cfg.receipts = RECEIPTS_ARCHIVE;
+            else { printf("Unknown receipts mode %s (file|segment|archive)\n", argv[i]); return 1; }
+        }
+        else if (strcmp(argv[i], "--replay") == 0 && i+1 < argc) replayFile = argv[++i];
+        else if (strcmp(argv[i], "--micro") == 0 && i+1 < argc) return runMicro(argv[++i]);
+        else { usage(); return strcmp(argv[i], "--help") == 0 ? 0 : 1; }
+    }
+    if (cfg.menuItems > BENCH_MAX_MENU_ITEMS) { printf("At most %d menu items.\n", BENCH_MAX_MENU_ITEMS); return 1; }
+    if (cfg.maxLines > MAX_ITEMS_PER_ORDER) { printf("At most %d lines per order.\n", MAX_ITEMS_PER_ORDER); return 1; }
+    if (cfg.tables > MAX_TABLES) { printf("At most %d tables.\n", MAX_TABLES); return 1; }
+    if (cfg.openOrders == 0) cfg.openOrders = cfg.tables;
+    if (replayFile) return runReplay(replayFile);
+    return runServiceDays(&cfg);
+}
@@ -1,441 +1,7308 @@
 
 
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <time.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
-#define MAX_MENU 80
-#define MAX_ORDERS 500
+#define MAX_MENU 65536
+#define MENU_HASH_SIZE (1 << 17)
+#define MENU_GRAM_MIN_SIZE 4096
+#define MENU_SEARCH_MAX 20
+#define MENU_MAGIC 0x314D4252u
+#define MENU_PATH_LEN 256
+#define MENU_POLL_MS 1000
 #define MAX_ITEMS_PER_ORDER 60
-#define MAX_TABLES 50
+#define MAX_SHARE_WAYS 100
+#define ORDER_SLAB_SIZE 256
+#define MAX_ORDER_SLABS 16384
+#define ITEM_CLASS_MIN 4
+#define ITEM_CLASS_COUNT 5
+#define MAX_LINE_QTY 8191
+#define MAX_UNIT_PRICE INT32_MAX
+#define ITEM_ARENA_BYTES 65536
+#define KOT_INDEX_MIN_SIZE 64
+#define KOT_SHARD_BITS 4
+#define KOT_SHARDS (1 << KOT_SHARD_BITS)
+#define BENCH_ROUNDS 3
+#define COMMAND_LINE_LEN 256
+#define COMMAND_MAX_TOKENS 8
+#define BATCH_OUTPUT_BUFFER (1 << 16)
+#define JOURNAL_MAGIC 0x314A4252u
+#define SNAPSHOT_MAGIC 0x31534252u
+#define JOURNAL_BUFFER_RECORDS 256
+#define JOURNAL_GROUP_MS 20
+#define JOURNAL_SNAPSHOT_RECORDS 20000
+#define JOURNAL_PATH_LEN 256
+#define RECEIPT_BUF_LEN 8192
+#define RECEIPT_TITLE "               BILL / RECEIPT           \n"
+#define PAYMENT_TITLE "              PART PAYMENT              \n"
+#define RECEIPT_QUEUE_SIZE 64
+#define RECEIPT_WRITE_BATCH 16
+#define RECEIPT_SEGMENT_BYTES (64L << 20)
+#define RECEIPT_IDLE_SLEEP_NS 1000000L
+#define MAX_RECEIPT_SINKS 4
+#define RECEIPT_RECORD_MAGIC 0x31524352u
+#define RECEIPT_INDEX_MAGIC 0x31495252u
+#define RECEIPT_DAY_MAX_BILLS 65536
+#define RECEIPT_INDEX_BITS 17           /* twice the day's bills, so probes stay short and always meet an empty slot */
+#define RECEIPT_INDEX_SLOTS (1 << RECEIPT_INDEX_BITS)
+#define RECEIPT_DAY_LEN 16
+#define RECEIPT_PATH_LEN 320
+#define SPOOL_DIR_LEN 200
+#define MAX_TABLES 4096
+#define FLOOR_WORDS (MAX_TABLES / 64)
+#define FLOOR_DEFAULT_TABLES 50
+#define FLOOR_DEFAULT_SEATS 4
+#define FLOOR_MAX_SECTIONS 256
+#define FLOOR_MAX_SEATS 32
+#define SECTION_NAME_LEN 32
+#define SERVER_BACKLOG 64
+#define MAX_SERVER_CLIENTS 256
+#define SERVER_POLL_MS 250
+#define LOADGEN_MAX_CLIENTS 64
+#define LOADGEN_DEFAULT_OPS 20000
+#define SALES_DIR_LEN 200
+#define SALES_BUFFER_ROWS 4096
+#define SALES_FLUSH_MS 1000
+#define SALES_MAX_ITEMS 65535
+#define SALES_MAX_THREADS 64
+#define SALES_MIN_ROWS_PER_THREAD 65536
+#define SALES_BENCH_ROWS 30000000
+#define CONSOLIDATE_MAX_THREADS 64
+#define CONSOLIDATE_BENCH_OUTLETS 128
+#define CONSOLIDATE_BENCH_ORDERS 1500
+#define KITCHEN_STATIONS 4
+#define KITCHEN_RING_SIZE 4096
+#define KITCHEN_FULL_WAIT_MS 50
+#define KITCHEN_PICKUP_MAX 64
+#define KITCHEN_BENCH_TICKETS 1000000
+#define STOCK_MAX 4096
+#define STOCK_MAX_USES 16384
+#define STOCK_ITEM_USES 8
+#define STOCK_SHARDS 8
+#define STOCK_NAME_LEN 24
+#define STOCK_MAX_UNITS 1000000000
+#define STOCK_RECONCILE_MS 1000
+#define STOCK_BENCH_OPS 1000000
+#define PRICING_MAX_TIERS 256
+#define PRICING_MAX_HAPPY 256
+#define PRICING_MAX_COMBOS 1024
+#define PRICING_MAX_COUPONS 1024
+#define PRICING_COMBO_ITEMS 4
+#define PRICING_SLOT_MINUTES 15
+#define PRICING_WEEK_SLOTS (7 * 24 * 60 / PRICING_SLOT_MINUTES)
+#define PRICING_BENCH_ORDERS 200000
+#define LATENCY_SUB_BITS 4
+#define LATENCY_BUCKETS (64 << LATENCY_SUB_BITS)
+#define METRICS_PATH_LEN 256
+#define METRICS_DUMP_MS 10000
 
 #define CODE_LEN 6   
 #define NAME_LEN 64
 #define RECEIPT_FILENAME_LEN 64
+#define MONEY_STR_LEN 24
+#define COUPON_LEN 16
+#define TAX_LABEL_LEN 32
 
+/* money is held in integer paise; rates are in basis points (1/100 of a percent) */
+#define RUPEES(r) ((Money)(r) * 100)
+#define RATE_BP_SCALE 10000
 
-#define GST_RATE_FOOD 0.05f
-#define SERVICE_RATE 0.10f
-#define DISCOUNT_TIER1_THRESHOLD 1000.0f
-#define DISCOUNT_TIER1_RATE 0.10f
-#define DISCOUNT_TIER2_THRESHOLD 2000.0f
-#define DISCOUNT_TIER2_RATE 0.15f
+#define GST_RATE_FOOD_BP 500
+#define SERVICE_RATE_BP 1000
+#define DISCOUNT_TIER1_THRESHOLD RUPEES(1000)
+#define DISCOUNT_TIER1_RATE_BP 1000
+#define DISCOUNT_TIER2_THRESHOLD RUPEES(2000)
+#define DISCOUNT_TIER2_RATE_BP 1500
+
+#define CATEGORY_COUNT 4
+#define CATEGORY_BIT(c) (1u << (c))
+#define FOOD_CATEGORY_MASK (CATEGORY_BIT(STARTER) | CATEGORY_BIT(MAIN_COURSE) | CATEGORY_BIT(DESSERT))
+
+typedef int64_t Money;
 
 typedef enum { STARTER=1, MAIN_COURSE=2, BEVERAGE=3, DESSERT=4 } Category;
 
+/* Also the on-disk record of a compiled catalog file, so a mapped file is used in place. */
 typedef struct {
-    char code[CODE_LEN];
+    char code[8];
     char name[NAME_LEN];
-    Category category;
-    float price;
-    int available;   
+    Money price;
+    uint16_t outlet;             /* 0 = every outlet */
+    uint8_t category;
+    _Atomic uint8_t available;
+    uint32_t reserved;
 } MenuItem;
 
-typedef struct {
-    char code[CODE_LEN];
-    int qty;
-} OrderItem;
+_Static_assert(sizeof(MenuItem) == 88, "MenuItem is a file format");
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t itemCount;
+    uint32_t reserved;
+} MenuFileHeader;
+
+/* A 2- or 3-byte run of lowercase item text and the view positions it occurs at. */
+typedef struct {
+    uint32_t key;                /* bytes packed high to low; 0 = empty slot */
+    uint32_t start;              /* first of count entries in MenuCatalog.postings */
+    uint32_t count;
+    uint32_t last;               /* while building: position + 1 last counted */
+} MenuGram;
+
+/*
+ * One immutable version of the menu; byId maps interned menu ids to this version's records.
+ * view holds the same records grouped by category in menu order, and the search index is built
+ * over it once per version. Only availableBits changes afterwards, flipped with each toggle.
+ */
+typedef struct {
+    MenuItem *items;
+    int itemCount;
+    MenuItem **byId;
+    int idCount;
+    uint64_t version;
+    void *map;
+    size_t mapLen;
+    MenuItem **view;
+    int viewCount;
+    int categoryStart[CATEGORY_COUNT + 1];     /* view range of each category - STARTER */
+    int *viewPos;                              /* by menu id, -1 = not on this menu */
+    _Atomic uint64_t *availableBits;           /* by view position */
+    char *searchText;                          /* " code name" lowercased, by view position */
+    int *searchOffset;
+    MenuGram *grams;                           /* open-addressed by key */
+    int gramSize;
+    uint32_t *postings;                        /* ascending view positions per gram */
+} MenuCatalog;
+
+/*
+ * One order line in 8 bytes: the interned menu id (MAX_MENU fits 16 bits), the qty packed with
+ * the category, and the unit price in paise. unitPrice and category are taken from the menu
+ * when the line is first added.
+ */
+typedef struct {
+    int32_t unitPrice;
+    uint16_t menuIdx;
+    uint16_t qty : 13;           /* up to MAX_LINE_QTY */
+    uint16_t category : 3;
+} OrderItem;
+
+/*
+ * The hot part of an order: everything listing, table status and billing read, 64 bytes (one
+ * cache line) per order and packed together in the slab. The lock and the free/active list back links live
+ * apart in OrderCold so scans do not drag them through the cache.
+ */
+typedef struct {
+    int orderId;
+    int16_t tableNumber;
+    uint8_t dineIn;
+    uint8_t active;
+    uint8_t itemCount;
+    uint8_t itemCapacity;
+    uint16_t reserved;
+    int nextActive;
+    OrderItem *items;
+    Money categorySubtotal[CATEGORY_COUNT];    /* running line totals by category - STARTER */
+    time_t timestamp;
+} Order;
+
+typedef struct {
+    pthread_mutex_t lock;
+    int prevActive;
+    int nextFree;
+    Money paid;                  /* part payments taken so far */
+    uint64_t paidLines;          /* bit i = items[i] paid for by item */
+    int16_t shareWays;           /* the even split in progress, 0 if none */
+    int16_t sharesPaid;          /* shares of it taken so far */
+} OrderCold;
+
+_Static_assert(sizeof(OrderItem) == 8, "order lines are packed to 8 bytes");
+_Static_assert(MAX_ITEMS_PER_ORDER <= (ITEM_CLASS_MIN << (ITEM_CLASS_COUNT - 1)) && (ITEM_CLASS_MIN << (ITEM_CLASS_COUNT - 1)) <= 255,
+               "itemCount and itemCapacity fit a byte");
+_Static_assert(MAX_TABLES <= INT16_MAX, "table numbers fit 16 bits");
+_Static_assert(MAX_ITEMS_PER_ORDER <= 64, "an order's lines fit a 64-bit mask");
+
+typedef struct {
+    int orderId;
+    int orderIdx;
+} KotIndexEntry;
+
+/* One slice of the KOT index and active list; a KOT lives in shard (orderId & (KOT_SHARDS-1)). */
+typedef struct {
+    _Alignas(64) pthread_mutex_t lock;
+    KotIndexEntry *index;
+    int indexSize;
+    int indexUsed;
+    int activeHead;
+    int activeTail;
+} KotShard;
+
+typedef struct {
+    int outlet;
+    char name[SECTION_NAME_LEN];
+    int firstTable;
+    int tableCount;
+    int seats;
+} FloorSection;
+
+/* Something counted down as it is ordered: a menu item's own portions or a recipe ingredient. */
+typedef struct {
+    char name[STOCK_NAME_LEN];   /* the item code, or the ingredient's name */
+    int menuId;                  /* -1 for an ingredient */
+    int32_t need;                /* most any one item takes per unit; less than this left = out */
+} StockResource;
+
+/* One item's draw on one resource; the uses of an item are adjacent. */
+typedef struct {
+    uint16_t menuId;
+    uint16_t resource;
+    int32_t perUnit;
+} StockUse;
+
+/* One slice of every resource's count; a thread reserves from its own slice and only pools the others when that runs short. */
+typedef struct {
+    _Alignas(64) _Atomic int32_t units[STOCK_MAX];
+} StockShard;
+
+/* MERGE / SPLIT / MOVE carry the table they act on in the record's qty field. */
+typedef enum {
+    JOURNAL_CREATE=1, JOURNAL_ADD=2, JOURNAL_REMOVE=3, JOURNAL_UPDATE=4, JOURNAL_CLOSE=5,
+    JOURNAL_MERGE=6, JOURNAL_SPLIT=7, JOURNAL_MOVE=8, JOURNAL_PAY=9
+} JournalEventType;
+typedef enum { FSYNC_NONE=0, FSYNC_BATCH=1, FSYNC_ALWAYS=2 } FsyncPolicy;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t generation;
+} JournalHeader;
+
+typedef struct {
+    uint8_t type;
+    uint8_t dineIn;
+    uint8_t category;
+    uint8_t reserved;
+    int32_t orderId;
+    int32_t tableNumber;
+    int32_t qty;
+    int64_t timestamp;
+    int64_t price;
+    char code[8];
+    uint32_t reserved2;
+    uint32_t checksum;
+} JournalRecord;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t generation;
+    int32_t nextOrderId;
+    int32_t orderCount;
+} SnapshotHeader;
+
+/*
+ * Version 1 snapshots end each order at timestamp; version 2 adds the merged tables, listed after the
+ * lines, and version 3 the part payments.
+ */
+typedef struct {
+    int32_t orderId;
+    int32_t dineIn;
+    int32_t tableNumber;
+    int32_t itemCount;
+    int64_t timestamp;
+    int32_t linkedTables;
+    int16_t shareWays;           /* 0 before version 3 */
+    int16_t sharesPaid;
+    int64_t paid;
+    uint64_t paidLines;
+} SnapshotOrder;
+
+typedef struct {
+    char code[8];
+    int32_t qty;
+    int32_t category;            /* 0 in older snapshots: take it from the menu */
+    int64_t price;
+} SnapshotLine;
+
+typedef enum { RECEIPTS_PER_FILE=0, RECEIPTS_SEGMENT=1, RECEIPTS_ARCHIVE=2 } ReceiptMode;
+typedef enum { RECEIPT_TARGET_ARCHIVE=0, RECEIPT_TARGET_SPOOL=1, RECEIPT_TARGET_RECORD=2 } ReceiptTarget;
+
+/*
+ * One bill in a daily archive segment (receipts_YYYY-MM-DD.rcp), followed by lineCount
+ * ReceiptRecordLines. Item codes and names and the tax label are ids into the day's .dict file,
+ * so a receipt takes a fraction of its text and is re-rendered on demand.
+ */
+typedef struct {
+    uint32_t magic;
+    int32_t orderId;
+    int16_t tableNumber;
+    uint8_t dineIn;
+    uint8_t lineCount;
+    uint16_t taxLabel;
+    int16_t discountBp;
+    int64_t openedAt;
+    int64_t billedAt;
+    int64_t subtotal;
+    int64_t gst;
+    int64_t serviceCharge;
+    int64_t discount;
+    int64_t total;
+    int64_t happyHour;
+    int64_t combo;
+    int64_t coupon;
+    char couponCode[COUPON_LEN];
+} ReceiptRecord;
+
+typedef struct {
+    uint16_t item;               /* dictionary id of "code|name"; the menu id while queued */
+    uint16_t qty;
+    int32_t unitPrice;
+} ReceiptRecordLine;
+
+/* A .dict entry is this header and len bytes of text; ids count up from 0 in file order. */
+typedef struct {
+    uint16_t id;
+    uint16_t len;
+} ReceiptDictEntry;
+
+/* receipts_YYYY-MM-DD.idx: this header, then RECEIPT_INDEX_SLOTS open-addressed KOT -> offset slots. */
+typedef struct {
+    uint32_t magic;
+    uint32_t slots;
+} ReceiptIndexHeader;
+
+typedef struct {
+    int32_t orderId;             /* 0 = empty */
+    uint32_t offset;
+} ReceiptIndexSlot;
+
+_Static_assert(sizeof(ReceiptRecord) == 112 && sizeof(ReceiptRecordLine) == 8, "receipt records are a file format");
+
+typedef struct {
+    _Atomic size_t seq;
+    int target;
+    int orderId;
+    int length;
+    _Alignas(8) char data[RECEIPT_BUF_LEN];   /* holds a ReceiptRecord in archive mode */
+} ReceiptSlot;
+
+typedef void (*ReceiptSinkFn)(int orderId, const char *data, int len, void *ctx);
+
+typedef struct {
+    ReceiptSinkFn emit;
+    void *ctx;
+} ReceiptSink;
+
+typedef struct {
+    char *buf;
+    int len;
+    int cap;
+} ByteWriter;
+
+typedef struct {
+    int fd;
+    int start;
+    int end;
+    int eof;
+    char buf[BATCH_OUTPUT_BUFFER];
+} LineReader;
+
+typedef enum { SALES_KOT, SALES_TIME, SALES_TABLE, SALES_ITEM, SALES_QTY, SALES_AMOUNT, SALES_CATEGORY, SALES_COLUMNS } SalesColumn;
+typedef enum { SALES_BY_ITEM=0, SALES_BY_CATEGORY=1, SALES_BY_HOUR=2 } SalesReportKind;
+
+/* A mapped sales store; map/mapLen index SALES_COLUMNS is the item dictionary. */
+typedef struct {
+    const void *col[SALES_COLUMNS];
+    const uint64_t *dict;
+    long rows;
+    int dictCount;
+    void *map[SALES_COLUMNS + 1];
+    size_t mapLen[SALES_COLUMNS + 1];
+} SalesColumns;
+
+typedef struct {
+    const SalesColumns *cols;
+    SalesReportKind kind;
+    int64_t from;                /* time filter, [from, to) */
+    int64_t to;
+    long utcOffset;              /* hours are bucketed in this fixed offset from UTC */
+} SalesQuery;
+
+/* Bills of one local day (days since 1970-01-01), summed across however many outlets fed it. */
+typedef struct {
+    int32_t day;
+    int32_t orders;
+    Money subtotal;
+    Money happyHour;
+    Money gst;
+    Money serviceCharge;
+    Money discount;
+    Money combo;
+    Money coupon;
+    Money total;
+} DayTotals;
+
+typedef struct {
+    int32_t orderId;
+    int32_t day;
+    Money total;
+} ConsolidatedBill;
+
+/* One outlet's input and what its worker found in it, in file order. */
+typedef struct {
+    const char *path;
+    int outlet;                  /* position on the command line, from 1 */
+    off_t size;
+    ConsolidatedBill *bills;
+    int billCount;
+    int billCapacity;
+    DayTotals *days;             /* sorted by day */
+    int dayCount;
+    int dayCapacity;
+    int lastDay;
+    long records;
+    int stillOpen;
+    int failed;
+} ConsolidationTask;
+
+/* A worker's run of tasks, [head, tail) packed in one word so the owner and thieves race on a single CAS. */
+typedef struct {
+    _Alignas(64) _Atomic uint64_t range;
+} TaskDeque;
+
+/* An order replayed from another outlet's journal; items points at lines. */
+typedef struct {
+    Order order;
+    OrderItem lines[MAX_ITEMS_PER_ORDER];
+} ReplayOrder;
+
+typedef struct {
+    ReplayOrder *orders;
+    int orderCount;
+    int orderCapacity;
+    int freeHead;                /* free slots are chained through order.nextActive */
+    KotIndexEntry *index;        /* open-addressed KOT -> orders[] */
+    int indexSize;
+    int indexUsed;
+    int32_t tableKot[MAX_TABLES];    /* last KOT seated at each table; stale once that KOT is closed */
+} OutletReplay;
+
+/* Log-linear buckets: 16 linear steps per power of two, so any recorded value is within 1/16. */
+typedef struct {
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t total;
+    uint64_t maxNs;
+} LatencyHistogram;
+
+#ifdef BILLING_METRICS
+typedef enum { METRIC_CREATE_ORDER, METRIC_ADD_ITEM, METRIC_CALCULATE_BILL, METRIC_PRINT_BILL, METRIC_SAVE_RECEIPT, METRIC_OPS } MetricOp;
+
+typedef struct MetricsShard {
+    _Atomic uint64_t calls[METRIC_OPS];
+    _Atomic uint64_t sumNs[METRIC_OPS];
+    _Atomic uint64_t maxNs[METRIC_OPS];
+    _Atomic uint64_t buckets[METRIC_OPS][LATENCY_BUCKETS];
+    _Atomic int inUse;
+    struct MetricsShard *next;
+} MetricsShard;
+
+typedef struct {
+    int op;
+    uint64_t startNs;
+} MetricScope;
+
+/* Times the rest of the enclosing block, whichever return leaves it; compiles to nothing without BILLING_METRICS. */
+#define METRIC_SCOPE(op) MetricScope metricScope __attribute__((cleanup(metricScopeEnd))) = { op, monotonicNs() }
+#else
+#define METRIC_SCOPE(op) ((void)0)
+#define metricsStop() ((void)0)
+#endif
+
+/* One line change for a kitchen station; qtyDelta is negative when items are taken off. */
+typedef struct {
+    int32_t orderId;
+    int32_t tableNumber;
+    int32_t qtyDelta;
+    char code[8];
+    uint64_t enteredNs;
+} KitchenTicket;
+
+typedef struct {
+    _Alignas(64) _Atomic uint64_t head;        /* next ticket to pick up; advanced by screens */
+    _Alignas(64) _Atomic uint64_t tail;        /* next free slot; written by the one producer */
+    pthread_mutex_t producerLock;
+    uint64_t dispatched;                       /* producerLock */
+    uint64_t dropped;                          /* producerLock */
+    int stalled;                               /* producerLock: ring stayed full past the wait */
+    pthread_mutex_t statsLock;
+    uint64_t pickedUp;                         /* statsLock */
+    LatencyHistogram wait;                     /* statsLock: order entry to pickup */
+    KitchenTicket slots[KITCHEN_RING_SIZE];
+} KitchenStation;
+
+/* Every amount is positive and total = subtotal - happyHour + gst + serviceCharge - discount - combo - coupon. */
+typedef struct {
+    Money subtotal;
+    Money gst;
+    Money serviceCharge;
+    Money discount;
+    Money total;
+    Money happyHour;
+    Money combo;
+    Money coupon;
+    int discountBp;
+    char couponCode[COUPON_LEN];
+} Bill;
+
+/* Pricing rules as written in a --pricing file, before compilePricing flattens them. */
+typedef struct {
+    uint8_t days;                /* bit 0 = Sunday */
+    int fromMinute;
+    int toMinute;                /* exclusive; earlier than fromMinute when the window passes midnight */
+    int category;                /* 0 = every category */
+    int rateBp;
+} PricingHappyRule;
+
+typedef struct {
+    uint16_t item[PRICING_COMBO_ITEMS];        /* menu ids */
+    uint8_t count[PRICING_COMBO_ITEMS];
+    int itemCount;
+    uint64_t signature;                        /* bit (menu id & 63) of every item, to skip combos an order cannot hold */
+    Money saving;
+} PricingCombo;
+
+typedef struct {
+    char code[COUPON_LEN];
+    int rateBp;                  /* percent off the amount due, or 0 for a flat amount */
+    Money amount;
+    Money minTotal;
+} PricingCoupon;
+
+typedef struct {
+    int taxBp[CATEGORY_COUNT];
+    int serviceBp[2];                          /* takeaway, dine-in */
+    int tierCount;
+    Money tierAbove[PRICING_MAX_TIERS];
+    int tierBp[PRICING_MAX_TIERS];
+    int happyCount;
+    PricingHappyRule happy[PRICING_MAX_HAPPY];
+    int comboCount;
+    PricingCombo combos[PRICING_MAX_COMBOS];
+    int couponCount;
+    PricingCoupon coupons[PRICING_MAX_COUPONS];
+} PricingRules;
+
+/*
+ * Compiled rules: categories with the same tax rate share one mask, discount tiers are sorted
+ * thresholds with the rate that applies above each, and happy hours are a row index per quarter-hour
+ * of the week into the distinct per-category rates (row 0 = none). Pricing an order is a fixed
+ * run of masked sums and table lookups however many rules there are.
+ */
+typedef struct {
+    int taxRates;
+    int taxRateBp[CATEGORY_COUNT];
+    unsigned taxMask[CATEGORY_COUNT];          /* CATEGORY_BIT set */
+    char taxLabel[TAX_LABEL_LEN];
+    int serviceBp[2];
+    int tierCount;
+    Money tierAbove[PRICING_MAX_TIERS];
+    int tierRateBp[PRICING_MAX_TIERS + 1];      /* by how many thresholds the total is above */
+    int happyCount;
+    uint8_t happySlot[PRICING_WEEK_SLOTS];
+    int happyBp[PRICING_MAX_HAPPY][CATEGORY_COUNT];
+    int comboCount;
+    PricingCombo *combos;
+    int couponCount;
+    PricingCoupon *coupons;                    /* sorted by code, case-insensitively */
+    int builtin;
+} PricingTable;
+
+typedef struct {
+    Money *price;
+    int32_t *qty;
+    uint8_t *categoryMask;
+    Money *lineAmount;
+    Money *foodAmount;
+    int *lineStart;
+    uint8_t *dineIn;
+    Money *subtotal;
+    Money *foodSubtotal;
+    int orderCount;
+    int lineCount;
+    int orderCapacity;
+    int lineCapacity;
+} BillingColumns;
+
+
+static uint64_t menuKeys[MAX_MENU];
+static char menuCodes[MAX_MENU][CODE_LEN];
+static _Atomic int menuHash[MENU_HASH_SIZE];   /* menu id + 1, 0 = empty */
+static int menuIdCount = 0;
+static pthread_mutex_t menuInternLock = PTHREAD_MUTEX_INITIALIZER;
+static MenuCatalog *_Atomic menuCurrent = NULL;
+static pthread_mutex_t menuPublishLock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t menuVersion = 0;
+static _Atomic int menuPhase = 0;
+static _Atomic long menuReaders[2];
+static _Thread_local int menuPinDepth = 0;
+static _Thread_local int menuPinPhase;
+static _Thread_local const MenuCatalog *menuPinned;
+static MenuItem *menuDraft = NULL;
+static int menuDraftCount = 0;
+static int menuDraftCapacity = 0;
+static int menuOutlet = 0;
+static const PricingTable pricingBuiltin = {
+    .taxRates = 1,
+    .taxRateBp = { GST_RATE_FOOD_BP },
+    .taxMask = { FOOD_CATEGORY_MASK },
+    .taxLabel = "GST (5% on food):",
+    .serviceBp = { 0, SERVICE_RATE_BP },
+    .tierCount = 2,
+    .tierAbove = { DISCOUNT_TIER1_THRESHOLD, DISCOUNT_TIER2_THRESHOLD },
+    .tierRateBp = { 0, DISCOUNT_TIER1_RATE_BP, DISCOUNT_TIER2_RATE_BP },
+    .happyCount = 1,
+    .builtin = 1,
+};
+static const PricingTable *pricing = &pricingBuiltin;
+static char menuPath[MENU_PATH_LEN];
+static struct stat menuFileStat;
+static pthread_t menuWatcherThread;
+static int menuWatcherRunning = 0;
+static _Atomic int menuWatcherStopping = 0;
+static Order *orderSlabs[MAX_ORDER_SLABS];
+static OrderCold *orderColdSlabs[MAX_ORDER_SLABS];
+static int orderSlabCount = 0;
+static _Atomic int orderCount = 0;
+static int freeOrderHead = -1;
+static void *itemFreeLists[ITEM_CLASS_COUNT];
+static char *itemArena = NULL;
+static size_t itemArenaUsed = ITEM_ARENA_BYTES;
+static pthread_mutex_t orderPoolLock = PTHREAD_MUTEX_INITIALIZER;
+static KotShard kotShards[KOT_SHARDS];
+static _Atomic int activeOrderCount = 0;
+static _Atomic int nextOrderId = 9001;
+static _Atomic int tableOrderIndex[MAX_TABLES]; 
+static int tableLink[MAX_TABLES];              /* next table of the same party, 0 = last */
+static uint8_t tableSeats[MAX_TABLES];
+static _Atomic uint64_t floorOccupied[FLOOR_WORDS];
+static uint64_t floorSeatMask[FLOOR_MAX_SEATS + 1][FLOOR_WORDS];   /* tables with exactly that many seats */
+static FloorSection floorSections[FLOOR_MAX_SECTIONS];
+static int floorSectionCount = 0;
+static int floorTableCount = 0;
+static pthread_mutex_t floorLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t journalLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t journalSyncLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t journalCheckpointLock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic int commandsInFlight = 0;
+static _Atomic int commandGateClosed = 0;
+static pthread_mutex_t commandGateLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t commandGateOpened = PTHREAD_COND_INITIALIZER;
+static _Atomic int journalFd = -1;
+static char journalPath[JOURNAL_PATH_LEN];
+static uint64_t journalGeneration = 0;
+static off_t journalBytes = 0;                 /* header and whole records written to the current file */
+static FsyncPolicy journalFsync = FSYNC_BATCH;
+static JournalRecord journalBuf[JOURNAL_BUFFER_RECORDS];
+static int journalPending = 0;
+static struct timespec journalFirstPending;
+static long journalSinceSnapshot = 0;
+static int journalReplaying = 0;
+static uint64_t journalSeq = 0;
+static _Atomic uint64_t journalDurableSeq = 0;
+static _Thread_local uint64_t journalLastSeq = 0;
+static ReceiptSlot receiptQueue[RECEIPT_QUEUE_SIZE];
+static _Atomic size_t receiptEnqueuePos;
+static _Atomic size_t receiptDequeuePos;
+static _Atomic int receiptWriterStopping;
+static pthread_t receiptWriterThread;
+static int receiptWriterRunning = 0;
+static ReceiptMode receiptMode = RECEIPTS_PER_FILE;
+static int receiptSegmentFd = -1;
+static int receiptSegmentNo = 0;
+static long receiptSegmentBytes = 0;
+static char archiveDay[RECEIPT_DAY_LEN];        /* receipt writer only: the open archive day */
+static int archiveRecordFd = -1;
+static int archiveDictFd = -1;
+static ReceiptIndexSlot *archiveIndex = NULL;
+static int archiveIndexUsed = 0;
+static uint64_t archiveRecordBytes = 0;
+static int archiveDictCount = 0;
+static int archiveDictIds[MAX_MENU];           /* dictionary id + 1 by menu id for the open day */
+static int archiveLabelId = -1;
+static char archiveLabel[TAX_LABEL_LEN];
+static ReceiptSink receiptSinks[MAX_RECEIPT_SINKS];
+static int receiptSinkCount = 0;
+static char spoolDir[SPOOL_DIR_LEN];
+static int serverClientFds[MAX_SERVER_CLIENTS];
+static int serverClientCount = 0;
+static pthread_mutex_t serverLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t serverIdle = PTHREAD_COND_INITIALIZER;
+static volatile sig_atomic_t serverStopping = 0;
+static KitchenStation kitchenStations[KITCHEN_STATIONS];
+#ifdef BILLING_METRICS
+static MetricsShard *metricsShards = NULL;
+static pthread_mutex_t metricsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t metricsKey;
+static pthread_once_t metricsKeyOnce = PTHREAD_ONCE_INIT;
+static _Thread_local MetricsShard *metricsLocal = NULL;
+static char metricsPath[METRICS_PATH_LEN];
+static pthread_t metricsThread;
+static int metricsRunning = 0;
+static _Atomic int metricsStopping = 0;
+#endif
+static int kitchenEnabled = 0;
+static int salesStoreOpen = 0;
+static int salesFds[SALES_COLUMNS];
+static int salesDictFd = -1;
+static void *salesBuf[SALES_COLUMNS];
+static int salesPending = 0;
+static struct timespec salesFirstPending;
+static int salesDictIds[MAX_MENU];             /* sales dictionary id + 1 by menu id, 0 = not yet in the dictionary */
+static int salesDictCount = 0;
+static pthread_mutex_t salesLock = PTHREAD_MUTEX_INITIALIZER;
+static StockShard stockShards[STOCK_SHARDS];
+static StockResource stockResources[STOCK_MAX];
+static int stockResourceCount = 0;
+static StockUse stockUses[STOCK_MAX_USES];
+static int stockUseCount = 0;
+static int32_t stockUseFirst[MAX_MENU];           /* index + 1 of the item's first use, 0 = not counted */
+static _Atomic uint8_t stockHeld[MAX_MENU];       /* made unavailable by running out, not by a toggle */
+static _Atomic int stockHeldCount = 0;
+static int stockLoaded = 0;
+static pthread_mutex_t stockLock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic unsigned stockNextShard = 0;
+static _Thread_local int stockHomeShard = -1;
+static pthread_t stockReconcilerThread;
+static int stockReconcilerRunning = 0;
+static int stockReconcilerStopping = 0;
+static pthread_cond_t stockReconcilerWake = PTHREAD_COND_INITIALIZER;
+
+void initMenu(void);
+void printMenuAll(FILE *out);
+void printMenuByCategory(FILE *out, Category c);
+int searchMenu(const MenuCatalog *menu, const char *query, int availableOnly, MenuItem **out, int max);
+int printMenuSearch(FILE *out, const char *query);
+int findMenuIndexByCode(const char* code);
+int internMenuCode(const char* code);
+const MenuCatalog* menuPin(void);
+void menuUnpin(void);
+const MenuItem* menuItemById(const MenuCatalog *c, int id);
+int toggleMenuItem(const char *code, char *name);
+MenuCatalog* loadMenuCatalog(const char *path);
+int compileMenuCatalog(const char *srcPath, const char *outPath);
+int exportMenuSource(const char *path);
+int menuOpen(const char *path);
+void menuClose(void);
+Order* orderAt(int orderIdx);
+int createOrder(int dineIn, int tableNumber);
+void closeOrder(int orderIdx);
+void releaseOrder(int orderIdx);
+int lockOrderById(int orderId);
+void unlockOrder(int orderIdx);
+int journalOpen(const char *path, FsyncPolicy policy);
+void journalCommit(void);
+void journalSync(void);
+int journalCheckpoint(void);
+void journalClose(void);
+int addItemToOrder(int orderIdx, const char* code, int qty);
+int removeItemFromOrder(int orderIdx, const char* code);
+int updateItemQtyInOrder(int orderIdx, const char* code, int newQty);
+Money applyRateBp(Money amount, int rateBp);
+char* formatMoney(Money m, char *buf);
+int compilePricing(const PricingRules *rules, PricingTable *t);
+const PricingCoupon* findCoupon(const char *code);
+Bill calculateBill(int orderIdx);
+Bill calculateBillWithCoupon(int orderIdx, const PricingCoupon *coupon);
+int buildBillingColumns(BillingColumns *cols, const int *orderIdxs, int n);
+void computeBillsBatch(BillingColumns *cols, Bill *out);
+void freeBillingColumns(BillingColumns *cols);
+void printBill(FILE *out, int orderIdx);
+void printBillWithCoupon(FILE *out, int orderIdx, const PricingCoupon *coupon);
+void printOrderDetails(FILE *out, int orderIdx);
+int payOrder(FILE *out, int orderIdx, uint64_t lines, int ways, Money amount, Money *taken, Money *balance);
+void saveReceiptToFile(int orderIdx, Bill b);
+int renderReceipt(char *buf, int cap, const Order *o, Bill b);
+int addReceiptSink(ReceiptSinkFn emit, void *ctx);
+void archiveReceiptSink(int orderId, const char *data, int len, void *ctx);
+void spoolReceiptSink(int orderId, const char *data, int len, void *ctx);
+int receiptWriterStart(ReceiptMode mode);
+int reprintReceipt(const char *dir, int orderId, const char *day, FILE *out);
+void receiptWriterStop(void);
+int salesOpen(const char *dir);
+void salesRecordOrder(const Order *o);
+void salesFlush(void);
+void salesClose(void);
+int salesMap(const char *dir, SalesColumns *cols);
+void salesUnmap(SalesColumns *cols);
+int salesAggregate(const SalesQuery *q, int threads, Money *amount, int64_t *qty);
+int runSalesReport(const char *dir, const char *kindName, const char *fromDate, const char *toDate);
+int runConsolidation(const char *outPrefix, char **paths, int count);
+int kitchenPickup(int station, KitchenTicket *out, int max);
+void kitchenStart(void);
+void showKitchenStatus(FILE *out);
+int stockOpen(const char *path, int outlet);
+void stockClose(void);
+int addStock(const char *name, int units);
+void showStock(FILE *out);
+void listActiveOrders(FILE *out);
+int findOrderIndexById(int orderId);
+void showTableStatus(FILE *out);
+int findFreeTable(int covers, int section);
+int mergeTable(int orderId, int table);
+int splitTable(int orderId, int table);
+int moveOrder(int orderId, int table);
+int loadFloorMap(const char *path, int outlet);
+int loadPricingRules(const char *path, int outlet);
+void clearInputBuffer(void);
+int runCommand(char *line, FILE *out);
+int runBatch(FILE *in, FILE *out);
+int runServer(const char *path);
+int runLoadgen(const char *path, int opsPerClient);
+void latencyRecord(LatencyHistogram *h, uint64_t ns);
+void latencyMerge(LatencyHistogram *into, const LatencyHistogram *from);
+uint64_t latencyPercentile(const LatencyHistogram *h, double pct);
+#ifdef BILLING_METRICS
+void writeMetrics(FILE *out);
+int metricsStart(const char *path);
+void metricsStop(void);
+#endif
+
+
+
+void clearInputBuffer(void) {
+    int c;
+    while ((c = getchar()) != '\n' && c != EOF) { }
+}
+
+static uint64_t monotonicNs(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ull + (uint64_t)t.tv_nsec;
+}
+
+static int latencyBucket(uint64_t ns) {
+    if (ns < (1u << LATENCY_SUB_BITS)) return (int)ns;
+    int shift = 63 - __builtin_clzll(ns) - LATENCY_SUB_BITS;
+    return ((shift + 1) << LATENCY_SUB_BITS) + (int)((ns >> shift) & ((1u << LATENCY_SUB_BITS) - 1));
+}
+
+static uint64_t latencyBucketValue(int bucket) {
+    if (bucket < (1 << LATENCY_SUB_BITS)) return (uint64_t)bucket;
+    int shift = (bucket >> LATENCY_SUB_BITS) - 1;
+    return (uint64_t)((1 << LATENCY_SUB_BITS) + (bucket & ((1 << LATENCY_SUB_BITS) - 1))) << shift;
+}
+
+void latencyRecord(LatencyHistogram *h, uint64_t ns) {
+    h->counts[latencyBucket(ns)]++;
+    h->total++;
+    if (ns > h->maxNs) h->maxNs = ns;
+}
+
+void latencyMerge(LatencyHistogram *into, const LatencyHistogram *from) {
+    for (int i=0;i<LATENCY_BUCKETS;i++) into->counts[i] += from->counts[i];
+    into->total += from->total;
+    if (from->maxNs > into->maxNs) into->maxNs = from->maxNs;
+}
+
+/* Lower edge of the bucket holding the given percentile (0..100). */
+uint64_t latencyPercentile(const LatencyHistogram *h, double pct) {
+    if (h->total == 0) return 0;
+    uint64_t rank = (uint64_t)((double)h->total * pct / 100.0);
+    if (rank >= h->total) rank = h->total - 1;
+    uint64_t seen = 0;
+    for (int i=0;i<LATENCY_BUCKETS;i++) {
+        seen += h->counts[i];
+        if (seen > rank) return latencyBucketValue(i);
+    }
+    return h->maxNs;
+}
+
+#ifdef BILLING_METRICS
+/*
+ * Hot-path metrics. Each thread records into its own shard (single writer, relaxed atomics, no
+ * shared cache lines), and a dump sums the shards. A thread's shard goes back on the free list
+ * when it exits and is reused, counts intact, by the next thread, so totals only ever grow.
+ */
+static void metricsRetireShard(void *shard) {
+    atomic_store(&((MetricsShard *)shard)->inUse, 0);
+}
+
+static void metricsCreateKey(void) {
+    pthread_key_create(&metricsKey, metricsRetireShard);
+}
+
+static MetricsShard *metricsShard(void) {
+    if (metricsLocal) return metricsLocal;
+    pthread_once(&metricsKeyOnce, metricsCreateKey);
+    pthread_mutex_lock(&metricsLock);
+    MetricsShard *s = metricsShards;
+    while (s && atomic_load(&s->inUse)) s = s->next;
+    if (!s && (s = calloc(1, sizeof(MetricsShard))) != NULL) {
+        s->next = metricsShards;
+        metricsShards = s;
+    }
+    if (s) atomic_store(&s->inUse, 1);
+    pthread_mutex_unlock(&metricsLock);
+    if (s) pthread_setspecific(metricsKey, s);
+    metricsLocal = s;
+    return s;
+}
+
+static void metricAdd(_Atomic uint64_t *c, uint64_t v) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+static void metricScopeEnd(MetricScope *m) {
+    uint64_t ns = monotonicNs() - m->startNs;
+    MetricsShard *s = metricsShard();
+    if (!s) return;
+    metricAdd(&s->calls[m->op], 1);
+    metricAdd(&s->sumNs[m->op], ns);
+    metricAdd(&s->buckets[m->op][latencyBucket(ns)], 1);
+    if (ns > atomic_load_explicit(&s->maxNs[m->op], memory_order_relaxed)) {
+        atomic_store_explicit(&s->maxNs[m->op], ns, memory_order_relaxed);
+    }
+}
+
+/* Sums every shard's histogram for op into h; returns the summed latency in ns. */
+static uint64_t metricsCollect(int op, LatencyHistogram *h) {
+    uint64_t sumNs = 0;
+    memset(h, 0, sizeof(*h));
+    pthread_mutex_lock(&metricsLock);
+    for (MetricsShard *s=metricsShards;s;s=s->next) {
+        for (int b=0;b<LATENCY_BUCKETS;b++) h->counts[b] += atomic_load_explicit(&s->buckets[op][b], memory_order_relaxed);
+        h->total += atomic_load_explicit(&s->calls[op], memory_order_relaxed);
+        sumNs += atomic_load_explicit(&s->sumNs[op], memory_order_relaxed);
+        uint64_t max = atomic_load_explicit(&s->maxNs[op], memory_order_relaxed);
+        if (max > h->maxNs) h->maxNs = max;
+    }
+    pthread_mutex_unlock(&metricsLock);
+    return sumNs;
+}
+
+/* Prometheus text format; the cumulative buckets are read off the log-linear histogram at fixed bounds. */
+void writeMetrics(FILE *out) {
+    static const char *opNames[METRIC_OPS] = { "create_order", "add_item", "calculate_bill", "print_bill", "save_receipt" };
+    static const uint64_t boundsNs[] = { 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+                                         1000000, 2500000, 5000000, 10000000, 25000000, 100000000, 1000000000 };
+    const int nBounds = (int)(sizeof(boundsNs) / sizeof(boundsNs[0]));
+    fprintf(out, "# HELP billing_call_duration_seconds Time spent in instrumented billing functions.\n");
+    fprintf(out, "# TYPE billing_call_duration_seconds histogram\n");
+    for (int op=0;op<METRIC_OPS;op++) {
+        LatencyHistogram h;
+        uint64_t sumNs = metricsCollect(op, &h);
+        uint64_t cumulative = 0;
+        int b = 0;
+        for (int k=0;k<nBounds;k++) {
+            for (;b<LATENCY_BUCKETS && latencyBucketValue(b) < boundsNs[k];b++) cumulative += h.counts[b];
+            fprintf(out, "billing_call_duration_seconds_bucket{fn=\"%s\",le=\"%g\"} %llu\n", opNames[op],
+                    boundsNs[k] / 1e9, (unsigned long long)cumulative);
+        }
+        fprintf(out, "billing_call_duration_seconds_bucket{fn=\"%s\",le=\"+Inf\"} %llu\n", opNames[op], (unsigned long long)h.total);
+        fprintf(out, "billing_call_duration_seconds_sum{fn=\"%s\"} %.9f\n", opNames[op], sumNs / 1e9);
+        fprintf(out, "billing_call_duration_seconds_count{fn=\"%s\"} %llu\n", opNames[op], (unsigned long long)h.total);
+    }
+    fprintf(out, "# HELP billing_call_duration_quantile_seconds Log-linear histogram quantiles (within 1/16).\n");
+    fprintf(out, "# TYPE billing_call_duration_quantile_seconds gauge\n");
+    for (int op=0;op<METRIC_OPS;op++) {
+        LatencyHistogram h;
+        metricsCollect(op, &h);
+        fprintf(out, "billing_call_duration_quantile_seconds{fn=\"%s\",quantile=\"0.5\"} %.9f\n", opNames[op], latencyPercentile(&h, 50) / 1e9);
+        fprintf(out, "billing_call_duration_quantile_seconds{fn=\"%s\",quantile=\"0.99\"} %.9f\n", opNames[op], latencyPercentile(&h, 99) / 1e9);
+        fprintf(out, "billing_call_duration_quantile_seconds{fn=\"%s\",quantile=\"1\"} %.9f\n", opNames[op], h.maxNs / 1e9);
+    }
+    fprintf(out, "# HELP billing_active_orders Orders open right now.\n");
+    fprintf(out, "# TYPE billing_active_orders gauge\n");
+    fprintf(out, "billing_active_orders %d\n", atomic_load(&activeOrderCount));
+}
+
+static int dumpMetrics(const char *path) {
+    char tmp[METRICS_PATH_LEN + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+    writeMetrics(f);
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* Rewrites the metrics file every METRICS_DUMP_MS and at once on SIGUSR1, which only this thread takes. */
+static void *metricsDumperMain(void *arg) {
+    (void)arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    struct timespec wait = { METRICS_DUMP_MS / 1000, (METRICS_DUMP_MS % 1000) * 1000000L };
+    while (!atomic_load(&metricsStopping)) {
+        sigtimedwait(&set, NULL, &wait);
+        dumpMetrics(metricsPath);
+    }
+    return NULL;
+}
+
+/* Must run before any other thread starts, so that every thread inherits SIGUSR1 blocked. */
+int metricsStart(const char *path) {
+    if (strlen(path) >= METRICS_PATH_LEN) return -1;
+    strcpy(metricsPath, path);
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    if (pthread_create(&metricsThread, NULL, metricsDumperMain, NULL) != 0) return -1;
+    metricsRunning = 1;
+    return 0;
+}
+
+void metricsStop(void) {
+    if (!metricsRunning) return;
+    atomic_store(&metricsStopping, 1);
+    pthread_kill(metricsThread, SIGUSR1);
+    pthread_join(metricsThread, NULL);
+    metricsRunning = 0;
+    dumpMetrics(metricsPath);
+}
+#endif
+
+static uint64_t packMenuCode(const char* code) {
+    uint64_t key = 0;
+    for (int i=0;i<CODE_LEN-1 && code[i];i++) {
+        key |= (uint64_t)(unsigned char)code[i] << (8*i);
+    }
+    return key;
+}
+
+static unsigned menuHashSlot(uint64_t key) {
+    return (unsigned)((key * 0x9E3779B97F4A7C15ull) >> 40) & (MENU_HASH_SIZE-1);
+}
+
+/*
+ * Menu ids are interned codes: a code keeps its id for the life of the process, across catalog
+ * reloads, so order lines can hold a small id. Lookups are lock-free; only interning takes menuInternLock.
+ */
+int findMenuIndexByCode(const char* code) {
+    if (code[0] == '\0') return -1;
+    if (memchr(code, '\0', CODE_LEN) == NULL) return -1;
+    uint64_t key = packMenuCode(code);
+    unsigned h = menuHashSlot(key);
+    int slot;
+    while ((slot = atomic_load_explicit(&menuHash[h], memory_order_acquire)) != 0) {
+        if (menuKeys[slot-1] == key) return slot-1;
+        h = (h+1) & (MENU_HASH_SIZE-1);
+    }
+    return -1;
+}
+
+int internMenuCode(const char* code) {
+    int id = findMenuIndexByCode(code);
+    if (id != -1 || code[0] == '\0' || memchr(code, '\0', CODE_LEN) == NULL) return id;
+    uint64_t key = packMenuCode(code);
+    pthread_mutex_lock(&menuInternLock);
+    unsigned h = menuHashSlot(key);
+    int slot;
+    while ((slot = menuHash[h]) != 0 && menuKeys[slot-1] != key) h = (h+1) & (MENU_HASH_SIZE-1);
+    if (slot != 0) id = slot-1;
+    else if (menuIdCount < MAX_MENU) {
+        id = menuIdCount;
+        menuKeys[id] = key;
+        strcpy(menuCodes[id], code);
+        atomic_store_explicit(&menuHash[h], id + 1, memory_order_release);
+        menuIdCount = id + 1;
+    }
+    pthread_mutex_unlock(&menuInternLock);
+    return id;
+}
+
+/* Records that fail these checks (or belong to another outlet) are ignored, never trusted. */
+static int menuItemUsable(const MenuItem *mi) {
+    return memchr(mi->code, '\0', CODE_LEN) != NULL && mi->code[0] != '\0'
+        && mi->name[NAME_LEN-1] == '\0'
+        && mi->category >= STARTER && mi->category <= DESSERT && mi->price >= 0 && mi->price <= MAX_UNIT_PRICE
+        && (menuOutlet == 0 || mi->outlet == 0 || mi->outlet == menuOutlet);
+}
+
+static void freeMenuCatalog(MenuCatalog *c);
+
+/* Groups the records byId points at by category, keeping menu order within each. */
+static int buildMenuViews(MenuCatalog *c) {
+    int counts[CATEGORY_COUNT] = {0};
+    c->viewPos = malloc(sizeof(int) * (size_t)(c->idCount + 1));
+    c->view = malloc(sizeof(MenuItem*) * (size_t)(c->itemCount + 1));
+    if (!c->viewPos || !c->view) return -1;
+    for (int id=0;id<c->idCount;id++) c->viewPos[id] = -1;
+    for (int i=0;i<c->itemCount;i++) {
+        const MenuItem *mi = &c->items[i];
+        if (menuItemUsable(mi) && menuItemById(c, findMenuIndexByCode(mi->code)) == mi) counts[mi->category - STARTER]++;
+    }
+    c->categoryStart[0] = 0;
+    for (int k=0;k<CATEGORY_COUNT;k++) c->categoryStart[k+1] = c->categoryStart[k] + counts[k];
+    c->viewCount = c->categoryStart[CATEGORY_COUNT];
+    c->availableBits = calloc((size_t)c->viewCount / 64 + 1, sizeof(uint64_t));
+    if (!c->availableBits) return -1;
+    int fill[CATEGORY_COUNT];
+    memcpy(fill, c->categoryStart, sizeof(fill));
+    for (int i=0;i<c->itemCount;i++) {
+        MenuItem *mi = &c->items[i];
+        int id = menuItemUsable(mi) ? findMenuIndexByCode(mi->code) : -1;
+        if (id == -1 || menuItemById(c, id) != mi) continue;
+        int pos = fill[mi->category - STARTER]++;
+        c->view[pos] = mi;
+        c->viewPos[id] = pos;
+        if (mi->available) c->availableBits[pos >> 6] |= 1ull << (pos & 63);
+    }
+    return 0;
+}
+
+static uint32_t menuGramKey(const char *s, int len) {
+    const unsigned char *u = (const unsigned char*)s;
+    return (uint32_t)u[0] << 16 | (uint32_t)u[1] << 8 | (len == 3 ? u[2] : 0u);
+}
+
+/* Every word start as a space and its first letter, and every trigram, of one item's search text. */
+static int menuTextGrams(const char *t, uint32_t *keys) {
+    int n = 0;
+    for (int i=0;t[i] && t[i+1];i++) {
+        if (t[i] == ' ' && t[i+1] != ' ') keys[n++] = menuGramKey(t + i, 2);
+        if (t[i+2]) keys[n++] = menuGramKey(t + i, 3);
+    }
+    return n;
+}
+
+static MenuGram* menuGramSlot(MenuGram *grams, int size, uint32_t key) {
+    unsigned h = (unsigned)(((uint64_t)key * 0x9E3779B97F4A7C15ull) >> 40) & (unsigned)(size-1);
+    while (grams[h].key != 0 && grams[h].key != key) h = (h+1) & (unsigned)(size-1);
+    return &grams[h];
+}
+
+/*
+ * Lowercases " code name" for each view position and indexes its grams. Postings come out in view
+ * order because positions are visited in order, so one counting pass sizes every list and a second
+ * fills them without sorting.
+ */
+static int buildMenuSearch(MenuCatalog *c) {
+    size_t textLen = 0;
+    for (int p=0;p<c->viewCount;p++) textLen += strlen(c->view[p]->code) + strlen(c->view[p]->name) + 3;
+    c->searchText = malloc(textLen + 1);
+    c->searchOffset = malloc(sizeof(int) * (size_t)(c->viewCount + 1));
+    c->gramSize = MENU_GRAM_MIN_SIZE;
+    c->grams = calloc((size_t)c->gramSize, sizeof(MenuGram));
+    if (!c->searchText || !c->searchOffset || !c->grams) return -1;
+    size_t at = 0;
+    for (int p=0;p<c->viewCount;p++) {
+        c->searchOffset[p] = (int)at;
+        char *t = c->searchText + at;
+        int len = sprintf(t, " %s %s", c->view[p]->code, c->view[p]->name);
+        for (int i=0;i<len;i++) {
+            if (t[i] >= 'A' && t[i] <= 'Z') t[i] = (char)(t[i] - 'A' + 'a');
+        }
+        at += (size_t)len + 1;
+    }
+    uint32_t keys[2 * (CODE_LEN + NAME_LEN + 2)];
+    int used = 0;
+    uint32_t total = 0;
+    for (int p=0;p<c->viewCount;p++) {
+        int n = menuTextGrams(c->searchText + c->searchOffset[p], keys);
+        for (int k=0;k<n;k++) {
+            if ((used + 1) * 2 > c->gramSize) {
+                int oldSize = c->gramSize;
+                MenuGram *old = c->grams;
+                c->grams = calloc((size_t)oldSize * 2, sizeof(MenuGram));
+                if (!c->grams) { c->grams = old; return -1; }
+                c->gramSize = oldSize * 2;
+                for (int i=0;i<oldSize;i++) {
+                    if (old[i].key != 0) *menuGramSlot(c->grams, c->gramSize, old[i].key) = old[i];
+                }
+                free(old);
+            }
+            MenuGram *g = menuGramSlot(c->grams, c->gramSize, keys[k]);
+            if (g->key == 0) { g->key = keys[k]; used++; }
+            if (g->last != (uint32_t)p + 1) { g->last = (uint32_t)p + 1; g->count++; total++; }
+        }
+    }
+    c->postings = malloc(sizeof(uint32_t) * (size_t)(total + 1));
+    if (!c->postings) return -1;
+    uint32_t start = 0;
+    for (int i=0;i<c->gramSize;i++) {
+        c->grams[i].start = start;
+        start += c->grams[i].count;
+        c->grams[i].count = c->grams[i].last = 0;
+    }
+    for (int p=0;p<c->viewCount;p++) {
+        int n = menuTextGrams(c->searchText + c->searchOffset[p], keys);
+        for (int k=0;k<n;k++) {
+            MenuGram *g = menuGramSlot(c->grams, c->gramSize, keys[k]);
+            if (g->last != (uint32_t)p + 1) { g->last = (uint32_t)p + 1; c->postings[g->start + g->count++] = (uint32_t)p; }
+        }
+    }
+    return 0;
+}
+
+static const MenuGram* menuGramFind(const MenuCatalog *c, uint32_t key) {
+    const MenuGram *g = menuGramSlot(c->grams, c->gramSize, key);
+    return g->key == key ? g : NULL;
+}
+
+/*
+ * Items whose code or name contains query, ignoring case, in menu order (by category). One or two
+ * characters match the start of a word; longer queries match anywhere and are checked against the
+ * items holding the query's rarest trigram. Returns how many were written to out, at most max.
+ */
+int searchMenu(const MenuCatalog *menu, const char *query, int availableOnly, MenuItem **out, int max) {
+    char q[NAME_LEN + 2];       /* a space, then the query lowercased */
+    int len = 0;
+    while (*query == ' ') query++;
+    for (;query[len] && len<NAME_LEN;len++) {
+        q[len+1] = (char)(query[len] >= 'A' && query[len] <= 'Z' ? query[len] - 'A' + 'a' : query[len]);
+    }
+    if (query[len]) return 0;
+    while (len > 0 && q[len] == ' ') len--;
+    if (len == 0) return 0;
+    q[0] = ' ';
+    q[len+1] = '\0';
+    const MenuGram *best = NULL;
+    if (len < 3) {
+        best = menuGramFind(menu, menuGramKey(q, len + 1));
+    } else {
+        for (int i=1;i+3<=len+1;i++) {
+            const MenuGram *g = menuGramFind(menu, menuGramKey(q + i, 3));
+            if (!g) return 0;
+            if (!best || g->count < best->count) best = g;
+        }
+    }
+    int n = 0;
+    for (uint32_t k=0;best && k<best->count && n<max;k++) {
+        uint32_t pos = menu->postings[best->start + k];
+        if (availableOnly && !((atomic_load_explicit(&menu->availableBits[pos >> 6], memory_order_relaxed) >> (pos & 63)) & 1)) continue;
+        if (len >= 3 && !strstr(menu->searchText + menu->searchOffset[pos], q + 1)) continue;
+        out[n++] = menu->view[pos];
+    }
+    return n;
+}
+
+/* Indexes a record array (mapped file or built-in table) as one immutable catalog version. */
+static MenuCatalog* buildMenuCatalog(MenuItem *items, int count, void *map, size_t mapLen) {
+    MenuCatalog *c = calloc(1, sizeof(MenuCatalog));
+    if (!c) return NULL;
+    c->items = items;
+    c->itemCount = count;
+    c->map = map;
+    c->mapLen = mapLen;
+    for (int i=0;i<count;i++) {
+        if (menuItemUsable(&items[i])) internMenuCode(items[i].code);
+    }
+    c->idCount = menuIdCount;
+    c->byId = calloc((size_t)c->idCount + 1, sizeof(MenuItem*));
+    if (!c->byId) { free(c); return NULL; }
+    for (int i=0;i<count;i++) {
+        if (!menuItemUsable(&items[i])) continue;
+        int id = findMenuIndexByCode(items[i].code);
+        if (id != -1 && id < c->idCount && !c->byId[id]) c->byId[id] = &items[i];
+    }
+    if (buildMenuViews(c) != 0 || buildMenuSearch(c) != 0) {
+        c->map = NULL;
+        c->items = NULL;
+        freeMenuCatalog(c);
+        return NULL;
+    }
+    return c;
+}
+
+static void freeMenuCatalog(MenuCatalog *c) {
+    if (!c) return;
+    if (c->map) munmap(c->map, c->mapLen);
+    else free(c->items);
+    free(c->byId);
+    free(c->view);
+    free(c->viewPos);
+    free(c->availableBits);
+    free(c->searchText);
+    free(c->searchOffset);
+    free(c->grams);
+    free(c->postings);
+    free(c);
+}
+
+const MenuItem* menuItemById(const MenuCatalog *c, int id) {
+    return id >= 0 && id < c->idCount ? c->byId[id] : NULL;
+}
+
+static const char* menuItemName(const MenuCatalog *c, int id) {
+    const MenuItem *mi = menuItemById(c, id);
+    return mi ? mi->name : "(off menu)";
+}
+
+/* Flips availability in the current catalog (and its file, when mapped shared); returns the new state or -1. */
+int toggleMenuItem(const char *code, char *name) {
+    const MenuCatalog *menu = menuPin();
+    int id = findMenuIndexByCode(code);
+    MenuItem *mi = id >= 0 && id < menu->idCount ? menu->byId[id] : NULL;
+    int available = -1;
+    if (mi) {
+        available = !atomic_fetch_xor(&mi->available, 1);
+        int pos = menu->viewPos[id];
+        atomic_fetch_xor(&menu->availableBits[pos >> 6], 1ull << (pos & 63));
+        /* the admin has the last word: a restock will not re-enable what a toggle turned off */
+        if (atomic_exchange(&stockHeld[id], 0)) atomic_fetch_sub(&stockHeldCount, 1);
+        if (name) strcpy(name, mi->name);
+    }
+    menuUnpin();
+    return available;
+}
+
+/* Sets availability in the given catalog and its search bits; returns the previous state or -1. */
+static int setMenuItemAvailable(const MenuCatalog *menu, int id, int available) {
+    MenuItem *mi = id >= 0 && id < menu->idCount ? menu->byId[id] : NULL;
+    if (!mi) return -1;
+    int was = atomic_exchange(&mi->available, (uint8_t)available);
+    if (was != available) {
+        int pos = menu->viewPos[id];
+        atomic_fetch_xor(&menu->availableBits[pos >> 6], 1ull << (pos & 63));
+    }
+    return was;
+}
+
+/*
+ * Readers pin the current catalog for the length of an operation; nested pins see the same
+ * version. Each pin counts itself in one of two phases, and a publisher flips the phase and
+ * waits for the old one to drain, twice, before freeing the version it replaced.
+ */
+const MenuCatalog* menuPin(void) {
+    if (menuPinDepth++ == 0) {
+        menuPinPhase = menuPhase;
+        menuReaders[menuPinPhase]++;
+        menuPinned = menuCurrent;
+    }
+    return menuPinned;
+}
+
+void menuUnpin(void) {
+    if (--menuPinDepth == 0) {
+        menuPinned = NULL;
+        menuReaders[menuPinPhase]--;
+    }
+}
+
+static void menuSynchronize(void) {
+    struct timespec pause = { 0, 100000 };
+    for (int pass=0;pass<2;pass++) {
+        int phase = menuPhase;
+        menuPhase = !phase;
+        while (menuReaders[phase] > 0) nanosleep(&pause, NULL);
+    }
+}
+
+/* Must not be called while the calling thread holds a pin. */
+static void publishMenu(MenuCatalog *c) {
+    pthread_mutex_lock(&menuPublishLock);
+    c->version = ++menuVersion;
+    MenuCatalog *old = atomic_exchange(&menuCurrent, c);
+    if (old) {
+        menuSynchronize();
+        freeMenuCatalog(old);
+    }
+    pthread_mutex_unlock(&menuPublishLock);
+}
+
+void addMenuItem(const char* code, const char* name, Category cat, Money price, int avail) {
+    if (menuDraftCount == menuDraftCapacity) {
+        int cap = menuDraftCapacity ? menuDraftCapacity * 2 : 32;
+        MenuItem *items = realloc(menuDraft, sizeof(MenuItem) * (size_t)cap);
+        if (!items) return;
+        menuDraft = items;
+        menuDraftCapacity = cap;
+    }
+    MenuItem *mi = &menuDraft[menuDraftCount++];
+    memset(mi, 0, sizeof(*mi));
+    strncpy(mi->code, code, CODE_LEN-1);
+    strncpy(mi->name, name, NAME_LEN-1);
+    mi->category = (uint8_t)cat;
+    mi->price = price;
+    mi->available = avail ? 1 : 0;
+}
+
+/* Publishes the items added since the last call as the current catalog. */
+static int publishMenuDraft(void) {
+    MenuCatalog *c = buildMenuCatalog(menuDraft, menuDraftCount, NULL, 0);
+    if (!c) return -1;
+    menuDraft = NULL;
+    menuDraftCount = menuDraftCapacity = 0;
+    publishMenu(c);
+    return 0;
+}
+
+
+/*
+ * Floor map. Tables are numbered 1..floorTableCount across the loaded sections; occupancy is one
+ * bit per table, claimed with an atomic OR so two terminals can never seat the same table.
+ * An order owns its primary table (Order.tableNumber) plus any merged tables chained through
+ * tableLink; the chain is only changed under the owning order's lock.
+ */
+static int floorAddSection(int outlet, const char *name, int tables, int seats) {
+    if (floorSectionCount == FLOOR_MAX_SECTIONS || tables < 1 || floorTableCount + tables > MAX_TABLES) return -1;
+    if (seats < 1 || seats > FLOOR_MAX_SEATS) return -1;
+    FloorSection *s = &floorSections[floorSectionCount++];
+    s->outlet = outlet;
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    s->firstTable = floorTableCount + 1;
+    s->tableCount = tables;
+    s->seats = seats;
+    for (int t=floorTableCount;t<floorTableCount+tables;t++) {
+        tableSeats[t] = (uint8_t)seats;
+        floorSeatMask[seats][t >> 6] |= 1ull << (t & 63);
+    }
+    floorTableCount += tables;
+    return 0;
+}
+
+static void floorReset(void) {
+    floorSectionCount = floorTableCount = 0;
+    memset(floorSeatMask, 0, sizeof(floorSeatMask));
+    memset(tableSeats, 0, sizeof(tableSeats));
+}
+
+static int tableOccupied(int table) {
+    int t = table - 1;
+    return (atomic_load(&floorOccupied[t >> 6]) >> (t & 63)) & 1;
+}
+
+static int floorClaim(int table, int orderIdx) {
+    if (table < 1 || table > floorTableCount) return -1;
+    int t = table - 1;
+    uint64_t bit = 1ull << (t & 63);
+    if (atomic_fetch_or(&floorOccupied[t >> 6], bit) & bit) return -1;
+    tableOrderIndex[t] = orderIdx;
+    tableLink[t] = 0;
+    return 0;
+}
+
+static void floorRelease(int table) {
+    int t = table - 1;
+    tableOrderIndex[t] = -1;
+    tableLink[t] = 0;
+    atomic_fetch_and(&floorOccupied[t >> 6], ~(1ull << (t & 63)));
+}
+
+static void floorReleaseGroup(Order *o) {
+    for (int t=o->tableNumber;t!=0;) {
+        int next = tableLink[t-1];
+        floorRelease(t);
+        t = next;
+    }
+}
+
+/* Bits of word w that fall inside tables first..last (1-based, inclusive). */
+static uint64_t floorRangeMask(int w, int first, int last) {
+    int lo = first - 1 - w * 64, hi = last - 1 - w * 64;
+    if (hi < 0 || lo > 63) return 0;
+    uint64_t m = ~0ull;
+    if (lo > 0) m &= ~0ull << lo;
+    if (hi < 63) m &= ~0ull >> (63 - hi);
+    return m;
+}
+
+/* Smallest free table seating at least `covers`, lowest number first; section 0 = anywhere. */
+int findFreeTable(int covers, int section) {
+    int first = 1, last = floorTableCount;
+    if (section > 0) {
+        if (section > floorSectionCount) return -1;
+        first = floorSections[section-1].firstTable;
+        last = first + floorSections[section-1].tableCount - 1;
+    }
+    if (covers < 1) covers = 1;
+    for (int seats=covers;seats<=FLOOR_MAX_SEATS;seats++) {
+        for (int w=(first-1)>>6;w<=(last-1)>>6;w++) {
+            uint64_t m = floorSeatMask[seats][w] & ~atomic_load(&floorOccupied[w]) & floorRangeMask(w, first, last);
+            if (m) return w * 64 + __builtin_ctzll(m) + 1;
+        }
+    }
+    return -1;
+}
+
+static void floorAppendToGroup(Order *o, int table) {
+    int t = o->tableNumber;
+    while (tableLink[t-1] != 0) t = tableLink[t-1];
+    tableLink[t-1] = table;
+}
+
+void initMenu(void) {
+    
+    addMenuItem("S01","Garlic Bread", STARTER, RUPEES(120), 1);
+    addMenuItem("S02","Veg Spring Roll", STARTER, RUPEES(140), 1);
+    addMenuItem("S03","Chicken Tikka", STARTER, RUPEES(260), 1);
+    addMenuItem("S04","Paneer Tikka", STARTER, RUPEES(220), 1);
+    addMenuItem("S05","French Fries", STARTER, RUPEES(130), 1);
+    addMenuItem("S06","Chicken Wings", STARTER, RUPEES(290), 1);
+    addMenuItem("S07","Masala Papad", STARTER, RUPEES(60), 1);
+
+    addMenuItem("M01","Butter Chicken", MAIN_COURSE, RUPEES(320), 1);
+    addMenuItem("M02","Paneer Butter Masala", MAIN_COURSE, RUPEES(300), 1);
+    addMenuItem("M03","Hyderabadi Chicken Biryani", MAIN_COURSE, RUPEES(280), 1);
+    addMenuItem("M04","Veg Biryani", MAIN_COURSE, RUPEES(240), 1);
+    addMenuItem("M05","Margherita Pizza", MAIN_COURSE, RUPEES(350), 1);
+    addMenuItem("M06","Farmhouse Pizza", MAIN_COURSE, RUPEES(420), 1);
+    addMenuItem("M07","Grilled Fish", MAIN_COURSE, RUPEES(380), 1);
+    addMenuItem("M08","Chicken Fried Rice", MAIN_COURSE, RUPEES(220), 1);
+    addMenuItem("M09","Mixed Veg Curry + Roti", MAIN_COURSE, RUPEES(180), 1);
+
+    addMenuItem("B01","Masala Chai", BEVERAGE, RUPEES(40), 1);
+    addMenuItem("B02","Cold Coffee", BEVERAGE, RUPEES(120), 1);
+    addMenuItem("B03","Mango Lassi", BEVERAGE, RUPEES(110), 1);
+    addMenuItem("B04","Soft Drink (500ml)", BEVERAGE, RUPEES(80), 1);
+    addMenuItem("B05","Lemonade", BEVERAGE, RUPEES(85), 1);
+    addMenuItem("B06","Mineral Water (1L)", BEVERAGE, RUPEES(50), 1);
+
+    addMenuItem("D01","Gulab Jamun (2 pcs)", DESSERT, RUPEES(90), 1);
+    addMenuItem("D02","Brownie with Ice Cream", DESSERT, RUPEES(210), 1);
+    addMenuItem("D03","Rasmalai (2 pcs)", DESSERT, RUPEES(130), 1);
+    addMenuItem("D04","Fruit Salad", DESSERT, RUPEES(150), 1);
+    addMenuItem("D05","Kulfi", DESSERT, RUPEES(110), 1);
+    addMenuItem("D06","Ice Cream Scoop", DESSERT, RUPEES(70), 1);
+    addMenuItem("D07","Jalebi (2 pcs)", DESSERT, RUPEES(95), 1);
+    publishMenuDraft();
+
+    
+    for (int i=0;i<MAX_TABLES;i++) tableOrderIndex[i] = -1;
+    floorAddSection(0, "Main", FLOOR_DEFAULT_TABLES, FLOOR_DEFAULT_SEATS);
+    for (int i=0;i<KOT_SHARDS;i++) {
+        pthread_mutex_init(&kotShards[i].lock, NULL);
+        kotShards[i].activeHead = kotShards[i].activeTail = -1;
+    }
+}
+
+
+void printMenuAll(FILE *out) {
+    fprintf(out, "\n========== MENU ==========\n");
+    fprintf(out, "Starters:\n");
+    printMenuByCategory(out, STARTER);
+    fprintf(out, "\nMain Course:\n");
+    printMenuByCategory(out, MAIN_COURSE);
+    fprintf(out, "\nBeverages:\n");
+    printMenuByCategory(out, BEVERAGE);
+    fprintf(out, "\nDesserts:\n");
+    printMenuByCategory(out, DESSERT);
+    fprintf(out, "==========================\n");
+}
+
+void printMenuByCategory(FILE *out, Category c) {
+    fprintf(out, "Code  | %-20s | Price  | Avail\n", "Name");
+    fprintf(out, "-----------------------------------------------\n");
+    const MenuCatalog *menu = menuPin();
+    for (int p=menu->categoryStart[c - STARTER];p<menu->categoryStart[c - STARTER + 1];p++) {
+        const MenuItem *mi = menu->view[p];
+        char price[MONEY_STR_LEN];
+        fprintf(out, "%-5s | %-20s | %6s | %s\n",
+               mi->code,
+               mi->name,
+               formatMoney(mi->price, price),
+               mi->available ? "Yes" : "No");
+    }
+    menuUnpin();
+}
+
+/* Type-ahead for item entry: the first MENU_SEARCH_MAX available items matching query. */
+int printMenuSearch(FILE *out, const char *query) {
+    MenuItem *hits[MENU_SEARCH_MAX];
+    const MenuCatalog *menu = menuPin();
+    int n = searchMenu(menu, query, 1, hits, MENU_SEARCH_MAX);
+    for (int k=0;k<n;k++) {
+        char price[MONEY_STR_LEN];
+        fprintf(out, "%-5s | %-20s | %6s\n", hits[k]->code, hits[k]->name, formatMoney(hits[k]->price, price));
+    }
+    menuUnpin();
+    if (n == 0) fprintf(out, "No available items match \"%s\".\n", query);
+    return n;
+}
+
+
+Order* orderAt(int orderIdx) {
+    return &orderSlabs[orderIdx / ORDER_SLAB_SIZE][orderIdx % ORDER_SLAB_SIZE];
+}
+
+static OrderCold *orderColdAt(int orderIdx) {
+    return &orderColdSlabs[orderIdx / ORDER_SLAB_SIZE][orderIdx % ORDER_SLAB_SIZE];
+}
+
+static pthread_mutex_t *orderLock(int orderIdx) {
+    return &orderColdAt(orderIdx)->lock;
+}
+
+static Money lineAmount(const OrderItem *line) {
+    return (Money)line->unitPrice * line->qty;
+}
+
+static Money orderSubtotal(const Order *o) {
+    return o->categorySubtotal[0] + o->categorySubtotal[1] + o->categorySubtotal[2] + o->categorySubtotal[3];
+}
+
+static int itemSizeClass(int capacity) {
+    int cls = 0;
+    while ((ITEM_CLASS_MIN << cls) < capacity) cls++;
+    return cls;
+}
+
+/* The item free lists and arena are shared by every terminal; callers hold orderPoolLock. */
+static OrderItem* allocItemBlock(int cls) {
+    if (itemFreeLists[cls]) {
+        void *blk = itemFreeLists[cls];
+        itemFreeLists[cls] = *(void**)blk;
+        return (OrderItem*)blk;
+    }
+    size_t bytes = sizeof(OrderItem) * (size_t)(ITEM_CLASS_MIN << cls);
+    if (itemArenaUsed + bytes > ITEM_ARENA_BYTES) {
+        itemArena = malloc(ITEM_ARENA_BYTES);
+        if (!itemArena) return NULL;
+        itemArenaUsed = 0;
+    }
+    OrderItem *blk = (OrderItem*)(itemArena + itemArenaUsed);
+    itemArenaUsed += bytes;
+    return blk;
+}
+
+static void freeItemBlock(OrderItem *blk, int capacity) {
+    if (!blk) return;
+    int cls = itemSizeClass(capacity);
+    *(void**)blk = itemFreeLists[cls];
+    itemFreeLists[cls] = blk;
+}
+
+static int growOrderItems(Order *o) {
+    int newCap = o->itemCapacity ? o->itemCapacity * 2 : ITEM_CLASS_MIN;
+    pthread_mutex_lock(&orderPoolLock);
+    OrderItem *blk = allocItemBlock(itemSizeClass(newCap));
+    if (blk) {
+        if (o->itemCount > 0) memcpy(blk, o->items, sizeof(OrderItem) * (size_t)o->itemCount);
+        freeItemBlock(o->items, o->itemCapacity);
+    }
+    pthread_mutex_unlock(&orderPoolLock);
+    if (!blk) return -1;
+    o->items = blk;
+    o->itemCapacity = newCap;
+    return 0;
+}
+
+/* Slabs are never moved or freed, so an index handed out stays valid without holding the pool lock. */
+static int addOrderSlab(void) {
+    if (orderSlabCount == MAX_ORDER_SLABS) return -1;
+    Order *slab = calloc(ORDER_SLAB_SIZE, sizeof(Order));
+    OrderCold *cold = calloc(ORDER_SLAB_SIZE, sizeof(OrderCold));
+    if (!slab || !cold) {
+        free(slab);
+        free(cold);
+        return -1;
+    }
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    for (int i=0;i<ORDER_SLAB_SIZE;i++) pthread_mutex_init(&cold[i].lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    orderColdSlabs[orderSlabCount] = cold;
+    orderSlabs[orderSlabCount++] = slab;
+    return 0;
+}
+
+static int allocOrderSlot(void) {
+    int idx = -1;
+    pthread_mutex_lock(&orderPoolLock);
+    if (freeOrderHead != -1) {
+        idx = freeOrderHead;
+        freeOrderHead = orderColdAt(idx)->nextFree;
+    } else if (orderCount < orderSlabCount * ORDER_SLAB_SIZE || addOrderSlab() == 0) {
+        idx = orderCount++;
+    }
+    pthread_mutex_unlock(&orderPoolLock);
+    return idx;
+}
+
+static void freeOrderSlot(int orderIdx) {
+    Order *o = orderAt(orderIdx);
+    pthread_mutex_lock(&orderPoolLock);
+    freeItemBlock(o->items, o->itemCapacity);
+    o->items = NULL;
+    o->itemCount = 0;
+    o->itemCapacity = 0;
+    memset(o->categorySubtotal, 0, sizeof(o->categorySubtotal));
+    o->orderId = 0;
+    orderColdAt(orderIdx)->nextFree = freeOrderHead;
+    freeOrderHead = orderIdx;
+    pthread_mutex_unlock(&orderPoolLock);
+}
+
+static KotShard* kotShardFor(int orderId) {
+    return &kotShards[(unsigned)orderId & (KOT_SHARDS-1)];
+}
+
+/* the low bits pick the shard, so hash on the rest or every KOT in a shard shares a home slot */
+static unsigned kotHashSlot(int orderId, int size) {
+    return (((unsigned)orderId >> KOT_SHARD_BITS) * 2654435761u) & (unsigned)(size-1);
+}
+
+static void kotIndexPut(KotShard *s, int orderId, int orderIdx) {
+    unsigned h = kotHashSlot(orderId, s->indexSize);
+    while (s->index[h].orderId != 0) h = (h+1) & (unsigned)(s->indexSize-1);
+    s->index[h].orderId = orderId;
+    s->index[h].orderIdx = orderIdx;
+}
+
+static int kotIndexInsert(KotShard *s, int orderId, int orderIdx) {
+    if ((s->indexUsed + 1) * 2 > s->indexSize) {
+        int oldSize = s->indexSize;
+        KotIndexEntry *old = s->index;
+        int newSize = oldSize ? oldSize * 2 : KOT_INDEX_MIN_SIZE;
+        KotIndexEntry *tbl = calloc((size_t)newSize, sizeof(KotIndexEntry));
+        if (!tbl) return -1;
+        s->index = tbl;
+        s->indexSize = newSize;
+        for (int i=0;i<oldSize;i++) {
+            if (old[i].orderId != 0) kotIndexPut(s, old[i].orderId, old[i].orderIdx);
+        }
+        free(old);
+    }
+    kotIndexPut(s, orderId, orderIdx);
+    s->indexUsed++;
+    return 0;
+}
+
+static void kotIndexErase(KotShard *s, int orderId) {
+    if (s->indexSize == 0) return;
+    KotIndexEntry *kotIndex = s->index;
+    unsigned mask = (unsigned)(s->indexSize-1);
+    unsigned h = kotHashSlot(orderId, s->indexSize);
+    while (kotIndex[h].orderId != orderId) {
+        if (kotIndex[h].orderId == 0) return;
+        h = (h+1) & mask;
+    }
+    /* backward-shift deletion keeps probe chains intact without tombstones */
+    unsigned hole = h;
+    unsigned j = h;
+    while (1) {
+        j = (j+1) & mask;
+        if (kotIndex[j].orderId == 0) break;
+        unsigned home = kotHashSlot(kotIndex[j].orderId, s->indexSize);
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            kotIndex[hole] = kotIndex[j];
+            hole = j;
+        }
+    }
+    kotIndex[hole].orderId = 0;
+    s->indexUsed--;
+}
+
+static void journalAppend(JournalEventType type, const Order *o, int midx, int qty);
+
+/*
+ * orderId 0 takes the next KOT. The table is claimed with a compare-and-swap before a KOT is
+ * assigned, so two terminals racing for one table cannot both win and no KOT number is burned.
+ * The new order stays locked until its CREATE record is journaled.
+ */
+static int createOrderWithId(int orderId, int dineIn, int tableNumber, time_t timestamp) {
+    if (dineIn) {
+        if (tableNumber < 1 || tableNumber > floorTableCount) return -1;
+        if (tableOccupied(tableNumber)) return -1;
+    }
+    int idx = allocOrderSlot();
+    if (idx == -1) return -1;
+    Order *o = orderAt(idx);
+    pthread_mutex_lock(orderLock(idx));
+    if (dineIn && floorClaim(tableNumber, idx) != 0) {
+        pthread_mutex_unlock(orderLock(idx));
+        freeOrderSlot(idx);
+        return -1;
+    }
+    if (orderId == 0) orderId = atomic_fetch_add(&nextOrderId, 1);
+    else if (orderId >= nextOrderId) nextOrderId = orderId + 1;
+    o->orderId = orderId;
+    o->dineIn = dineIn ? 1 : 0;
+    o->tableNumber = dineIn ? tableNumber : 0;
+    o->items = NULL;
+    o->itemCount = 0;
+    o->itemCapacity = 0;
+    memset(o->categorySubtotal, 0, sizeof(o->categorySubtotal));
+    o->timestamp = timestamp;
+    o->active = 1;
+    orderColdAt(idx)->nextFree = -1;
+    orderColdAt(idx)->paid = 0;
+    orderColdAt(idx)->paidLines = 0;
+    orderColdAt(idx)->shareWays = 0;
+    orderColdAt(idx)->sharesPaid = 0;
+    KotShard *s = kotShardFor(orderId);
+    pthread_mutex_lock(&s->lock);
+    if (kotIndexInsert(s, orderId, idx) != 0) {
+        pthread_mutex_unlock(&s->lock);
+        o->active = 0;
+        if (dineIn) floorRelease(tableNumber);
+        pthread_mutex_unlock(orderLock(idx));
+        freeOrderSlot(idx);
+        return -1;
+    }
+    orderColdAt(idx)->prevActive = s->activeTail;
+    o->nextActive = -1;
+    if (s->activeTail != -1) orderAt(s->activeTail)->nextActive = idx;
+    else s->activeHead = idx;
+    s->activeTail = idx;
+    pthread_mutex_unlock(&s->lock);
+    activeOrderCount++;
+    journalAppend(JOURNAL_CREATE, o, -1, 0);
+    pthread_mutex_unlock(orderLock(idx));
+    return idx;
+}
+
+int createOrder(int dineIn, int tableNumber) {
+    METRIC_SCOPE(METRIC_CREATE_ORDER);
+    return createOrderWithId(0, dineIn, tableNumber, time(NULL));
+}
+
+/* Returns the slot of an active order with its lock held, or -1; pair with unlockOrder. */
+int lockOrderById(int orderId) {
+    int idx = findOrderIndexById(orderId);
+    if (idx == -1) return -1;
+    Order *o = orderAt(idx);
+    pthread_mutex_lock(orderLock(idx));
+    /* the slot may have been billed and reused between the lookup and the lock */
+    if (!o->active || o->orderId != orderId) {
+        pthread_mutex_unlock(orderLock(idx));
+        return -1;
+    }
+    return idx;
+}
+
+void unlockOrder(int orderIdx) {
+    pthread_mutex_unlock(orderLock(orderIdx));
+}
+
+
+void closeOrder(int orderIdx) {
+    if (orderIdx < 0 || orderIdx >= orderCount) return;
+    Order *o = orderAt(orderIdx);
+    pthread_mutex_lock(orderLock(orderIdx));
+    if (!o->active) {
+        pthread_mutex_unlock(orderLock(orderIdx));
+        return;
+    }
+    KotShard *s = kotShardFor(o->orderId);
+    pthread_mutex_lock(&s->lock);
+    o->active = 0;
+    int prev = orderColdAt(orderIdx)->prevActive;
+    if (prev != -1) orderAt(prev)->nextActive = o->nextActive;
+    else s->activeHead = o->nextActive;
+    if (o->nextActive != -1) orderColdAt(o->nextActive)->prevActive = prev;
+    else s->activeTail = prev;
+    kotIndexErase(s, o->orderId);
+    pthread_mutex_unlock(&s->lock);
+    activeOrderCount--;
+    journalAppend(JOURNAL_CLOSE, o, -1, 0);
+    /* freed only after CLOSE is journaled, so a replay never sees two orders on one table */
+    if (o->dineIn && o->tableNumber >= 1) floorReleaseGroup(o);
+    releaseOrder(orderIdx);
+    pthread_mutex_unlock(orderLock(orderIdx));
+}
+
+
+void releaseOrder(int orderIdx) {
+    if (orderIdx < 0 || orderIdx >= orderCount) return;
+    Order *o = orderAt(orderIdx);
+    if (o->active || o->orderId == 0) return;
+    freeOrderSlot(orderIdx);
+}
+
+
+/*
+ * Kitchen dispatch: every change to an order line becomes a delta ticket on the ring of the
+ * station that cooks its category. Producers are serialised per station, so each ring has a
+ * single writer publishing `tail`; any number of station screens pick up batches by CASing `head`
+ * forward, copying the tickets out first and retrying if another screen got there before them.
+ */
+static int kitchenStationFor(int category) {
+    return category >= STARTER && category <= DESSERT ? category - STARTER : -1;
+}
+
+static void kitchenPush(KitchenStation *s, const KitchenTicket *t) {
+    pthread_mutex_lock(&s->producerLock);
+    uint64_t tail = atomic_load_explicit(&s->tail, memory_order_relaxed);
+    /* a full ring waits briefly for the screens, then drops rather than stall the terminal;
+       once a station has stalled, later tickets drop at once until a screen frees a slot */
+    uint64_t deadline = 0;
+    while (tail - atomic_load_explicit(&s->head, memory_order_acquire) >= KITCHEN_RING_SIZE) {
+        uint64_t now = monotonicNs();
+        if (deadline == 0) deadline = now + KITCHEN_FULL_WAIT_MS * 1000000ull;
+        if (s->stalled || now >= deadline) {
+            s->stalled = 1;
+            s->dropped++;
+            pthread_mutex_unlock(&s->producerLock);
+            return;
+        }
+        sched_yield();
+    }
+    s->slots[tail & (KITCHEN_RING_SIZE - 1)] = *t;
+    atomic_store_explicit(&s->tail, tail + 1, memory_order_release);
+    s->dispatched++;
+    s->stalled = 0;
+    pthread_mutex_unlock(&s->producerLock);
+}
+
+/* Takes up to max tickets off a station's ring; returns how many were copied into out. */
+int kitchenPickup(int station, KitchenTicket *out, int max) {
+    KitchenStation *s = &kitchenStations[station];
+    uint64_t head = atomic_load_explicit(&s->head, memory_order_acquire);
+    while (1) {
+        uint64_t tail = atomic_load_explicit(&s->tail, memory_order_acquire);
+        int n = tail - head < (uint64_t)max ? (int)(tail - head) : max;
+        if (n <= 0) return 0;
+        for (int i=0;i<n;i++) out[i] = s->slots[(head + (uint64_t)i) & (KITCHEN_RING_SIZE - 1)];
+        if (atomic_compare_exchange_weak_explicit(&s->head, &head, head + (uint64_t)n,
+                                                  memory_order_acq_rel, memory_order_acquire)) return n;
+    }
+}
+
+/* Called with the order locked, after the change is applied, so one order's tickets stay in order. */
+static void kitchenEmit(const Order *o, int midx, int category, int qtyDelta) {
+    int station = kitchenStationFor(category);
+    if (!kitchenEnabled || journalReplaying || station == -1 || qtyDelta == 0) return;
+    KitchenTicket t;
+    memset(&t, 0, sizeof(t));
+    t.orderId = o->orderId;
+    t.tableNumber = o->dineIn ? o->tableNumber : 0;
+    t.qtyDelta = qtyDelta;
+    memcpy(t.code, menuCodes[midx], CODE_LEN);
+    t.enteredNs = monotonicNs();
+    kitchenPush(&kitchenStations[station], &t);
+}
+
+static const char *kitchenStationNames[KITCHEN_STATIONS] = { "starters", "mains", "beverages", "desserts" };
+
+void kitchenStart(void) {
+    for (int i=0;i<KITCHEN_STATIONS;i++) {
+        pthread_mutex_init(&kitchenStations[i].producerLock, NULL);
+        pthread_mutex_init(&kitchenStations[i].statsLock, NULL);
+    }
+}
+
+/* Stamps a picked-up batch into the station's wait histogram; now is taken once per batch. */
+static void kitchenRecordPickup(int station, const KitchenTicket *t, int n, uint64_t now) {
+    KitchenStation *s = &kitchenStations[station];
+    pthread_mutex_lock(&s->statsLock);
+    for (int i=0;i<n;i++) latencyRecord(&s->wait, now > t[i].enteredNs ? now - t[i].enteredNs : 0);
+    s->pickedUp += (uint64_t)n;
+    pthread_mutex_unlock(&s->statsLock);
+}
+
+void showKitchenStatus(FILE *out) {
+    for (int i=0;i<KITCHEN_STATIONS;i++) {
+        KitchenStation *s = &kitchenStations[i];
+        pthread_mutex_lock(&s->producerLock);
+        uint64_t dispatched = s->dispatched, dropped = s->dropped;
+        pthread_mutex_unlock(&s->producerLock);
+        uint64_t queued = atomic_load(&s->tail) - atomic_load(&s->head);
+        pthread_mutex_lock(&s->statsLock);
+        fprintf(out, "%-10s sent %llu  picked %llu  queued %llu  dropped %llu  wait p50 %.1f us  p99 %.1f us  max %.1f us\n",
+                kitchenStationNames[i], (unsigned long long)dispatched, (unsigned long long)s->pickedUp,
+                (unsigned long long)queued, (unsigned long long)dropped,
+                latencyPercentile(&s->wait, 50) / 1e3, latencyPercentile(&s->wait, 99) / 1e3, s->wait.maxNs / 1e3);
+        pthread_mutex_unlock(&s->statsLock);
+    }
+}
+
+/*
+ * Stock. Each counted resource (an item's portions, or an ingredient) has its count split across
+ * STOCK_SHARDS slices, and a thread reserves from and releases to its own slice with a CAS on a
+ * line no other slice shares, so terminals on different slices never contend. When a slice runs
+ * short the thread pools every slice under stockLock; that is also when a count reaching zero is
+ * seen and the items depending on it go unavailable. The reconciler re-deals all counts evenly once
+ * a second so that units released on one slice become reachable cheaply from the others.
+ */
+static int stockHome(void) {
+    if (stockHomeShard == -1) stockHomeShard = (int)(atomic_fetch_add(&stockNextShard, 1) % STOCK_SHARDS);
+    return stockHomeShard;
+}
+
+static int64_t stockCount(int r) {
+    int64_t total = 0;
+    for (int s=0;s<STOCK_SHARDS;s++) total += atomic_load_explicit(&stockShards[s].units[r], memory_order_relaxed);
+    return total;
+}
+
+/*
+ * Pools every slice of r, takes n out if it is there and deals the rest back evenly (the odd units to
+ * this thread's slice). Returns the units left, or -1 with nothing taken. Under stockLock.
+ */
+static int64_t stockPool(int r, int32_t n) {
+    int64_t total = 0;
+    for (int s=0;s<STOCK_SHARDS;s++) total += atomic_exchange_explicit(&stockShards[s].units[r], 0, memory_order_relaxed);
+    int64_t left = total >= n ? total - n : total;
+    int home = stockHome();
+    for (int s=0;s<STOCK_SHARDS;s++) {
+        int32_t share = (int32_t)(left / STOCK_SHARDS + (s == home ? left % STOCK_SHARDS : 0));
+        if (share) atomic_fetch_add_explicit(&stockShards[s].units[r], share, memory_order_relaxed);
+    }
+    return total >= n ? left : -1;
+}
+
+/* Takes counted items that cannot be made once more off the menu and puts restocked ones back. Under stockLock. */
+static void stockRefresh(void) {
+    const MenuCatalog *menu = menuPin();
+    for (int k=0;k<stockUseCount;) {
+        int id = stockUses[k].menuId, enough = 1;
+        for (;k<stockUseCount && stockUses[k].menuId == id;k++) enough &= stockCount(stockUses[k].resource) >= stockUses[k].perUnit;
+        if (!enough) {
+            if (setMenuItemAvailable(menu, id, 0) == 1 && !atomic_exchange(&stockHeld[id], 1)) atomic_fetch_add(&stockHeldCount, 1);
+        } else if (atomic_exchange(&stockHeld[id], 0)) {
+            atomic_fetch_sub(&stockHeldCount, 1);
+            setMenuItemAvailable(menu, id, 1);
+        }
+    }
+    menuUnpin();
+}
+
+static int stockRebalance(int r, int32_t n) {
+    pthread_mutex_lock(&stockLock);
+    int64_t left = stockPool(r, n);
+    if (left < stockResources[r].need || atomic_load(&stockHeldCount)) stockRefresh();
+    pthread_mutex_unlock(&stockLock);
+    return left < 0 ? -1 : 0;
+}
+
+static int stockTake(int r, int32_t n) {
+    _Atomic int32_t *home = &stockShards[stockHome()].units[r];
+    int32_t have = atomic_load_explicit(home, memory_order_relaxed);
+    while (have >= n) {
+        if (atomic_compare_exchange_weak_explicit(home, &have, have - n, memory_order_relaxed, memory_order_relaxed)) {
+            /* this slice cannot serve another unit: pool the slices to see whether the others can */
+            if (have - n < stockResources[r].need) stockRebalance(r, 0);
+            return 0;
+        }
+    }
+    return stockRebalance(r, n);
+}
+
+/* Returns qty units' worth of uses [first, end) to this thread's slice. */
+static void stockGive(int first, int end, int qty) {
+    for (int k=first;k<end;k++) {
+        _Atomic int32_t *home = &stockShards[stockHome()].units[stockUses[k].resource];
+        atomic_fetch_add_explicit(home, stockUses[k].perUnit * qty, memory_order_relaxed);
+    }
+    if (atomic_load(&stockHeldCount)) {
+        pthread_mutex_lock(&stockLock);
+        stockRefresh();
+        pthread_mutex_unlock(&stockLock);
+    }
+}
+
+/* Reserves qty of an item from every resource it draws on, all or nothing; -3 when any runs short. */
+static int stockReserve(int midx, int qty) {
+    if (!stockLoaded || stockUseFirst[midx] == 0) return 0;
+    int first = stockUseFirst[midx] - 1, k = first;
+    for (;k<stockUseCount && stockUses[k].menuId == midx;k++) {
+        int64_t n = (int64_t)stockUses[k].perUnit * qty;
+        if (n > INT32_MAX || stockTake(stockUses[k].resource, (int32_t)n) != 0) break;
+    }
+    if (k == stockUseCount || stockUses[k].menuId != midx) return 0;
+    stockGive(first, k, qty);
+    return -3;
+}
+
+/* Hands back what stockReserve took for qty of an item: removed lines and lowered quantities. */
+static void stockRelease(int midx, int qty) {
+    if (!stockLoaded || stockUseFirst[midx] == 0) return;
+    int first = stockUseFirst[midx] - 1, end = first;
+    while (end < stockUseCount && stockUses[end].menuId == midx) end++;
+    stockGive(first, end, qty);
+}
+
+/* Under stockLock. */
+static void stockReconcile(void) {
+    for (int r=0;r<stockResourceCount;r++) stockPool(r, 0);
+    stockRefresh();
+}
+
+static int stockFind(const char *name) {
+    for (int r=0;r<stockResourceCount;r++) {
+        if (strcmp(stockResources[r].name, name) == 0) return r;
+    }
+    return -1;
+}
+
+static int stockAddResource(const char *name, int menuId) {
+    if (stockResourceCount == STOCK_MAX || strlen(name) >= STOCK_NAME_LEN) return -1;
+    StockResource *res = &stockResources[stockResourceCount];
+    strcpy(res->name, name);
+    res->menuId = menuId;
+    res->need = 1;
+    return stockResourceCount++;
+}
+
+static int stockAddUse(int menuId, int r, int32_t perUnit) {
+    int uses = 0;
+    for (int k=0;k<stockUseCount;k++) uses += stockUses[k].menuId == menuId;
+    if (stockUseCount == STOCK_MAX_USES || uses == STOCK_ITEM_USES) return -1;
+    stockUses[stockUseCount++] = (StockUse){ (uint16_t)menuId, (uint16_t)r, perUnit };
+    if (perUnit > stockResources[r].need) stockResources[r].need = perUnit;
+    return 0;
+}
+
+static int compareStockUses(const void *a, const void *b) {
+    const StockUse *x = a, *y = b;
+    if (x->menuId != y->menuId) return x->menuId < y->menuId ? -1 : 1;
+    return x->resource < y->resource ? -1 : x->resource > y->resource;
+}
+
+/* Starts counting from units[] (by resource), less whatever the orders already open hold. */
+static void stockInstall(int64_t *units) {
+    qsort(stockUses, (size_t)stockUseCount, sizeof(StockUse), compareStockUses);
+    for (int k=stockUseCount-1;k>=0;k--) stockUseFirst[stockUses[k].menuId] = k + 1;
+    for (int s=0;s<KOT_SHARDS;s++) {
+        for (int i=kotShards[s].activeHead;i!=-1;i=orderAt(i)->nextActive) {
+            const Order *o = orderAt(i);
+            for (int j=0;j<o->itemCount;j++) {
+                int id = o->items[j].menuIdx;
+                if (stockUseFirst[id] == 0) continue;
+                for (int k=stockUseFirst[id]-1;k<stockUseCount && stockUses[k].menuId == id;k++) {
+                    int64_t n = (int64_t)stockUses[k].perUnit * o->items[j].qty, *left = &units[stockUses[k].resource];
+                    *left -= n < *left ? n : *left;
+                }
+            }
+        }
+    }
+    for (int r=0;r<stockResourceCount;r++) atomic_store(&stockShards[0].units[r], (int32_t)units[r]);
+    stockLoaded = 1;
+    pthread_mutex_lock(&stockLock);
+    stockReconcile();
+    pthread_mutex_unlock(&stockLock);
+}
+
+/* Adds units to an item's or ingredient's count; returns the new count or -1. */
+int addStock(const char *name, int units) {
+    int r = stockLoaded ? stockFind(name) : -1;
+    if (r == -1 || units <= 0) return -1;
+    pthread_mutex_lock(&stockLock);
+    int64_t total = stockPool(r, 0);
+    if (total + units > STOCK_MAX_UNITS) total = -1;
+    else {
+        atomic_fetch_add(&stockShards[stockHome()].units[r], units);
+        total += units;
+        stockRefresh();
+    }
+    pthread_mutex_unlock(&stockLock);
+    return (int)total;
+}
+
+void showStock(FILE *out) {
+    fprintf(out, "\nStock:\n");
+    fprintf(out, "%-*s | %-10s | %10s\n", STOCK_NAME_LEN - 1, "Item / ingredient", "Kind", "Left");
+    fprintf(out, "-------------------------------------------------\n");
+    for (int r=0;r<stockResourceCount;r++) {
+        const StockResource *res = &stockResources[r];
+        fprintf(out, "%-*s | %-10s | %10" PRId64 "%s\n", STOCK_NAME_LEN - 1, res->name,
+                res->menuId == -1 ? "ingredient" : "item", stockCount(r),
+                res->menuId != -1 && atomic_load(&stockHeld[res->menuId]) ? "  (out)" : "");
+    }
+}
+
+/* Keeps the running subtotals in step with qtyDelta units of one line joining or leaving the order. */
+static void adjustOrderTotals(Order *o, const OrderItem *line, int qtyDelta) {
+    o->categorySubtotal[line->category - STARTER] += (Money)line->unitPrice * qtyDelta;
+}
+
+#ifdef BILLING_DEBUG
+static void checkOrderTotals(const Order *o) {
+    Money sums[CATEGORY_COUNT] = {0};
+    for (int i=0;i<o->itemCount;i++) sums[o->items[i].category - STARTER] += lineAmount(&o->items[i]);
+    for (int c=0;c<CATEGORY_COUNT;c++) {
+        if (sums[c] == o->categorySubtotal[c]) continue;
+        fprintf(stderr, "KOT %d running total for category %d %" PRId64 " != recomputed %" PRId64 "\n",
+                o->orderId, c + STARTER, o->categorySubtotal[c], sums[c]);
+        abort();
+    }
+}
+#define CHECK_ORDER_TOTALS(o) checkOrderTotals(o)
+#else
+#define CHECK_ORDER_TOTALS(o) ((void)0)
+#endif
+
+/* More of an item already on the order is billed at that line's price, even if the menu has since changed. */
+static int addLineToOrder(Order *o, int midx, int qty, Money unitPrice, int category) {
+    for (int i=0;i<o->itemCount;i++) {
+        if (o->items[i].menuIdx == midx) {
+            if (o->items[i].qty + qty > MAX_LINE_QTY) return -1;
+            o->items[i].qty += qty;
+            adjustOrderTotals(o, &o->items[i], qty);
+            CHECK_ORDER_TOTALS(o);
+            return 0;
+        }
+    }
+    if (qty > MAX_LINE_QTY || unitPrice > MAX_UNIT_PRICE) return -1;
+    if (o->itemCount >= MAX_ITEMS_PER_ORDER) return -2;
+    if (o->itemCount == o->itemCapacity && growOrderItems(o) != 0) return -1;
+    OrderItem *line = &o->items[o->itemCount++];
+    line->menuIdx = (uint16_t)midx;
+    line->qty = (uint16_t)qty;
+    line->unitPrice = (int32_t)unitPrice;
+    line->category = (uint16_t)category;
+    adjustOrderTotals(o, line, qty);
+    CHECK_ORDER_TOTALS(o);
+    return 0;
+}
+
+/*
+ * Counts one share of an even split into ways and returns how many were left before it. A split
+ * starts afresh when the number of ways changes or the last one was used up.
+ */
+static int orderTakeShare(OrderCold *c, int ways) {
+    if (c->shareWays != ways || c->sharesPaid >= ways) {
+        c->shareWays = (int16_t)ways;
+        c->sharesPaid = 0;
+    }
+    return ways - c->sharesPaid++;
+}
+
+/* Whether the order's line for midx has been paid for by item; paid lines cannot change. */
+static int orderLinePaid(int orderIdx, int midx) {
+    uint64_t paid = orderColdAt(orderIdx)->paidLines;
+    const Order *o = orderAt(orderIdx);
+    for (int i=0;paid && i<o->itemCount;i++) {
+        if (o->items[i].menuIdx == midx) return (int)(paid >> i & 1);
+    }
+    return 0;
+}
+
+int addItemToOrder(int orderIdx, const char* code, int qty) {
+    METRIC_SCOPE(METRIC_ADD_ITEM);
+    if (qty <= 0) return -1;
+    if (orderIdx < 0 || orderIdx >= orderCount) return -1;
+    Order *o = orderAt(orderIdx);
+    int midx = findMenuIndexByCode(code);
+    if (midx == -1) return -1;
+    const MenuItem *mi = menuItemById(menuPin(), midx);
+    if (!mi || !mi->available) {
+        menuUnpin();
+        return mi && atomic_load(&stockHeld[midx]) ? -3 : -1;
+    }
+    int category = mi->category;   /* mi is gone once unpinned if a reload frees the catalog */
+    pthread_mutex_lock(orderLock(orderIdx));
+    int ret = -1;
+    if (o->active && orderLinePaid(orderIdx, midx)) ret = -4;
+    else if (o->active && (ret = stockReserve(midx, qty)) == 0) {
+        ret = addLineToOrder(o, midx, qty, mi->price, category);
+        if (ret != 0) stockRelease(midx, qty);
+    }
+    menuUnpin();
+    if (ret == 0) {
+        journalAppend(JOURNAL_ADD, o, midx, qty);
+        kitchenEmit(o, midx, category, qty);
+    }
+    pthread_mutex_unlock(orderLock(orderIdx));
+    return ret;
+}
+
+
+int removeItemFromOrder(int orderIdx, const char* code) {
+    if (orderIdx < 0 || orderIdx >= orderCount) return -1;
+    Order *o = orderAt(orderIdx);
+    int midx = findMenuIndexByCode(code);
+    if (midx == -1) return -1;
+    int ret = -1;
+    pthread_mutex_lock(orderLock(orderIdx));
+    for (int i=0;o->active && i<o->itemCount;i++) {
+        if (o->items[i].menuIdx == midx) {
+            OrderCold *c = orderColdAt(orderIdx);
+            if (c->paidLines >> i & 1) {
+                ret = -4;
+                break;
+            }
+            /* the lines after i move down one, and their paid bits with them */
+            c->paidLines = (c->paidLines & ((1ull << i) - 1)) | (c->paidLines >> (i + 1) << i);
+            adjustOrderTotals(o, &o->items[i], -o->items[i].qty);
+            kitchenEmit(o, midx, o->items[i].category, -o->items[i].qty);
+            stockRelease(midx, o->items[i].qty);
+            for (int j=i;j<o->itemCount-1;j++) {
+                o->items[j] = o->items[j+1];
+            }
+            o->itemCount--;
+            CHECK_ORDER_TOTALS(o);
+            journalAppend(JOURNAL_REMOVE, o, midx, 0);
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(orderLock(orderIdx));
+    return ret;
+}
+
+
+int updateItemQtyInOrder(int orderIdx, const char* code, int newQty) {
+    if (orderIdx < 0 || orderIdx >= orderCount) return -1;
+    Order *o = orderAt(orderIdx);
+    int midx = findMenuIndexByCode(code);
+    if (midx == -1) return -1;
+    if (newQty <= 0) return removeItemFromOrder(orderIdx, code);
+    if (newQty > MAX_LINE_QTY) return -1;
+    int ret = -1;
+    pthread_mutex_lock(orderLock(orderIdx));
+    for (int i=0;o->active && i<o->itemCount;i++) {
+        if (o->items[i].menuIdx == midx) {
+            int delta = newQty - o->items[i].qty;
+            if (orderColdAt(orderIdx)->paidLines >> i & 1) {
+                ret = -4;
+                break;
+            }
+            if (delta > 0 && stockReserve(midx, delta) != 0) {
+                ret = -3;
+                break;
+            }
+            if (delta < 0) stockRelease(midx, -delta);
+            adjustOrderTotals(o, &o->items[i], delta);
+            kitchenEmit(o, midx, o->items[i].category, delta);
+            o->items[i].qty = newQty;
+            CHECK_ORDER_TOTALS(o);
+            journalAppend(JOURNAL_UPDATE, o, midx, newQty);
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(orderLock(orderIdx));
+    return ret;
+}
+
+
+/*
+ * Joins `table` to the order's party. A free table is simply claimed; a table held by another
+ * order folds that order in: its lines and tables move over and it is closed unbilled.
+ * Returns 0, the KOT that was folded in, or -1.
+ */
+int mergeTable(int orderId, int table) {
+    pthread_mutex_lock(&floorLock);
+    int idx = lockOrderById(orderId);
+    if (idx == -1) {
+        pthread_mutex_unlock(&floorLock);
+        return -1;
+    }
+    Order *o = orderAt(idx);
+    int ret = -1;
+    if (o->dineIn && table >= 1 && table <= floorTableCount) {
+        int other = tableOrderIndex[table-1];
+        if (!tableOccupied(table) && floorClaim(table, idx) == 0) {
+            floorAppendToGroup(o, table);
+            journalAppend(JOURNAL_MERGE, o, -1, table);
+            ret = 0;
+        } else if (other != -1 && other != idx) {
+            Order *b = orderAt(other);
+            pthread_mutex_lock(orderLock(other));
+            int newLines = 0, qtyFits = 1;
+            for (int i=0;i<b->itemCount;i++) {
+                int found = 0;
+                for (int j=0;j<o->itemCount && !found;j++) {
+                    found = o->items[j].menuIdx == b->items[i].menuIdx;
+                    if (found && o->items[j].qty + b->items[i].qty > MAX_LINE_QTY) qtyFits = 0;
+                }
+                newLines += !found;
+            }
+            /* part-paid orders keep their own lines: payments are tracked per order */
+            if (b->active && b->dineIn && tableOrderIndex[table-1] == other
+                && o->itemCount + newLines <= MAX_ITEMS_PER_ORDER && qtyFits
+                && orderColdAt(idx)->paid == 0 && orderColdAt(other)->paid == 0) {
+                journalAppend(JOURNAL_MERGE, o, -1, table);
+                for (int i=0;i<b->itemCount;i++) {
+                    const OrderItem *line = &b->items[i];
+                    addLineToOrder(o, line->menuIdx, line->qty, line->unitPrice, line->category);
+                }
+                for (int t=b->tableNumber;t!=0;t=tableLink[t-1]) tableOrderIndex[t-1] = idx;
+                floorAppendToGroup(o, b->tableNumber);
+                ret = b->orderId;
+                /* the tables now belong to this order, so closing b must not free them */
+                b->dineIn = 0;
+                b->tableNumber = 0;
+                closeOrder(other);
+            }
+            pthread_mutex_unlock(orderLock(other));
+        }
+    }
+    unlockOrder(idx);
+    pthread_mutex_unlock(&floorLock);
+    return ret;
+}
+
+/* Frees one table of a party seated across several; the order keeps at least one table. */
+int splitTable(int orderId, int table) {
+    pthread_mutex_lock(&floorLock);
+    int idx = lockOrderById(orderId);
+    if (idx == -1) {
+        pthread_mutex_unlock(&floorLock);
+        return -1;
+    }
+    Order *o = orderAt(idx);
+    int ret = -1;
+    if (o->dineIn && table >= 1 && table <= floorTableCount && tableOrderIndex[table-1] == idx
+        && tableLink[o->tableNumber-1] != 0) {
+        if (o->tableNumber == table) o->tableNumber = tableLink[table-1];
+        else {
+            int t = o->tableNumber;
+            while (tableLink[t-1] != table) t = tableLink[t-1];
+            tableLink[t-1] = tableLink[table-1];
+        }
+        floorRelease(table);
+        journalAppend(JOURNAL_SPLIT, o, -1, table);
+        ret = 0;
+    }
+    unlockOrder(idx);
+    pthread_mutex_unlock(&floorLock);
+    return ret;
+}
+
+/* Reseats an order from its primary table onto a free one; the Order itself stays where it is. */
+int moveOrder(int orderId, int table) {
+    pthread_mutex_lock(&floorLock);
+    int idx = lockOrderById(orderId);
+    if (idx == -1) {
+        pthread_mutex_unlock(&floorLock);
+        return -1;
+    }
+    Order *o = orderAt(idx);
+    int ret = -1;
+    if (o->dineIn && floorClaim(table, idx) == 0) {
+        int old = o->tableNumber;
+        tableLink[table-1] = tableLink[old-1];
+        floorRelease(old);
+        o->tableNumber = table;
+        journalAppend(JOURNAL_MOVE, o, -1, table);
+        ret = 0;
+    }
+    unlockOrder(idx);
+    pthread_mutex_unlock(&floorLock);
+    return ret;
+}
+
+
+static uint32_t journalChecksum(const JournalRecord *r) {
+    const unsigned char *p = (const unsigned char*)r;
+    uint32_t h = 2166136261u;
+    for (size_t i=0;i<offsetof(JournalRecord, checksum);i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int writeFully(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0) return -1;
+        p += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+static void journalDisable(void) {
+    fprintf(stderr, "Journal %s cannot be written; journaling is off until restart.\n", journalPath);
+    close(journalFd);
+    journalFd = -1;
+    journalPending = 0;
+}
+
+/*
+ * The journal is shared by every terminal. Records are buffered under journalLock; fsyncs run
+ * under journalSyncLock only, so terminals keep appending while one of them waits on the disk.
+ * Lock order is journalSyncLock, then journalLock. A failed write is cut back to the last whole
+ * record so a retry does not append records twice.
+ */
+static int journalFlush(int doFsync) {
+    if (journalFd == -1) return 0;
+    if (journalPending > 0) {
+        size_t len = sizeof(JournalRecord) * (size_t)journalPending;
+        if (writeFully(journalFd, journalBuf, len) != 0) {
+            fprintf(stderr, "Journal write failed.\n");
+            if (ftruncate(journalFd, journalBytes) != 0 || lseek(journalFd, journalBytes, SEEK_SET) < 0) journalDisable();
+            return -1;
+        }
+        journalBytes += (off_t)len;
+        journalPending = 0;
+    }
+    if (doFsync && fsync(journalFd) != 0) {
+        fprintf(stderr, "Journal fsync failed.\n");
+        return -1;
+    }
+    if (doFsync || journalFsync == FSYNC_NONE) journalDurableSeq = journalSeq;
+    return 0;
+}
+
+/* Claims the next buffered record with the order's fields filled in; NULL when not journaling. Holds journalLock until journalEnd. */
+static JournalRecord* journalBegin(JournalEventType type, const Order *o, int qty) {
+    if (journalFd == -1 || journalReplaying) return NULL;
+    pthread_mutex_lock(&journalLock);
+    if (journalFd == -1) {
+        pthread_mutex_unlock(&journalLock);
+        return NULL;
+    }
+    /* with nowhere to put the record, stop journaling rather than run past the buffer */
+    if (journalPending == JOURNAL_BUFFER_RECORDS && journalFlush(0) != 0 && journalFd != -1) journalDisable();
+    if (journalFd == -1) {
+        pthread_mutex_unlock(&journalLock);
+        return NULL;
+    }
+    JournalRecord *r = &journalBuf[journalPending];
+    memset(r, 0, sizeof(*r));
+    r->type = (uint8_t)type;
+    r->dineIn = (uint8_t)o->dineIn;
+    r->orderId = o->orderId;
+    r->tableNumber = o->tableNumber;
+    r->qty = qty;
+    r->timestamp = (int64_t)o->timestamp;
+    return r;
+}
+
+static void journalEnd(JournalRecord *r) {
+    r->checksum = journalChecksum(r);
+    if (journalPending++ == 0) clock_gettime(CLOCK_MONOTONIC, &journalFirstPending);
+    journalSinceSnapshot++;
+    journalLastSeq = ++journalSeq;
+    pthread_mutex_unlock(&journalLock);
+}
+
+static void journalAppend(JournalEventType type, const Order *o, int midx, int qty) {
+    JournalRecord *r = journalBegin(type, o, qty);
+    if (!r) return;
+    if (midx >= 0) {
+        memcpy(r->code, menuCodes[midx], CODE_LEN);
+        for (int i=0;i<o->itemCount;i++) {
+            if (o->items[i].menuIdx == midx) {
+                r->category = (uint8_t)o->items[i].category;
+                r->price = o->items[i].unitPrice;
+                break;
+            }
+        }
+    }
+    journalEnd(r);
+}
+
+/* PAY carries the amount in price, the mask of lines paid for by item in code and the ways of a share in qty. */
+static void journalAppendPayment(const Order *o, Money amount, uint64_t lines, int ways) {
+    JournalRecord *r = journalBegin(JOURNAL_PAY, o, ways);
+    if (!r) return;
+    r->price = amount;
+    memcpy(r->code, &lines, sizeof(lines));
+    journalEnd(r);
+}
+
+/* Commands run inside a shared gate so a checkpoint can briefly stop them at a command boundary. */
+static void commandGateEnter(void) {
+    while (1) {
+        atomic_fetch_add(&commandsInFlight, 1);
+        if (!commandGateClosed) return;
+        atomic_fetch_sub(&commandsInFlight, 1);
+        pthread_mutex_lock(&commandGateLock);
+        while (commandGateClosed) pthread_cond_wait(&commandGateOpened, &commandGateLock);
+        pthread_mutex_unlock(&commandGateLock);
+    }
+}
+
+static void commandGateExit(void) {
+    atomic_fetch_sub(&commandsInFlight, 1);
+}
+
+static void commandGateClose(void) {
+    pthread_mutex_lock(&commandGateLock);
+    commandGateClosed = 1;
+    pthread_mutex_unlock(&commandGateLock);
+    struct timespec pause = { 0, 50000 };
+    while (commandsInFlight > 0) nanosleep(&pause, NULL);
+}
+
+static void commandGateOpen(void) {
+    pthread_mutex_lock(&commandGateLock);
+    commandGateClosed = 0;
+    pthread_cond_broadcast(&commandGateOpened);
+    pthread_mutex_unlock(&commandGateLock);
+}
+
+static int journalCheckpointLocked(void);
+
+/* Caller holds journalCheckpointLock and is not inside a command. */
+static int journalCheckpointQuiesced(int force) {
+    commandGateClose();
+    pthread_mutex_lock(&journalSyncLock);
+    pthread_mutex_lock(&journalLock);
+    int ret = force || journalSinceSnapshot >= JOURNAL_SNAPSHOT_RECORDS ? journalCheckpointLocked() : 0;
+    pthread_mutex_unlock(&journalLock);
+    pthread_mutex_unlock(&journalSyncLock);
+    commandGateOpen();
+    return ret;
+}
+
+/* Makes every record up to target durable; one fsync covers all terminals queued behind it. */
+static void journalSyncTo(uint64_t target) {
+    if (journalDurableSeq >= target) return;
+    pthread_mutex_lock(&journalSyncLock);
+    if (journalDurableSeq < target) {
+        pthread_mutex_lock(&journalLock);
+        int fd = journalFd;
+        uint64_t upTo = journalSeq;
+        int ok = journalFlush(0) == 0;
+        pthread_mutex_unlock(&journalLock);
+        if (ok && fd != -1 && journalFsync != FSYNC_NONE) ok = fsync(fd) == 0;
+        if (ok) journalDurableSeq = upTo;
+    }
+    pthread_mutex_unlock(&journalSyncLock);
+}
+
+/* Called once an operation is complete; group-commits unless the policy asks for every record. */
+void journalCommit(void) {
+    if (journalFd == -1) return;
+    uint64_t target = journalFsync == FSYNC_ALWAYS ? journalLastSeq : 0;
+    pthread_mutex_lock(&journalLock);
+    if (!target && journalPending > 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long ms = (long)(now.tv_sec - journalFirstPending.tv_sec) * 1000
+                + (now.tv_nsec - journalFirstPending.tv_nsec) / 1000000;
+        if (ms >= JOURNAL_GROUP_MS) target = journalSeq;
+    }
+    int due = journalSinceSnapshot >= JOURNAL_SNAPSHOT_RECORDS;
+    pthread_mutex_unlock(&journalLock);
+    if (target) journalSyncTo(target);
+    /* one terminal takes the checkpoint; the rest carry on and find the counter reset */
+    if (due && pthread_mutex_trylock(&journalCheckpointLock) == 0) {
+        journalCheckpointQuiesced(0);
+        pthread_mutex_unlock(&journalCheckpointLock);
+    }
+}
+
+/* Called before blocking on input so nothing acknowledged to the cashier sits in the buffer. */
+void journalSync(void) {
+    journalSyncTo(journalLastSeq);
+}
+
+/* A generation closed by a checkpoint is kept as <journal>.<generation> for --consolidate. */
+static int journalKeepClosed(const char *path, uint64_t generation) {
+    char closed[JOURNAL_PATH_LEN + 24];
+    snprintf(closed, sizeof(closed), "%s.%llu", path, (unsigned long long)generation);
+    return rename(path, closed);
+}
+
+static int journalCreateFile(const char *path, uint64_t generation) {
+    char tmp[JOURNAL_PATH_LEN + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return -1;
+    JournalHeader h = { JOURNAL_MAGIC, 1, generation };
+    if (writeFully(fd, &h, sizeof(h)) != 0 || fsync(fd) != 0 || rename(tmp, path) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Writes every live order to <journal>.snap, keeps the closed journal and starts a fresh generation;
+ * a generation with no records is left open. Callers hold both journal locks with no command in
+ * flight, so every applied change is journaled.
+ */
+static int journalCheckpointLocked(void) {
+    if (journalFd == -1 || journalSinceSnapshot == 0) return 0;
+    if (journalFlush(1) != 0) return -1;
+    char snapPath[JOURNAL_PATH_LEN + 8], tmp[JOURNAL_PATH_LEN + 16];
+    snprintf(snapPath, sizeof(snapPath), "%s.snap", journalPath);
+    snprintf(tmp, sizeof(tmp), "%s.snap.tmp", journalPath);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return -1;
+    SnapshotHeader h = { SNAPSHOT_MAGIC, 3, journalGeneration + 1, nextOrderId, activeOrderCount };
+    fwrite(&h, sizeof(h), 1, f);
+    for (int k=0;k<KOT_SHARDS;k++) {
+        KotShard *s = &kotShards[k];
+        pthread_mutex_lock(&s->lock);
+        for (int i=s->activeHead;i!=-1;i=orderAt(i)->nextActive) {
+            Order *o = orderAt(i);
+            int linked = 0;
+            for (int t=o->dineIn ? tableLink[o->tableNumber-1] : 0;t!=0;t=tableLink[t-1]) linked++;
+            SnapshotOrder so = { o->orderId, o->dineIn, o->tableNumber, o->itemCount, (int64_t)o->timestamp, linked,
+                                 orderColdAt(i)->shareWays, orderColdAt(i)->sharesPaid, orderColdAt(i)->paid, orderColdAt(i)->paidLines };
+            fwrite(&so, sizeof(so), 1, f);
+            for (int j=0;j<o->itemCount;j++) {
+                SnapshotLine sl;
+                memset(&sl, 0, sizeof(sl));
+                memcpy(sl.code, menuCodes[o->items[j].menuIdx], CODE_LEN);
+                sl.qty = o->items[j].qty;
+                sl.category = o->items[j].category;
+                sl.price = o->items[j].unitPrice;
+                fwrite(&sl, sizeof(sl), 1, f);
+            }
+            for (int t=so.linkedTables ? tableLink[o->tableNumber-1] : 0;t!=0;t=tableLink[t-1]) {
+                int32_t table = t;
+                fwrite(&table, sizeof(table), 1, f);
+            }
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    int ok = fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp, snapPath) != 0) return -1;
+    if (journalKeepClosed(journalPath, journalGeneration) != 0) return -1;
+    int fd = journalCreateFile(journalPath, journalGeneration + 1);
+    if (fd == -1) return -1;
+    close(journalFd);
+    journalFd = fd;
+    journalBytes = sizeof(JournalHeader);
+    journalGeneration++;
+    journalSinceSnapshot = 0;
+    return 0;
+}
+
+int journalCheckpoint(void) {
+    pthread_mutex_lock(&journalCheckpointLock);
+    int ret = journalCheckpointQuiesced(1);
+    pthread_mutex_unlock(&journalCheckpointLock);
+    return ret;
+}
+
+/* Recovered lines keep the price they were ordered at; only records without a category fall back to the menu. */
+static void addRecoveredLine(Order *o, int midx, int qty, Money price, int category) {
+    if (category == 0) {
+        const MenuItem *mi = menuItemById(menuPin(), midx);
+        if (mi) category = mi->category;
+        menuUnpin();
+        if (category == 0) return;
+    }
+    addLineToOrder(o, midx, qty, price, category);
+}
+
+static size_t snapshotOrderLen(uint32_t version) {
+    if (version < 2) return offsetof(SnapshotOrder, linkedTables);
+    return version < 3 ? offsetof(SnapshotOrder, paid) : sizeof(SnapshotOrder);
+}
+
+static int loadSnapshot(const char *path, uint64_t *generation) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    SnapshotHeader h;
+    if (fread(&h, sizeof(h), 1, f) != 1 || h.magic != SNAPSHOT_MAGIC) { fclose(f); return -1; }
+    for (int i=0;i<h.orderCount;i++) {
+        SnapshotOrder so;
+        size_t soLen = snapshotOrderLen(h.version);
+        memset(&so, 0, sizeof(so));
+        if (fread(&so, soLen, 1, f) != 1) { fclose(f); return -1; }
+        int idx = createOrderWithId(so.orderId, so.dineIn, so.tableNumber, (time_t)so.timestamp);
+        if (idx != -1) {
+            orderColdAt(idx)->paid = so.paid;
+            orderColdAt(idx)->paidLines = so.paidLines;
+            orderColdAt(idx)->shareWays = so.shareWays;
+            orderColdAt(idx)->sharesPaid = so.sharesPaid;
+        }
+        for (int j=0;j<so.itemCount;j++) {
+            SnapshotLine sl;
+            if (fread(&sl, sizeof(sl), 1, f) != 1) { fclose(f); return -1; }
+            sl.code[CODE_LEN-1] = '\0';
+            int midx = internMenuCode(sl.code);
+            if (idx != -1 && midx != -1) addRecoveredLine(orderAt(idx), midx, sl.qty, sl.price, sl.category);
+        }
+        for (int j=0;j<so.linkedTables;j++) {
+            int32_t table;
+            if (fread(&table, sizeof(table), 1, f) != 1) { fclose(f); return -1; }
+            if (idx != -1 && so.dineIn && floorClaim(table, idx) == 0) floorAppendToGroup(orderAt(idx), table);
+        }
+    }
+    if (h.nextOrderId > nextOrderId) nextOrderId = h.nextOrderId;
+    *generation = h.generation;
+    fclose(f);
+    return 1;
+}
+
+static void replayRecord(const JournalRecord *r) {
+    char code[CODE_LEN];
+    memcpy(code, r->code, CODE_LEN);
+    code[CODE_LEN-1] = '\0';
+    int idx = r->type == JOURNAL_CREATE ? -1 : findOrderIndexById(r->orderId);
+    int midx = r->type == JOURNAL_ADD ? internMenuCode(code) : -1;   /* PAY keeps a line mask in code */
+    switch (r->type) {
+        case JOURNAL_CREATE:
+            createOrderWithId(r->orderId, r->dineIn, r->tableNumber, (time_t)r->timestamp);
+            break;
+        case JOURNAL_ADD:
+            if (idx != -1 && midx != -1) addRecoveredLine(orderAt(idx), midx, r->qty, r->price, r->category);
+            break;
+        case JOURNAL_REMOVE:
+            if (idx != -1) removeItemFromOrder(idx, code);
+            break;
+        case JOURNAL_UPDATE:
+            if (idx != -1) updateItemQtyInOrder(idx, code, r->qty);
+            break;
+        case JOURNAL_CLOSE:
+            if (idx != -1) closeOrder(idx);
+            break;
+        case JOURNAL_MERGE:
+            mergeTable(r->orderId, r->qty);
+            break;
+        case JOURNAL_SPLIT:
+            splitTable(r->orderId, r->qty);
+            break;
+        case JOURNAL_MOVE:
+            moveOrder(r->orderId, r->qty);
+            break;
+        case JOURNAL_PAY:
+            if (idx != -1) {
+                uint64_t lines;
+                memcpy(&lines, r->code, sizeof(lines));
+                orderColdAt(idx)->paid += r->price;
+                orderColdAt(idx)->paidLines |= lines;
+                if (r->qty > 0) orderTakeShare(orderColdAt(idx), r->qty);
+            }
+            break;
+    }
+}
+
+/* Recovers state from <path>.snap and <path>, then keeps appending to <path>. */
+int journalOpen(const char *path, FsyncPolicy policy) {
+    char snapPath[JOURNAL_PATH_LEN + 8];
+    if (strlen(path) >= JOURNAL_PATH_LEN) return -1;
+    strcpy(journalPath, path);
+    journalFsync = policy;
+    snprintf(snapPath, sizeof(snapPath), "%s.snap", path);
+
+    journalReplaying = 1;
+    uint64_t snapGen = 0;
+    int snap = loadSnapshot(snapPath, &snapGen);
+    if (snap < 0) {
+        journalReplaying = 0;
+        printf("Snapshot %s is corrupt.\n", snapPath);
+        return -1;
+    }
+    long replayed = 0;
+    off_t validEnd = 0;
+    int fd = open(path, O_RDWR);
+    if (fd != -1) {
+        JournalHeader h;
+        if (read(fd, &h, sizeof(h)) == (ssize_t)sizeof(h) && h.magic == JOURNAL_MAGIC) {
+            validEnd = sizeof(h);
+            journalGeneration = h.generation;
+            JournalRecord r;
+            while (read(fd, &r, sizeof(r)) == (ssize_t)sizeof(r) && r.checksum == journalChecksum(&r)) {
+                /* a journal older than the snapshot is already folded into it */
+                if (h.generation >= snapGen) replayRecord(&r);
+                validEnd += sizeof(r);
+                replayed++;
+            }
+        }
+        /* a checkpoint that died before rotating leaves the older generation in place */
+        if (validEnd != 0 && journalGeneration < snapGen) journalKeepClosed(path, journalGeneration);
+        if (validEnd == 0 || journalGeneration < snapGen || ftruncate(fd, validEnd) != 0 || lseek(fd, 0, SEEK_END) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    journalReplaying = 0;
+    if (snapGen > journalGeneration) journalGeneration = snapGen;
+    if (fd == -1) {
+        fd = journalCreateFile(path, journalGeneration);
+        validEnd = sizeof(JournalHeader);
+    }
+    if (fd == -1) {
+        printf("Cannot open journal %s\n", path);
+        return -1;
+    }
+    journalFd = fd;
+    journalBytes = validEnd;
+    journalSinceSnapshot = replayed;
+    if (snap || replayed) printf("Recovered %d active orders (%ld journal records).\n", activeOrderCount, replayed);
+    return 0;
+}
+
+void journalClose(void) {
+    pthread_mutex_lock(&journalSyncLock);
+    pthread_mutex_lock(&journalLock);
+    if (journalFd != -1) {
+        journalCheckpointLocked();
+        journalFlush(1);
+        close(journalFd);
+        journalFd = -1;
+    }
+    pthread_mutex_unlock(&journalLock);
+    pthread_mutex_unlock(&journalSyncLock);
+}
+
+
+/* Each rate is applied once per bill component and rounded half away from zero to whole paise. */
+Money applyRateBp(Money amount, int rateBp) {
+    Money scaled = amount * rateBp;
+    if (scaled >= 0) return (scaled + RATE_BP_SCALE/2) / RATE_BP_SCALE;
+    return -((-scaled + RATE_BP_SCALE/2) / RATE_BP_SCALE);
+}
+
+/* Writes m as rupees with two decimals into buf (at least MONEY_STR_LEN bytes); returns the length. */
+static int moneyToChars(Money m, char *buf) {
+    char tmp[MONEY_STR_LEN];
+    int n = 0, len = 0;
+    uint64_t a = m < 0 ? (uint64_t)0 - (uint64_t)m : (uint64_t)m;
+    tmp[n++] = (char)('0' + a % 10); a /= 10;
+    tmp[n++] = (char)('0' + a % 10); a /= 10;
+    tmp[n++] = '.';
+    do { tmp[n++] = (char)('0' + a % 10); a /= 10; } while (a);
+    if (m < 0) buf[len++] = '-';
+    while (n) buf[len++] = tmp[--n];
+    buf[len] = '\0';
+    return len;
+}
+
+char* formatMoney(Money m, char *buf) {
+    moneyToChars(m, buf);
+    return buf;
+}
+
+
+/* Seconds to add to a UTC timestamp to get local wall-clock time at t. */
+static long utcOffsetAt(time_t t) {
+    struct tm lt, gt;
+    localtime_r(&t, &lt);
+    gmtime_r(&t, &gt);
+    long off = (lt.tm_hour - gt.tm_hour) * 3600L + (lt.tm_min - gt.tm_min) * 60L;
+    if (lt.tm_year != gt.tm_year) off += lt.tm_year > gt.tm_year ? 86400L : -86400L;
+    else if (lt.tm_yday != gt.tm_yday) off += lt.tm_yday > gt.tm_yday ? 86400L : -86400L;
+    return off;
+}
+
+/* t on the local wall clock, in seconds since the epoch; UTC offsets are cached by hour per thread. */
+static int64_t localClock(time_t t) {
+    static _Thread_local time_t offsetHour[256];       /* hour + 1, 0 = empty */
+    static _Thread_local long offset[256];
+    time_t hour = t / 3600;
+    unsigned h = (unsigned)hour & 255;
+    if (offsetHour[h] != hour + 1) {
+        offset[h] = utcOffsetAt(t);
+        offsetHour[h] = hour + 1;
+    }
+    return (int64_t)t + offset[h];
+}
+
+static int64_t localDayOf(time_t t) {
+    int64_t local = localClock(t);
+    return local >= 0 ? local / 86400 : (local - 86399) / 86400;
+}
+
+/* Quarter-hour of the local week (Sunday 00:00 is slot 0) that t falls in. */
+static int pricingWeekSlot(time_t t) {
+    int64_t local = localClock(t);
+    int64_t day = local >= 0 ? local / 86400 : (local - 86399) / 86400;
+    int weekday = (int)(((day + 4) % 7 + 7) % 7);      /* 1970-01-01 was a Thursday */
+    int minute = (int)((local - day * 86400) / 60);
+    return weekday * (24 * 60 / PRICING_SLOT_MINUTES) + minute / PRICING_SLOT_MINUTES;
+}
+
+/* Combos are taken greedily in file order, each as many times as the still unclaimed quantities allow. */
+static Money comboSavings(const PricingTable *t, const Order *o) {
+    uint64_t have = 0;
+    int left[MAX_ITEMS_PER_ORDER];
+    for (int i=0;i<o->itemCount;i++) {
+        have |= 1ull << (o->items[i].menuIdx & 63);
+        left[i] = o->items[i].qty;
+    }
+    Money saving = 0;
+    for (int k=0;k<t->comboCount;k++) {
+        const PricingCombo *cb = &t->combos[k];
+        if (cb->signature & ~have) continue;
+        int line[PRICING_COMBO_ITEMS], times = MAX_LINE_QTY;
+        for (int j=0;j<cb->itemCount && times > 0;j++) {
+            line[j] = -1;
+            for (int i=0;i<o->itemCount;i++) {
+                if (o->items[i].menuIdx == cb->item[j]) { line[j] = i; break; }
+            }
+            int fits = line[j] == -1 ? 0 : left[line[j]] / cb->count[j];
+            if (fits < times) times = fits;
+        }
+        if (times == 0) continue;
+        for (int j=0;j<cb->itemCount;j++) left[line[j]] -= times * cb->count[j];
+        saving += cb->saving * times;
+    }
+    return saving;
+}
+
+/* Happy-hour cuts, tax and service on per-category amounts; fills those parts of b and returns what they come to. */
+static Money priceCategories(const PricingTable *t, const Money *amounts, time_t openedAt, int dineIn, Bill *b) {
+    const int *happy = t->happyBp[t->happyCount > 1 ? t->happySlot[pricingWeekSlot(openedAt)] : 0];
+    Money net[CATEGORY_COUNT];
+    for (int c=0;c<CATEGORY_COUNT;c++) {
+        Money cut = applyRateBp(amounts[c], happy[c]);
+        b->subtotal += amounts[c];
+        b->happyHour += cut;
+        net[c] = amounts[c] - cut;
+    }
+    Money netTotal = b->subtotal - b->happyHour;
+    for (int r=0;r<t->taxRates;r++) {
+        Money base = 0;
+        for (int c=0;c<CATEGORY_COUNT;c++) base += net[c] & -(Money)((t->taxMask[r] >> (c + STARTER)) & 1);
+        b->gst += applyRateBp(base, t->taxRateBp[r]);
+    }
+    b->serviceCharge = applyRateBp(netTotal, t->serviceBp[dineIn]);
+    return netTotal + b->gst + b->serviceCharge;
+}
+
+/*
+ * Happy-hour cuts come off each category first; tax and service are charged on what is left, the
+ * tier discount on that total, and combos and the coupon last, on the amount due. The caller holds
+ * the order lock.
+ */
+static Bill priceOrder(const PricingTable *t, const Order *o, const PricingCoupon *coupon) {
+    Bill b;
+    memset(&b, 0, sizeof(b));
+    Money temp = priceCategories(t, o->categorySubtotal, o->timestamp, o->dineIn, &b);
+    /* count the thresholds below temp with a fixed-step binary search (selects, no data-dependent branches) */
+    const Money *above = t->tierAbove;
+    int span = t->tierCount;
+    while (span > 1) {
+        int half = span / 2;
+        above = above[half - 1] < temp ? above + half : above;
+        span -= half;
+    }
+    int passed = (int)(above - t->tierAbove) + (span == 1 && *above < temp);
+    b.discountBp = t->tierRateBp[passed];
+    b.discount = applyRateBp(temp, b.discountBp);
+    Money due = temp - b.discount;
+    if (t->comboCount > 0) {
+        b.combo = comboSavings(t, o);
+        if (b.combo > due) b.combo = due;
+        due -= b.combo;
+    }
+    if (coupon && due >= coupon->minTotal) {
+        b.coupon = coupon->rateBp ? applyRateBp(due, coupon->rateBp) : coupon->amount < due ? coupon->amount : due;
+        due -= b.coupon;
+        memcpy(b.couponCode, coupon->code, COUPON_LEN);
+    }
+    b.total = due;
+    return b;
+}
+
+/*
+ * The part of the whole order's bill that falls on the lines in mask: happy hour, tax and service
+ * on those lines as for the order, the order's discount rate (splitting a table's bill does not drop
+ * it to a lower tier) and a share of the combo savings in proportion to the lines' subtotal. Only
+ * the chosen lines are read; everything else comes from whole. The caller holds the order lock.
+ */
+static Bill priceLines(const PricingTable *t, const Order *o, const Bill *whole, uint64_t mask) {
+    Bill b;
+    memset(&b, 0, sizeof(b));
+    Money amounts[CATEGORY_COUNT] = {0};
+    for (uint64_t m=mask;m;m&=m-1) {
+        const OrderItem *line = &o->items[__builtin_ctzll(m)];
+        amounts[line->category - STARTER] += lineAmount(line);
+    }
+    Money temp = priceCategories(t, amounts, o->timestamp, o->dineIn, &b);
+    b.discountBp = whole->discountBp;
+    b.discount = applyRateBp(temp, b.discountBp);
+    Money due = temp - b.discount;
+    if (whole->combo > 0 && whole->subtotal > 0) {
+        b.combo = (Money)((__int128)whole->combo * b.subtotal / whole->subtotal);
+        if (b.combo > due) b.combo = due;
+        due -= b.combo;
+    }
+    b.total = due;
+    return b;
+}
+
+static int compareCoupons(const void *a, const void *b) {
+    return strcasecmp(((const PricingCoupon*)a)->code, ((const PricingCoupon*)b)->code);
+}
+
+const PricingCoupon* findCoupon(const char *code) {
+    PricingCoupon key;
+    if (pricing->couponCount == 0 || strlen(code) >= COUPON_LEN) return NULL;
+    strcpy(key.code, code);
+    return bsearch(&key, pricing->coupons, (size_t)pricing->couponCount, sizeof(PricingCoupon), compareCoupons);
+}
+
+static int happyRuleCovers(const PricingHappyRule *h, int slot) {
+    int day = slot / (24 * 60 / PRICING_SLOT_MINUTES);
+    int minute = slot % (24 * 60 / PRICING_SLOT_MINUTES) * PRICING_SLOT_MINUTES;
+    if (h->fromMinute <= h->toMinute) return (h->days >> day & 1) && minute >= h->fromMinute && minute < h->toMinute;
+    /* a window past midnight belongs to the day it starts on */
+    if (minute >= h->fromMinute) return h->days >> day & 1;
+    return minute < h->toMinute && (h->days >> ((day + 6) % 7) & 1);
+}
+
+static void formatPercent(char *buf, size_t cap, int bp) {
+    if (bp % 100 == 0) snprintf(buf, cap, "%d%%", bp / 100);
+    else snprintf(buf, cap, "%d.%02d%%", bp / 100, bp % 100);
+}
+
+/* Fills t from rules; returns -1 if the happy hours need more than PRICING_MAX_HAPPY distinct rate rows. */
+int compilePricing(const PricingRules *rules, PricingTable *t) {
+    memset(t, 0, sizeof(*t));
+    for (int c=0;c<CATEGORY_COUNT;c++) {
+        if (rules->taxBp[c] == 0) continue;
+        int r = 0;
+        while (r < t->taxRates && t->taxRateBp[r] != rules->taxBp[c]) r++;
+        if (r == t->taxRates) t->taxRateBp[t->taxRates++] = rules->taxBp[c];
+        t->taxMask[r] |= CATEGORY_BIT(c + STARTER);
+    }
+    char pct[16];
+    strcpy(t->taxLabel, "GST:");
+    if (t->taxRates == 1) formatPercent(pct, sizeof(pct), t->taxRateBp[0]);
+    if (t->taxRates == 1 && t->taxMask[0] == FOOD_CATEGORY_MASK) snprintf(t->taxLabel, sizeof(t->taxLabel), "GST (%s on food):", pct);
+    else if (t->taxRates == 1 && t->taxMask[0] == (FOOD_CATEGORY_MASK | CATEGORY_BIT(BEVERAGE))) snprintf(t->taxLabel, sizeof(t->taxLabel), "GST (%s):", pct);
+    t->serviceBp[0] = rules->serviceBp[0];
+    t->serviceBp[1] = rules->serviceBp[1];
+
+    /* sort tiers by threshold; above several, the highest one passed sets the rate */
+    int order[PRICING_MAX_TIERS];
+    for (int i=0;i<rules->tierCount;i++) {
+        int j = i;
+        while (j > 0 && rules->tierAbove[order[j-1]] > rules->tierAbove[i]) { order[j] = order[j-1]; j--; }
+        order[j] = i;
+    }
+    for (int i=0;i<rules->tierCount;i++) {
+        t->tierAbove[i] = rules->tierAbove[order[i]];
+        t->tierRateBp[i+1] = rules->tierBp[order[i]];
+    }
+    t->tierCount = rules->tierCount;
+
+    /* where happy hours overlap, each category gets the best of them */
+    t->happyCount = 1;
+    for (int slot=0;slot<PRICING_WEEK_SLOTS;slot++) {
+        int row[CATEGORY_COUNT] = {0};
+        for (int k=0;k<rules->happyCount;k++) {
+            const PricingHappyRule *h = &rules->happy[k];
+            if (!happyRuleCovers(h, slot)) continue;
+            for (int c=0;c<CATEGORY_COUNT;c++) {
+                if ((h->category == 0 || h->category == c + STARTER) && h->rateBp > row[c]) row[c] = h->rateBp;
+            }
+        }
+        int r = 0;
+        while (r < t->happyCount && memcmp(t->happyBp[r], row, sizeof(row)) != 0) r++;
+        if (r == t->happyCount) {
+            if (r == PRICING_MAX_HAPPY) return -1;
+            memcpy(t->happyBp[t->happyCount++], row, sizeof(row));
+        }
+        t->happySlot[slot] = (uint8_t)r;
+    }
+
+    if (rules->comboCount > 0) {
+        t->combos = malloc(sizeof(PricingCombo) * (size_t)rules->comboCount);
+        if (!t->combos) return -1;
+        memcpy(t->combos, rules->combos, sizeof(PricingCombo) * (size_t)rules->comboCount);
+        t->comboCount = rules->comboCount;
+    }
+    if (rules->couponCount > 0) {
+        t->coupons = malloc(sizeof(PricingCoupon) * (size_t)rules->couponCount);
+        if (!t->coupons) return -1;
+        memcpy(t->coupons, rules->coupons, sizeof(PricingCoupon) * (size_t)rules->couponCount);
+        qsort(t->coupons, (size_t)rules->couponCount, sizeof(PricingCoupon), compareCoupons);
+        t->couponCount = rules->couponCount;
+    }
+    return 0;
+}
+
+Bill calculateBillWithCoupon(int orderIdx, const PricingCoupon *coupon) {
+    METRIC_SCOPE(METRIC_CALCULATE_BILL);
+    Bill b;
+    memset(&b, 0, sizeof(b));
+    if (orderIdx < 0 || orderIdx >= orderCount) return b;
+    Order *o = orderAt(orderIdx);
+    /* the running totals are kept by every line change, so only combos make a bill preview read the lines */
+    pthread_mutex_lock(orderLock(orderIdx));
+    CHECK_ORDER_TOTALS(o);
+    b = priceOrder(pricing, o, coupon);
+    pthread_mutex_unlock(orderLock(orderIdx));
+    return b;
+}
+
+Bill calculateBill(int orderIdx) {
+    return calculateBillWithCoupon(orderIdx, NULL);
+}
+
+
+static int reserveBillingColumns(BillingColumns *cols, int orders, int lines) {
+    if (orders > cols->orderCapacity) {
+        int *ls = realloc(cols->lineStart, sizeof(int) * (size_t)(orders + 1));
+        if (ls) cols->lineStart = ls;
+        uint8_t *di = realloc(cols->dineIn, (size_t)orders);
+        if (di) cols->dineIn = di;
+        Money *st = realloc(cols->subtotal, sizeof(Money) * (size_t)orders);
+        if (st) cols->subtotal = st;
+        Money *fs = realloc(cols->foodSubtotal, sizeof(Money) * (size_t)orders);
+        if (fs) cols->foodSubtotal = fs;
+        if (!ls || !di || !st || !fs) return -1;
+        cols->orderCapacity = orders;
+    }
+    if (lines > cols->lineCapacity) {
+        Money *pr = realloc(cols->price, sizeof(Money) * (size_t)lines);
+        if (pr) cols->price = pr;
+        int32_t *q = realloc(cols->qty, sizeof(int32_t) * (size_t)lines);
+        if (q) cols->qty = q;
+        uint8_t *cm = realloc(cols->categoryMask, (size_t)lines);
+        if (cm) cols->categoryMask = cm;
+        Money *la = realloc(cols->lineAmount, sizeof(Money) * (size_t)lines);
+        if (la) cols->lineAmount = la;
+        Money *fa = realloc(cols->foodAmount, sizeof(Money) * (size_t)lines);
+        if (fa) cols->foodAmount = fa;
+        if (!pr || !q || !cm || !la || !fa) return -1;
+        cols->lineCapacity = lines;
+    }
+    return 0;
+}
+
+/* Flattens the given orders into per-line columns so the bill maths can run as straight loops. */
+int buildBillingColumns(BillingColumns *cols, const int *orderIdxs, int n) {
+    int lines = 0;
+    for (int k=0;k<n;k++) {
+        if (orderIdxs[k] < 0 || orderIdxs[k] >= orderCount) return -1;
+        lines += orderAt(orderIdxs[k])->itemCount;
+    }
+    if (reserveBillingColumns(cols, n, lines) != 0) return -1;
+    int pos = 0;
+    for (int k=0;k<n;k++) {
+        Order *o = orderAt(orderIdxs[k]);
+        cols->lineStart[k] = pos;
+        cols->dineIn[k] = (uint8_t)o->dineIn;
+        for (int i=0;i<o->itemCount;i++) {
+            cols->price[pos] = o->items[i].unitPrice;
+            cols->qty[pos] = o->items[i].qty;
+            cols->categoryMask[pos] = (uint8_t)CATEGORY_BIT(o->items[i].category);
+            pos++;
+        }
+    }
+    cols->lineStart[n] = pos;
+    cols->orderCount = n;
+    cols->lineCount = pos;
+    return 0;
+}
+
+/* The built-in pricing only; under a --pricing file bills come from calculateBill, one order at a time. */
+void computeBillsBatch(BillingColumns *cols, Bill *out) {
+    const Money *price = cols->price;
+    const int32_t *qty = cols->qty;
+    const uint8_t *mask = cols->categoryMask;
+    Money *lineAmount = cols->lineAmount;
+    Money *foodAmount = cols->foodAmount;
+    for (int i=0;i<cols->lineCount;i++) {
+        Money line = price[i] * qty[i];
+        lineAmount[i] = line;
+        foodAmount[i] = line & -(Money)((mask[i] & FOOD_CATEGORY_MASK) != 0);
+    }
+    for (int k=0;k<cols->orderCount;k++) {
+        Money sub = 0, food = 0;
+        for (int i=cols->lineStart[k];i<cols->lineStart[k+1];i++) {
+            sub += lineAmount[i];
+            food += foodAmount[i];
+        }
+        cols->subtotal[k] = sub;
+        cols->foodSubtotal[k] = food;
+    }
+    /* amounts are non-negative here, so half-up rounding needs no sign branch */
+    for (int k=0;k<cols->orderCount;k++) {
+        Money sub = cols->subtotal[k];
+        Money gst = (cols->foodSubtotal[k] * GST_RATE_FOOD_BP + RATE_BP_SCALE/2) / RATE_BP_SCALE;
+        Money svc = ((sub * SERVICE_RATE_BP + RATE_BP_SCALE/2) / RATE_BP_SCALE) & -(Money)cols->dineIn[k];
+        Money temp = sub + gst + svc;
+        Money rate = DISCOUNT_TIER1_RATE_BP * (Money)(temp > DISCOUNT_TIER1_THRESHOLD)
+                   + (DISCOUNT_TIER2_RATE_BP - DISCOUNT_TIER1_RATE_BP) * (Money)(temp > DISCOUNT_TIER2_THRESHOLD);
+        Money disc = (temp * rate + RATE_BP_SCALE/2) / RATE_BP_SCALE;
+        memset(&out[k], 0, sizeof(Bill));
+        out[k].discountBp = (int)rate;
+        out[k].subtotal = sub;
+        out[k].gst = gst;
+        out[k].serviceCharge = svc;
+        out[k].discount = disc;
+        out[k].total = temp - disc;
+    }
+}
+
+void freeBillingColumns(BillingColumns *cols) {
+    free(cols->price);
+    free(cols->qty);
+    free(cols->categoryMask);
+    free(cols->lineAmount);
+    free(cols->foodAmount);
+    free(cols->lineStart);
+    free(cols->dineIn);
+    free(cols->subtotal);
+    free(cols->foodSubtotal);
+    memset(cols, 0, sizeof(*cols));
+}
+
+
+static void putBytes(ByteWriter *w, const char *p, int n) {
+    if (n > w->cap - w->len) n = w->cap - w->len;
+    memcpy(w->buf + w->len, p, (size_t)n);
+    w->len += n;
+}
+
+static void putStr(ByteWriter *w, const char *p) {
+    putBytes(w, p, (int)strlen(p));
+}
+
+static void putPadding(ByteWriter *w, int n) {
+    static const char spaces[] = "                                ";
+    while (n > 0) {
+        int k = n < (int)sizeof(spaces) - 1 ? n : (int)sizeof(spaces) - 1;
+        putBytes(w, spaces, k);
+        n -= k;
+    }
+}
+
+/* width > 0 right-aligns like %Ns, width < 0 left-aligns like %-Ns */
+static void putField(ByteWriter *w, const char *p, int n, int width) {
+    if (width > n) putPadding(w, width - n);
+    putBytes(w, p, n);
+    if (-width > n) putPadding(w, -width - n);
+}
+
+static void putIntField(ByteWriter *w, int v, int width) {
+    char tmp[16];
+    int n = 0, neg = v < 0;
+    unsigned a = neg ? 0u - (unsigned)v : (unsigned)v;
+    char digits[16];
+    do { digits[n++] = (char)('0' + a % 10); a /= 10; } while (a);
+    int len = 0;
+    if (neg) tmp[len++] = '-';
+    while (n) tmp[len++] = digits[--n];
+    putField(w, tmp, len, width);
+}
+
+static void putMoneyField(ByteWriter *w, Money m, int width) {
+    char tmp[MONEY_STR_LEN];
+    putField(w, tmp, moneyToChars(m, tmp), width);
+}
+
+static void putReceiptHead(ByteWriter *w, const char *title, int orderId, int dineIn, int tableNumber, time_t openedAt) {
+    static _Thread_local time_t whenAt = -1;
+    static _Thread_local char when[32];
+    static _Thread_local int whenLen = 0;
+    if (openedAt != whenAt) {
+        struct tm tmv;
+        localtime_r(&openedAt, &tmv);
+        whenLen = (int)strftime(when, sizeof(when), "%a %b %e %H:%M:%S %Y", &tmv);
+        whenAt = openedAt;
+    }
+    putStr(w, "========================================\n");
+    putStr(w, title);
+    putStr(w, "KOT: "); putIntField(w, orderId, 0); putStr(w, "\n");
+    putStr(w, dineIn ? "Type: Dine-In\n" : "Type: Takeaway\n");
+    if (dineIn) { putStr(w, "Table: "); putIntField(w, tableNumber, 0); putStr(w, "\n"); }
+    putStr(w, "Date/Time: "); putBytes(w, when, whenLen); putStr(w, "\n");
+    putStr(w, "----------------------------------------\n");
+}
+
+static void putReceiptColumns(ByteWriter *w) {
+    putStr(w, "Code   Item                      Qty    Amount  \n");
+    putStr(w, "----------------------------------------\n");
+}
+
+static void putReceiptLine(ByteWriter *w, const char *code, int codeLen, const char *name, int nameLen, int qty, Money amount) {
+    putField(w, code, codeLen, -6);
+    putStr(w, " ");
+    putField(w, name, nameLen, -25);
+    putStr(w, " ");
+    putIntField(w, qty, -6);
+    putStr(w, " ");
+    putMoneyField(w, amount, -8);
+    putStr(w, "\n");
+}
+
+static void putSlipAmount(ByteWriter *w, const char *label, Money m) {
+    putField(w, label, (int)strlen(label), -17); putMoneyField(w, m, 8); putStr(w, "\n");
+}
+
+static void putReceiptTotals(ByteWriter *w, const Bill *b, const char *taxLabel, int taxLabelLen) {
+    putStr(w, "----------------------------------------\n");
+    putStr(w, "Subtotal:        "); putMoneyField(w, b->subtotal, 8); putStr(w, "\n");
+    if (b->happyHour) { putStr(w, "Happy hour:      "); putMoneyField(w, b->happyHour, 8); putStr(w, "\n"); }
+    putField(w, taxLabel, taxLabelLen, -17); putMoneyField(w, b->gst, 8); putStr(w, "\n");
+    putStr(w, "Service:         "); putMoneyField(w, b->serviceCharge, 8); putStr(w, "\n");
+    int amountWidth = 8;
+    if (b->discountBp > 0) {
+        char pct[16], label[32];
+        formatPercent(pct, sizeof(pct), b->discountBp);
+        int n = snprintf(label, sizeof(label), "Discount (%s):", pct);
+        putField(w, label, n, -17);
+        if (n > 17) amountWidth -= n - 17;   /* "Discount (12.50%):" runs one column into the amount */
+    } else {
+        putStr(w, "Discount:        ");
+    }
+    putMoneyField(w, b->discount, amountWidth); putStr(w, "\n");
+    if (b->combo) { putStr(w, "Combos:          "); putMoneyField(w, b->combo, 8); putStr(w, "\n"); }
+    if (b->coupon) {
+        char label[COUPON_LEN + 16];
+        int n = snprintf(label, sizeof(label), "Coupon %.*s:", COUPON_LEN - 1, b->couponCode);
+        putField(w, label, n, -17); putMoneyField(w, b->coupon, 8); putStr(w, "\n");
+    }
+    putStr(w, "TOTAL:           "); putMoneyField(w, b->total, 8); putStr(w, "\n");
+    putStr(w, "========================================\n");
+}
+
+/* The one receipt layout, shared by the screen, the receipt files, the printer spool and archive reprints. */
+int renderReceipt(char *buf, int cap, const Order *o, Bill b) {
+    ByteWriter w = { buf, 0, cap };
+    putReceiptHead(&w, RECEIPT_TITLE, o->orderId, o->dineIn, o->tableNumber, o->timestamp);
+    putReceiptColumns(&w);
+    const MenuCatalog *menu = menuPin();
+    for (int i=0;i<o->itemCount;i++) {
+        const char *code = menuCodes[o->items[i].menuIdx];
+        const char *name = menuItemName(menu, o->items[i].menuIdx);
+        putReceiptLine(&w, code, (int)strlen(code), name, (int)strlen(name), o->items[i].qty, lineAmount(&o->items[i]));
+    }
+    menuUnpin();
+    putReceiptTotals(&w, &b, pricing->taxLabel, (int)strlen(pricing->taxLabel));
+    return w.len;
+}
+
+int addReceiptSink(ReceiptSinkFn emit, void *ctx) {
+    if (receiptSinkCount >= MAX_RECEIPT_SINKS) return -1;
+    receiptSinks[receiptSinkCount].emit = emit;
+    receiptSinks[receiptSinkCount].ctx = ctx;
+    receiptSinkCount++;
+    return 0;
+}
+
+static void enqueueReceiptRecord(const Order *o, const Bill *b);
+
+static void emitReceipt(int orderId, const char *data, int len) {
+    for (int i=0;i<receiptSinkCount;i++) receiptSinks[i].emit(orderId, data, len, receiptSinks[i].ctx);
+}
+
+void printBill(FILE *out, int orderIdx) {
+    printBillWithCoupon(out, orderIdx, NULL);
+}
+
+void printBillWithCoupon(FILE *out, int orderIdx, const PricingCoupon *coupon) {
+    METRIC_SCOPE(METRIC_PRINT_BILL);
+    static _Thread_local char receipt[RECEIPT_BUF_LEN];
+    if (orderIdx < 0 || orderIdx >= orderCount) {
+        fprintf(out, "Invalid order index.\n");
+        return;
+    }
+    Order *o = orderAt(orderIdx);
+    pthread_mutex_lock(orderLock(orderIdx));
+    if (!o->active) {
+        pthread_mutex_unlock(orderLock(orderIdx));
+        fprintf(out, "Order already billed/closed.\n");
+        return;
+    }
+    Money paid = orderColdAt(orderIdx)->paid;
+    if (paid > 0 && coupon) {
+        pthread_mutex_unlock(orderLock(orderIdx));
+        fprintf(out, "Coupons cannot be applied after part payments.\n");
+        return;
+    }
+    Bill b = calculateBillWithCoupon(orderIdx, coupon);
+    int len = renderReceipt(receipt, sizeof(receipt), o, b);
+
+    fputc('\n', out);
+    fwrite(receipt, 1, (size_t)len, out);
+    emitReceipt(o->orderId, receipt, len);
+    if (receiptMode == RECEIPTS_ARCHIVE) enqueueReceiptRecord(o, &b);
+    salesRecordOrder(o);
+    if (receiptMode == RECEIPTS_SEGMENT) fprintf(out, "Receipt appended to receipts segment.\n");
+    else if (receiptMode == RECEIPTS_ARCHIVE) fprintf(out, "Receipt archived for KOT %d.\n", o->orderId);
+    else fprintf(out, "Receipt saved to: receipt_%d.txt\n", o->orderId);
+    if (paid > 0) {
+        char amt[2][MONEY_STR_LEN];
+        Money rest = b.total - paid;
+        fprintf(out, "Part payments: %s, %s: %s\n", formatMoney(paid, amt[0]),
+                rest >= 0 ? "balance collected" : "refunded", formatMoney(rest >= 0 ? rest : -rest, amt[1]));
+    }
+
+    closeOrder(orderIdx);
+    pthread_mutex_unlock(orderLock(orderIdx));
+}
+
+/*
+ * Takes one part payment towards an open order: the lines in lines, one of ways equal shares of the
+ * balance left when the split began, or otherwise amount. Sub-bills are priced from the order itself (priceLines on the chosen
+ * lines), so nothing is copied; the payment is added to the order and prints a slip, and the payment
+ * that settles the balance bills and closes the order, freeing its tables. Returns 0 with the amount
+ * taken and the balance left, -1 for a bad or empty request and -4 when a line is already paid for.
+ */
+int payOrder(FILE *out, int orderIdx, uint64_t lines, int ways, Money amount, Money *taken, Money *balance) {
+    static _Thread_local char slip[RECEIPT_BUF_LEN];
+    if (orderIdx < 0 || orderIdx >= orderCount) return -1;
+    Order *o = orderAt(orderIdx);
+    OrderCold *c = orderColdAt(orderIdx);
+    pthread_mutex_lock(orderLock(orderIdx));
+    uint64_t all = o->itemCount == 64 ? ~0ull : (1ull << o->itemCount) - 1;
+    if (!o->active || o->itemCount == 0 || (lines & ~all) || ways < 0 || ways > MAX_SHARE_WAYS || (!lines && !ways && amount <= 0)) {
+        pthread_mutex_unlock(orderLock(orderIdx));
+        return -1;
+    }
+    if (lines & c->paidLines) {
+        pthread_mutex_unlock(orderLock(orderIdx));
+        return -4;
+    }
+    CHECK_ORDER_TOTALS(o);
+    Bill whole = priceOrder(pricing, o, NULL), part;
+    Money due = whole.total - c->paid, change = 0;
+    if (due <= 0) {
+        pthread_mutex_unlock(orderLock(orderIdx));
+        return -1;
+    }
+    if (lines) {
+        part = priceLines(pricing, o, &whole, lines);
+        /* the payment that leaves no line unpaid takes the exact balance, rounding and all */
+        amount = (lines | c->paidLines) == all || part.total > due ? due : part.total;
+    } else if (ways) {
+        /* each share divides what is still due among the shares still to come, so the last one settles it */
+        int left = orderTakeShare(c, ways);
+        amount = due / left + (due % left != 0);
+    } else if (amount > due) {
+        change = amount - due;
+        amount = due;
+    }
+    c->paid += amount;
+    c->paidLines |= lines;
+    journalAppendPayment(o, amount, lines, ways);
+
+    ByteWriter w = { slip, 0, sizeof(slip) };
+    putReceiptHead(&w, PAYMENT_TITLE, o->orderId, o->dineIn, o->tableNumber, o->timestamp);
+    if (lines) {
+        putReceiptColumns(&w);
+        const MenuCatalog *menu = menuPin();
+        for (uint64_t m=lines;m;m&=m-1) {
+            const OrderItem *line = &o->items[__builtin_ctzll(m)];
+            const char *code = menuCodes[line->menuIdx];
+            const char *name = menuItemName(menu, line->menuIdx);
+            putReceiptLine(&w, code, (int)strlen(code), name, (int)strlen(name), line->qty, lineAmount(line));
+        }
+        menuUnpin();
+        putReceiptTotals(&w, &part, pricing->taxLabel, (int)strlen(pricing->taxLabel));
+    } else {
+        if (ways) {
+            putStr(&w, "Share:           "); putIntField(&w, c->sharesPaid, 0);
+            putStr(&w, " of "); putIntField(&w, ways, 0); putStr(&w, "\n");
+        }
+        putSlipAmount(&w, "Bill total:", whole.total);
+        putStr(&w, "----------------------------------------\n");
+    }
+    putSlipAmount(&w, "Paid now:", amount);
+    if (change) putSlipAmount(&w, "Change:", change);
+    putSlipAmount(&w, "Paid so far:", c->paid);
+    putSlipAmount(&w, "Balance due:", due - amount);
+    putStr(&w, "========================================\n");
+    fputc('\n', out);
+    fwrite(slip, 1, (size_t)w.len, out);
+
+    *taken = amount;
+    *balance = due - amount;
+    if (*balance == 0) printBillWithCoupon(out, orderIdx, NULL);
+    pthread_mutex_unlock(orderLock(orderIdx));
+    return 0;
+}
+
+
+void printOrderDetails(FILE *out, int orderIdx) {
+    if (orderIdx < 0 || orderIdx >= orderCount) return;
+    Order *o = orderAt(orderIdx);
+    pthread_mutex_lock(orderLock(orderIdx));
+    fprintf(out, "\nOrder KOT: %d | Type: %s | Table: %d | Items: %d\n",
+            o->orderId, o->dineIn ? "Dine-In" : "Takeaway", o->tableNumber, o->itemCount);
+    if (o->itemCount == 0) {
+        pthread_mutex_unlock(orderLock(orderIdx));
+        fprintf(out, "No items.\n");
+        return;
+    }
+    char amt[5][MONEY_STR_LEN];
+    fprintf(out, "%-6s %-25s %-6s %-8s\n","Code","Item","Qty","Amount");
+    const MenuCatalog *menu = menuPin();
+    uint64_t paidLines = orderColdAt(orderIdx)->paidLines;
+    for (int i=0;i<o->itemCount;i++) {
+        int m = o->items[i].menuIdx;
+        fprintf(out, "%-6s %-25s %-6d %-8s%s\n", menuCodes[m], menuItemName(menu, m), o->items[i].qty,
+                formatMoney(lineAmount(&o->items[i]), amt[0]), paidLines >> i & 1 ? " paid" : "");
+    }
+    menuUnpin();
+    Bill b = calculateBill(orderIdx);
+    Money paid = orderColdAt(orderIdx)->paid;
+    pthread_mutex_unlock(orderLock(orderIdx));
+    fprintf(out, "Subtotal: %s | GST: %s | Service: %s | Discount: %s | Total: %s\n",
+            formatMoney(b.subtotal, amt[0]), formatMoney(b.gst, amt[1]), formatMoney(b.serviceCharge, amt[2]),
+            formatMoney(b.discount, amt[3]), formatMoney(b.total, amt[4]));
+    if (paid > 0) fprintf(out, "Paid so far: %s | Balance due: %s\n", formatMoney(paid, amt[0]), formatMoney(b.total - paid, amt[1]));
+}
+
+
+/* Bounded MPMC ring (sequence-numbered cells); producers render straight into the claimed cell. */
+static ReceiptSlot* receiptClaim(size_t *ticket) {
+    size_t pos = atomic_load_explicit(&receiptEnqueuePos, memory_order_relaxed);
+    while (1) {
+        ReceiptSlot *slot = &receiptQueue[pos & (RECEIPT_QUEUE_SIZE-1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&receiptEnqueuePos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *ticket = pos;
+                return slot;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&receiptEnqueuePos, memory_order_relaxed);
+        }
+    }
+}
+
+static void receiptPublish(ReceiptSlot *slot, size_t ticket) {
+    atomic_store_explicit(&slot->seq, ticket + 1, memory_order_release);
+}
+
+static ReceiptSlot* receiptPeek(size_t pos) {
+    ReceiptSlot *slot = &receiptQueue[pos & (RECEIPT_QUEUE_SIZE-1)];
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1) return NULL;
+    return slot;
+}
+
+static void receiptRelease(ReceiptSlot *slot, size_t pos) {
+    atomic_store_explicit(&slot->seq, pos + RECEIPT_QUEUE_SIZE, memory_order_release);
+}
+
+static int openReceiptSegment(void) {
+    char fname[RECEIPT_FILENAME_LEN];
+    struct stat st;
+    if (receiptSegmentFd != -1) close(receiptSegmentFd);
+    while (1) {
+        receiptSegmentNo++;
+        snprintf(fname, sizeof(fname), "receipts_%04d.seg", receiptSegmentNo);
+        if (stat(fname, &st) != 0 || st.st_size < RECEIPT_SEGMENT_BYTES) break;
+    }
+    receiptSegmentFd = open(fname, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    receiptSegmentBytes = (receiptSegmentFd != -1 && fstat(receiptSegmentFd, &st) == 0) ? (long)st.st_size : 0;
+    return receiptSegmentFd == -1 ? -1 : 0;
+}
+
+static void writeReceiptFile(const ReceiptSlot *slot) {
+    char fname[RECEIPT_FILENAME_LEN];
+    snprintf(fname, sizeof(fname), "receipt_%d.txt", slot->orderId);
+    int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || writeFully(fd, slot->data, (size_t)slot->length) != 0) {
+        fprintf(stderr, "Failed to write receipt %s.\n", fname);
+    }
+    if (fd != -1) close(fd);
+}
+
+/* Spool files appear via rename so the print spooler never picks up a half-written job. */
+static void writeSpoolFile(const ReceiptSlot *slot) {
+    char tmp[SPOOL_DIR_LEN + RECEIPT_FILENAME_LEN], fname[SPOOL_DIR_LEN + RECEIPT_FILENAME_LEN];
+    snprintf(tmp, sizeof(tmp), "%s/.receipt_%d.tmp", spoolDir, slot->orderId);
+    snprintf(fname, sizeof(fname), "%s/receipt_%d.prn", spoolDir, slot->orderId);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int ok = fd != -1 && writeFully(fd, slot->data, (size_t)slot->length) == 0;
+    if (fd != -1) close(fd);
+    if (!ok || rename(tmp, fname) != 0) fprintf(stderr, "Failed to spool receipt %d.\n", slot->orderId);
+}
+
+static void writeReceiptSlots(ReceiptSlot **slots, int n);
+
+static void writeReceiptSegment(ReceiptSlot **slots, int n) {
+    struct iovec iov[RECEIPT_WRITE_BATCH];
+    long bytes = 0;
+    for (int i=0;i<n;i++) {
+        iov[i].iov_base = slots[i]->data;
+        iov[i].iov_len = (size_t)slots[i]->length;
+        bytes += slots[i]->length;
+    }
+    if ((receiptSegmentFd == -1 || receiptSegmentBytes + bytes > RECEIPT_SEGMENT_BYTES) && openReceiptSegment() != 0) {
+        fprintf(stderr, "Failed to open receipt segment.\n");
+        return;
+    }
+    ssize_t w = writev(receiptSegmentFd, iov, n);
+    if (w != bytes) fprintf(stderr, "Short write to receipt segment.\n");
+    if (w > 0) receiptSegmentBytes += (long)w;
+}
+
+static void closeArchiveDay(void) {
+    if (archiveRecordFd != -1) close(archiveRecordFd);
+    if (archiveDictFd != -1) close(archiveDictFd);
+    if (archiveIndex) munmap((ReceiptIndexHeader*)archiveIndex - 1, sizeof(ReceiptIndexHeader) + sizeof(ReceiptIndexSlot) * RECEIPT_INDEX_SLOTS);
+    archiveRecordFd = archiveDictFd = -1;
+    archiveIndex = NULL;
+    archiveDay[0] = '\0';
+}
+
+/* Opens (or reopens after a restart) one day's segment, dictionary and index. */
+static int openArchiveDay(const char *day) {
+    char fname[RECEIPT_FILENAME_LEN];
+    struct stat st;
+    closeArchiveDay();
+    memset(archiveDictIds, 0, sizeof(archiveDictIds));
+    archiveDictCount = 0;
+    archiveLabelId = -1;
+    snprintf(fname, sizeof(fname), "receipts_%s.rcp", day);
+    archiveRecordFd = open(fname, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (archiveRecordFd == -1 || fstat(archiveRecordFd, &st) != 0) return -1;
+    archiveRecordBytes = (uint64_t)st.st_size;
+
+    /* reload the ids already handed out today; a torn last entry is cut off */
+    snprintf(fname, sizeof(fname), "receipts_%s.dict", day);
+    archiveDictFd = open(fname, O_RDWR | O_CREAT, 0644);
+    if (archiveDictFd == -1 || fstat(archiveDictFd, &st) != 0) return -1;
+    char *dict = st.st_size > 0 ? malloc((size_t)st.st_size) : NULL;
+    off_t valid = 0;
+    if (dict && pread(archiveDictFd, dict, (size_t)st.st_size, 0) == st.st_size) {
+        while (valid + (off_t)sizeof(ReceiptDictEntry) <= st.st_size) {
+            ReceiptDictEntry e;
+            memcpy(&e, dict + valid, sizeof(e));
+            if (e.id != archiveDictCount || valid + (off_t)sizeof(e) + e.len > st.st_size) break;
+            const char *text = dict + valid + sizeof(e);
+            const char *bar = memchr(text, '|', e.len);
+            if (bar && bar - text < CODE_LEN) {
+                char code[CODE_LEN];
+                memcpy(code, text, (size_t)(bar - text));
+                code[bar - text] = '\0';
+                int midx = internMenuCode(code);
+                if (midx != -1) archiveDictIds[midx] = e.id + 1;
+            } else if (!bar && e.len < TAX_LABEL_LEN) {
+                memcpy(archiveLabel, text, e.len);
+                archiveLabel[e.len] = '\0';
+                archiveLabelId = e.id;
+            }
+            archiveDictCount++;
+            valid += (off_t)sizeof(e) + e.len;
+        }
+    }
+    free(dict);
+    if (valid != st.st_size && ftruncate(archiveDictFd, valid) != 0) return -1;
+    if (lseek(archiveDictFd, 0, SEEK_END) == -1) return -1;
+
+    snprintf(fname, sizeof(fname), "receipts_%s.idx", day);
+    size_t indexLen = sizeof(ReceiptIndexHeader) + sizeof(ReceiptIndexSlot) * RECEIPT_INDEX_SLOTS;
+    int fd = open(fname, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) return -1;
+    int fresh = fstat(fd, &st) == 0 && st.st_size == 0;
+    if ((fresh && ftruncate(fd, (off_t)indexLen) != 0) || (!fresh && st.st_size != (off_t)indexLen)) { close(fd); return -1; }
+    void *map = mmap(NULL, indexLen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    ReceiptIndexHeader *h = map;
+    if (fresh) { h->magic = RECEIPT_INDEX_MAGIC; h->slots = RECEIPT_INDEX_SLOTS; }
+    if (h->magic != RECEIPT_INDEX_MAGIC || h->slots != RECEIPT_INDEX_SLOTS) { munmap(map, indexLen); return -1; }
+    archiveIndex = (ReceiptIndexSlot*)(h + 1);
+    archiveIndexUsed = 0;
+    for (int i=0;i<RECEIPT_INDEX_SLOTS;i++) archiveIndexUsed += archiveIndex[i].orderId != 0;
+    strcpy(archiveDay, day);
+    return 0;
+}
+
+static unsigned receiptIndexHash(int orderId, int bits) {
+    return ((uint32_t)orderId * 2654435761u) >> (32 - bits);
+}
+
+/* A KOT billed twice in one day (counters restart without a journal) keeps its latest receipt. */
+static int indexArchivedReceipt(int orderId, uint64_t offset) {
+    unsigned h = receiptIndexHash(orderId, RECEIPT_INDEX_BITS);
+    for (int probe=0;probe<RECEIPT_INDEX_SLOTS;probe++) {
+        ReceiptIndexSlot *slot = &archiveIndex[(h + (unsigned)probe) & (RECEIPT_INDEX_SLOTS - 1)];
+        if (slot->orderId == 0 && archiveIndexUsed >= RECEIPT_DAY_MAX_BILLS) return -1;
+        if (slot->orderId == 0 || slot->orderId == orderId) {
+            archiveIndexUsed += slot->orderId == 0;
+            slot->offset = (uint32_t)offset;
+            slot->orderId = orderId;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int appendArchiveDict(char *buf, int *len, int cap, const char *text, int textLen) {
+    ReceiptDictEntry e = { (uint16_t)archiveDictCount, (uint16_t)textLen };
+    if (archiveDictCount >= 65535 || *len + (int)sizeof(e) + textLen > cap) return -1;
+    memcpy(buf + *len, &e, sizeof(e));
+    memcpy(buf + *len + sizeof(e), text, (size_t)textLen);
+    *len += (int)sizeof(e) + textLen;
+    return archiveDictCount++;
+}
+
+/*
+ * Queued records carry menu ids, then each line's name and the tax label as NUL-terminated text.
+ * Here the ids become the day's dictionary ids (new entries are written ahead of the records
+ * that use them), the records are appended with one writev and then indexed.
+ */
+static void writeReceiptRecords(ReceiptSlot **slots, int n) {
+    static char dictBuf[RECEIPT_WRITE_BATCH * RECEIPT_BUF_LEN];
+    struct iovec iov[RECEIPT_WRITE_BATCH];
+    int start = 0;
+    while (start < n) {
+        const ReceiptRecord *first = (const ReceiptRecord*)slots[start]->data;
+        char day[RECEIPT_DAY_LEN];
+        struct tm tmv;
+        time_t billedAt = (time_t)first->billedAt;
+        localtime_r(&billedAt, &tmv);
+        strftime(day, sizeof(day), "%Y-%m-%d", &tmv);
+        if (strcmp(day, archiveDay) != 0 && openArchiveDay(day) != 0) {
+            fprintf(stderr, "Failed to open receipt archive for %s.\n", day);
+            closeArchiveDay();
+            return;
+        }
+        int dictLen = 0, count = 0;
+        size_t bytes = 0;
+        for (int i=start;i<n;i++) {
+            ReceiptRecord *r = (ReceiptRecord*)slots[i]->data;
+            billedAt = (time_t)r->billedAt;
+            localtime_r(&billedAt, &tmv);
+            char recordDay[RECEIPT_DAY_LEN];
+            strftime(recordDay, sizeof(recordDay), "%Y-%m-%d", &tmv);
+            if (strcmp(recordDay, archiveDay) != 0) break;
+            ReceiptRecordLine *lines = (ReceiptRecordLine*)(r + 1);
+            const char *text = (const char*)(lines + r->lineCount);
+            for (int j=0;j<r->lineCount;j++) {
+                int midx = lines[j].item;
+                int nameLen = (int)strlen(text);
+                if (archiveDictIds[midx] == 0) {
+                    char entry[CODE_LEN + NAME_LEN + 1];
+                    int len = snprintf(entry, sizeof(entry), "%s|%s", menuCodes[midx], text);
+                    int id = appendArchiveDict(dictBuf, &dictLen, (int)sizeof(dictBuf), entry, len);
+                    archiveDictIds[midx] = id + 1;
+                }
+                lines[j].item = (uint16_t)(archiveDictIds[midx] - 1);
+                text += nameLen + 1;
+            }
+            if (archiveLabelId == -1 || strcmp(text, archiveLabel) != 0) {
+                archiveLabelId = appendArchiveDict(dictBuf, &dictLen, (int)sizeof(dictBuf), text, (int)strlen(text));
+                snprintf(archiveLabel, sizeof(archiveLabel), "%s", text);
+            }
+            r->taxLabel = (uint16_t)archiveLabelId;
+            iov[count].iov_base = r;
+            iov[count].iov_len = sizeof(ReceiptRecord) + sizeof(ReceiptRecordLine) * r->lineCount;
+            bytes += iov[count].iov_len;
+            count++;
+        }
+        start += count;
+        if (dictLen > 0 && writeFully(archiveDictFd, dictBuf, (size_t)dictLen) != 0) fprintf(stderr, "Short write to receipt dictionary.\n");
+        uint64_t offset = archiveRecordBytes;
+        ssize_t w = writev(archiveRecordFd, iov, count);
+        if (w > 0) archiveRecordBytes += (uint64_t)w;
+        if (w != (ssize_t)bytes) {
+            fprintf(stderr, "Short write to receipt archive.\n");
+            continue;
+        }
+        for (int i=0;i<count;i++) {
+            if (offset > UINT32_MAX || indexArchivedReceipt(((ReceiptRecord*)iov[i].iov_base)->orderId, offset) != 0) {
+                fprintf(stderr, "Receipt index for %s is full.\n", archiveDay);
+                break;
+            }
+            offset += iov[i].iov_len;
+        }
+    }
+}
+
+static void writeReceiptSlots(ReceiptSlot **slots, int n) {
+    ReceiptSlot *archive[RECEIPT_WRITE_BATCH], *records[RECEIPT_WRITE_BATCH];
+    int archived = 0, recorded = 0;
+    for (int i=0;i<n;i++) {
+        if (slots[i]->target == RECEIPT_TARGET_SPOOL) writeSpoolFile(slots[i]);
+        else if (slots[i]->target == RECEIPT_TARGET_RECORD) records[recorded++] = slots[i];
+        else if (receiptMode == RECEIPTS_SEGMENT) archive[archived++] = slots[i];
+        else writeReceiptFile(slots[i]);
+    }
+    if (archived > 0) writeReceiptSegment(archive, archived);
+    if (recorded > 0) writeReceiptRecords(records, recorded);
+}
+
+static void* receiptWriterMain(void *arg) {
+    (void)arg;
+    struct timespec idle = { 0, RECEIPT_IDLE_SLEEP_NS };
+    while (1) {
+        size_t pos = atomic_load_explicit(&receiptDequeuePos, memory_order_relaxed);
+        ReceiptSlot *batch[RECEIPT_WRITE_BATCH];
+        int n = 0;
+        while (n < RECEIPT_WRITE_BATCH && (batch[n] = receiptPeek(pos + (size_t)n)) != NULL) n++;
+        if (n == 0) {
+            if (atomic_load(&receiptWriterStopping)) break;
+            nanosleep(&idle, NULL);
+            continue;
+        }
+        writeReceiptSlots(batch, n);
+        for (int i=0;i<n;i++) receiptRelease(batch[i], pos + (size_t)i);
+        atomic_store_explicit(&receiptDequeuePos, pos + (size_t)n, memory_order_relaxed);
+    }
+    return NULL;
+}
+
+int receiptWriterStart(ReceiptMode mode) {
+    receiptMode = mode;
+    for (size_t i=0;i<RECEIPT_QUEUE_SIZE;i++) atomic_store(&receiptQueue[i].seq, i);
+    atomic_store(&receiptEnqueuePos, 0);
+    atomic_store(&receiptDequeuePos, 0);
+    atomic_store(&receiptWriterStopping, 0);
+    if (pthread_create(&receiptWriterThread, NULL, receiptWriterMain, NULL) != 0) return -1;
+    receiptWriterRunning = 1;
+    return 0;
+}
+
+/* Drains everything already queued, then joins the writer. */
+void receiptWriterStop(void) {
+    if (!receiptWriterRunning) return;
+    atomic_store(&receiptWriterStopping, 1);
+    pthread_join(receiptWriterThread, NULL);
+    receiptWriterRunning = 0;
+    if (receiptSegmentFd != -1) {
+        close(receiptSegmentFd);
+        receiptSegmentFd = -1;
+    }
+    closeArchiveDay();
+}
+
+
+/* Without the writer thread a receipt is written inline from a thread-local slot. */
+static ReceiptSlot* beginReceipt(ReceiptTarget target, int orderId, size_t *ticket) {
+    static _Thread_local ReceiptSlot local;
+    ReceiptSlot *slot = &local;
+    if (receiptWriterRunning) {
+        struct timespec backoff = { 0, 50000L };
+        while ((slot = receiptClaim(ticket)) == NULL) nanosleep(&backoff, NULL);
+    }
+    slot->target = target;
+    slot->orderId = orderId;
+    return slot;
+}
+
+static void finishReceipt(ReceiptSlot *slot, size_t ticket) {
+    if (receiptWriterRunning) receiptPublish(slot, ticket);
+    else writeReceiptSlots(&slot, 1);
+}
+
+static void enqueueReceipt(ReceiptTarget target, int orderId, const char *data, int len) {
+    size_t ticket = 0;
+    ReceiptSlot *slot = beginReceipt(target, orderId, &ticket);
+    if (len > RECEIPT_BUF_LEN) len = RECEIPT_BUF_LEN;
+    slot->length = len;
+    memcpy(slot->data, data, (size_t)len);
+    finishReceipt(slot, ticket);
+}
+
+/* Archive mode keeps the bill as a record rather than its text; the caller holds the order lock. */
+static void enqueueReceiptRecord(const Order *o, const Bill *b) {
+    size_t ticket = 0;
+    ReceiptSlot *slot = beginReceipt(RECEIPT_TARGET_RECORD, o->orderId, &ticket);
+    ReceiptRecord *r = (ReceiptRecord*)slot->data;
+    memset(r, 0, sizeof(*r));
+    r->magic = RECEIPT_RECORD_MAGIC;
+    r->orderId = o->orderId;
+    r->tableNumber = o->tableNumber;
+    r->dineIn = o->dineIn;
+    r->lineCount = o->itemCount;
+    r->discountBp = (int16_t)b->discountBp;
+    r->openedAt = o->timestamp;
+    r->billedAt = time(NULL);
+    r->subtotal = b->subtotal;
+    r->gst = b->gst;
+    r->serviceCharge = b->serviceCharge;
+    r->discount = b->discount;
+    r->total = b->total;
+    r->happyHour = b->happyHour;
+    r->combo = b->combo;
+    r->coupon = b->coupon;
+    memcpy(r->couponCode, b->couponCode, COUPON_LEN);
+    ReceiptRecordLine *lines = (ReceiptRecordLine*)(r + 1);
+    char *text = (char*)(lines + o->itemCount);
+    const MenuCatalog *menu = menuPin();
+    for (int i=0;i<o->itemCount;i++) {
+        ReceiptRecordLine l = { o->items[i].menuIdx, o->items[i].qty, o->items[i].unitPrice };
+        lines[i] = l;
+        const char *name = menuItemName(menu, o->items[i].menuIdx);
+        size_t len = strlen(name) + 1;
+        memcpy(text, name, len);
+        text += len;
+    }
+    menuUnpin();
+    size_t labelLen = strlen(pricing->taxLabel) + 1;
+    memcpy(text, pricing->taxLabel, labelLen);
+    slot->length = (int)(text + labelLen - slot->data);
+    finishReceipt(slot, ticket);
+}
+
+void archiveReceiptSink(int orderId, const char *data, int len, void *ctx) {
+    (void)ctx;
+    enqueueReceipt(RECEIPT_TARGET_ARCHIVE, orderId, data, len);
+}
+
+void spoolReceiptSink(int orderId, const char *data, int len, void *ctx) {
+    (void)ctx;
+    enqueueReceipt(RECEIPT_TARGET_SPOOL, orderId, data, len);
+}
+
+void saveReceiptToFile(int orderIdx, Bill b) {
+    METRIC_SCOPE(METRIC_SAVE_RECEIPT);
+    static _Thread_local char receipt[RECEIPT_BUF_LEN];
+    if (orderIdx < 0 || orderIdx >= orderCount) return;
+    Order *o = orderAt(orderIdx);
+    pthread_mutex_lock(orderLock(orderIdx));
+    emitReceipt(o->orderId, receipt, renderReceipt(receipt, sizeof(receipt), o, b));
+    if (receiptMode == RECEIPTS_ARCHIVE) enqueueReceiptRecord(o, &b);
+    pthread_mutex_unlock(orderLock(orderIdx));
+}
+
+
+/* Renders one KOT from one day's archive; returns 1 if that day has no receipt for it, -1 if the files are damaged. */
+static int reprintFromDay(const char *dir, const char *day, int orderId, FILE *out) {
+    char fname[RECEIPT_PATH_LEN];
+    snprintf(fname, sizeof(fname), "%s/receipts_%s.idx", dir, day);
+    int fd = open(fname, O_RDONLY);
+    if (fd == -1) return 1;
+    ReceiptIndexHeader h;
+    ReceiptIndexSlot slot = { 0, 0 };
+    int found = 0;
+    /* older archives have a 65,536 slot index; the slot count in the header says which */
+    if (pread(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h) && h.magic == RECEIPT_INDEX_MAGIC
+        && h.slots >= 2 && h.slots <= RECEIPT_INDEX_SLOTS && (h.slots & (h.slots - 1)) == 0) {
+        unsigned at = receiptIndexHash(orderId, __builtin_ctz(h.slots));
+        for (uint32_t probe=0;probe<h.slots;probe++) {
+            off_t pos = (off_t)(sizeof(h) + sizeof(slot) * ((at + probe) & (h.slots - 1)));
+            if (pread(fd, &slot, sizeof(slot), pos) != (ssize_t)sizeof(slot) || slot.orderId == 0) break;
+            if (slot.orderId == orderId) { found = 1; break; }
+        }
+    }
+    close(fd);
+    if (!found) return 1;
+
+    ReceiptRecord r;
+    ReceiptRecordLine lines[MAX_ITEMS_PER_ORDER];
+    snprintf(fname, sizeof(fname), "%s/receipts_%s.rcp", dir, day);
+    fd = open(fname, O_RDONLY);
+    int ok = fd != -1 && pread(fd, &r, sizeof(r), slot.offset) == (ssize_t)sizeof(r)
+          && r.magic == RECEIPT_RECORD_MAGIC && r.orderId == orderId && r.lineCount <= MAX_ITEMS_PER_ORDER
+          && pread(fd, lines, sizeof(lines[0]) * r.lineCount, (off_t)slot.offset + (off_t)sizeof(r))
+             == (ssize_t)(sizeof(lines[0]) * r.lineCount);
+    if (fd != -1) close(fd);
+    if (!ok) return -1;
+
+    /* the dictionary is small (one entry per item sold that day), so it is read whole */
+    snprintf(fname, sizeof(fname), "%s/receipts_%s.dict", dir, day);
+    struct stat st;
+    fd = open(fname, O_RDONLY);
+    char *dict = fd != -1 && fstat(fd, &st) == 0 && st.st_size > 0 ? malloc((size_t)st.st_size) : NULL;
+    int *entryAt = calloc(65536, sizeof(int));
+    int entries = 0;
+    if (dict && entryAt && pread(fd, dict, (size_t)st.st_size, 0) == st.st_size) {
+        off_t pos = 0;
+        while (pos + (off_t)sizeof(ReceiptDictEntry) <= st.st_size) {
+            ReceiptDictEntry e;
+            memcpy(&e, dict + pos, sizeof(e));
+            if (e.id != entries || pos + (off_t)sizeof(e) + e.len > st.st_size) break;
+            entryAt[entries++] = (int)pos;
+            pos += (off_t)sizeof(e) + e.len;
+        }
+    }
+    if (fd != -1) close(fd);
+
+    static char receipt[RECEIPT_BUF_LEN];
+    ByteWriter w = { receipt, 0, (int)sizeof(receipt) };
+    putReceiptHead(&w, RECEIPT_TITLE, r.orderId, r.dineIn, r.tableNumber, (time_t)r.openedAt);
+    putReceiptColumns(&w);
+    for (int i=0;i<r.lineCount && ok;i++) {
+        ReceiptDictEntry e;
+        ok = lines[i].item < entries;
+        if (!ok) break;
+        memcpy(&e, dict + entryAt[lines[i].item], sizeof(e));
+        const char *text = dict + entryAt[lines[i].item] + sizeof(e);
+        const char *bar = memchr(text, '|', e.len);
+        ok = bar != NULL;
+        if (ok) putReceiptLine(&w, text, (int)(bar - text), bar + 1, (int)(text + e.len - bar - 1),
+                               lines[i].qty, (Money)lines[i].unitPrice * lines[i].qty);
+    }
+    if (ok && r.taxLabel < entries) {
+        Bill b;
+        memset(&b, 0, sizeof(b));
+        b.subtotal = r.subtotal;
+        b.gst = r.gst;
+        b.serviceCharge = r.serviceCharge;
+        b.discount = r.discount;
+        b.total = r.total;
+        b.happyHour = r.happyHour;
+        b.combo = r.combo;
+        b.coupon = r.coupon;
+        b.discountBp = r.discountBp;
+        memcpy(b.couponCode, r.couponCode, COUPON_LEN);
+        ReceiptDictEntry e;
+        memcpy(&e, dict + entryAt[r.taxLabel], sizeof(e));
+        putReceiptTotals(&w, &b, dict + entryAt[r.taxLabel] + sizeof(e), e.len);
+        fwrite(receipt, 1, (size_t)w.len, out);
+    } else {
+        ok = 0;
+    }
+    free(dict);
+    free(entryAt);
+    return ok ? 0 : -1;
+}
+
+static int compareDaysNewestFirst(const void *a, const void *b) {
+    return strcmp((const char*)b, (const char*)a);
+}
+
+/* With no day given, the days in dir are tried newest first: one index probe per day. */
+int reprintReceipt(const char *dir, int orderId, const char *day, FILE *out) {
+    int ret = 1;
+    if (day) {
+        ret = reprintFromDay(dir, day, orderId, out);
+    } else {
+        DIR *d = opendir(dir);
+        if (!d) { printf("Cannot open %s\n", dir); return 1; }
+        char (*days)[RECEIPT_DAY_LEN] = NULL;
+        int count = 0, capacity = 0;
+        struct dirent *de;
+        while ((de = readdir(d)) != NULL) {
+            size_t len = strlen(de->d_name);
+            if (len != strlen("receipts_YYYY-MM-DD.idx") || strncmp(de->d_name, "receipts_", 9) != 0
+                || strcmp(de->d_name + len - 4, ".idx") != 0) continue;
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                void *grown = realloc(days, sizeof(*days) * (size_t)capacity);
+                if (!grown) break;
+                days = grown;
+            }
+            memcpy(days[count], de->d_name + 9, 10);
+            days[count++][10] = '\0';
+        }
+        closedir(d);
+        qsort(days, (size_t)count, sizeof(*days), compareDaysNewestFirst);
+        for (int i=0;i<count && ret == 1;i++) ret = reprintFromDay(dir, days[i], orderId, out);
+        free(days);
+    }
+    if (ret == 1) printf("KOT %d is not in the receipt archive%s%s\n", orderId, day ? " for " : "", day ? day : "");
+    else if (ret == -1) printf("Receipt archive for KOT %d is damaged\n", orderId);
+    return ret != 0;
+}
+
+
+/*
+ * Sales store: every billed line is appended to one file per column under the --sales directory.
+ * Item codes are dictionary-encoded into sales.dict (written before any row that uses them), so the
+ * item column is a dense 16-bit id. Rows are buffered and written once a buffer fills or is a second old.
+ */
+static const struct { const char *name; int width; } salesColumnSpec[SALES_COLUMNS] = {
+    { "kot", 4 }, { "time", 8 }, { "table", 2 }, { "item", 2 }, { "qty", 4 }, { "amount", 8 }, { "category", 1 }
+};
+
+static void unpackMenuCode(uint64_t key, char *code) {
+    for (int i=0;i<CODE_LEN;i++) code[i] = (char)(key >> (8*i));
+    code[CODE_LEN-1] = '\0';
+}
+
+int salesOpen(const char *dir) {
+    char path[SALES_DIR_LEN + 32];
+    if (strlen(dir) >= SALES_DIR_LEN) return -1;
+    mkdir(dir, 0755);
+    long rows = -1;
+    for (int c=0;c<SALES_COLUMNS;c++) {
+        snprintf(path, sizeof(path), "%s/sales.%s", dir, salesColumnSpec[c].name);
+        salesFds[c] = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+        struct stat st;
+        if (salesFds[c] == -1 || fstat(salesFds[c], &st) != 0) return -1;
+        long n = (long)(st.st_size / salesColumnSpec[c].width);
+        if (rows == -1 || n < rows) rows = n;
+        salesBuf[c] = malloc((size_t)salesColumnSpec[c].width * SALES_BUFFER_ROWS);
+        if (!salesBuf[c]) return -1;
+    }
+    /* a crash mid-flush can leave columns of different lengths; drop the partial rows */
+    for (int c=0;c<SALES_COLUMNS;c++) {
+        if (ftruncate(salesFds[c], (off_t)rows * salesColumnSpec[c].width) != 0) return -1;
+    }
+    snprintf(path, sizeof(path), "%s/sales.dict", dir);
+    salesDictFd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (salesDictFd == -1) return -1;
+    uint64_t key;
+    while (salesDictCount < SALES_MAX_ITEMS && read(salesDictFd, &key, sizeof(key)) == (ssize_t)sizeof(key)) {
+        char code[CODE_LEN];
+        unpackMenuCode(key, code);
+        int id = internMenuCode(code);
+        if (id != -1 && salesDictIds[id] == 0) salesDictIds[id] = salesDictCount + 1;
+        salesDictCount++;
+    }
+    if (ftruncate(salesDictFd, (off_t)salesDictCount * (off_t)sizeof(key)) != 0) return -1;
+    salesStoreOpen = 1;
+    return 0;
+}
+
+static int salesDictId(int midx) {
+    if (salesDictIds[midx] != 0) return salesDictIds[midx] - 1;
+    if (salesDictCount >= SALES_MAX_ITEMS) return -1;
+    if (writeFully(salesDictFd, &menuKeys[midx], sizeof(menuKeys[midx])) != 0) return -1;
+    salesDictIds[midx] = ++salesDictCount;
+    return salesDictCount - 1;
+}
+
+static int salesFlushLocked(void) {
+    int ret = 0;
+    for (int c=0;c<SALES_COLUMNS && salesPending > 0;c++) {
+        if (writeFully(salesFds[c], salesBuf[c], (size_t)salesPending * salesColumnSpec[c].width) != 0) ret = -1;
+    }
+    salesPending = 0;
+    return ret;
+}
+
+/* Called with the order locked, just before a billed order is closed. */
+void salesRecordOrder(const Order *o) {
+    if (!salesStoreOpen) return;
+    pthread_mutex_lock(&salesLock);
+    int64_t now = (int64_t)time(NULL);
+    for (int i=0;i<o->itemCount;i++) {
+        int id = salesDictId(o->items[i].menuIdx);
+        if (id == -1) continue;
+        if (salesPending == SALES_BUFFER_ROWS) salesFlushLocked();
+        int p = salesPending;
+        ((int32_t*)salesBuf[SALES_KOT])[p] = o->orderId;
+        ((int64_t*)salesBuf[SALES_TIME])[p] = now;
+        ((int16_t*)salesBuf[SALES_TABLE])[p] = (int16_t)(o->dineIn ? o->tableNumber : 0);
+        ((uint16_t*)salesBuf[SALES_ITEM])[p] = (uint16_t)id;
+        ((int32_t*)salesBuf[SALES_QTY])[p] = o->items[i].qty;
+        ((Money*)salesBuf[SALES_AMOUNT])[p] = lineAmount(&o->items[i]);
+        ((uint8_t*)salesBuf[SALES_CATEGORY])[p] = (uint8_t)o->items[i].category;
+        if (salesPending++ == 0) clock_gettime(CLOCK_MONOTONIC, &salesFirstPending);
+    }
+    struct timespec now2;
+    clock_gettime(CLOCK_MONOTONIC, &now2);
+    if (salesPending > 0 && (now2.tv_sec - salesFirstPending.tv_sec) * 1000L
+        + (now2.tv_nsec - salesFirstPending.tv_nsec) / 1000000L >= SALES_FLUSH_MS) salesFlushLocked();
+    pthread_mutex_unlock(&salesLock);
+}
+
+void salesFlush(void) {
+    if (!salesStoreOpen) return;
+    pthread_mutex_lock(&salesLock);
+    salesFlushLocked();
+    pthread_mutex_unlock(&salesLock);
+}
+
+void salesClose(void) {
+    if (!salesStoreOpen) return;
+    pthread_mutex_lock(&salesLock);
+    salesFlushLocked();
+    for (int c=0;c<SALES_COLUMNS;c++) {
+        close(salesFds[c]);
+        free(salesBuf[c]);
+    }
+    close(salesDictFd);
+    salesStoreOpen = 0;
+    pthread_mutex_unlock(&salesLock);
+}
+
+/* Maps the column files read-only; a column shorter than the rest (torn append) bounds the row count. */
+int salesMap(const char *dir, SalesColumns *cols) {
+    char path[SALES_DIR_LEN + 32];
+    memset(cols, 0, sizeof(*cols));
+    if (strlen(dir) >= SALES_DIR_LEN) return -1;
+    cols->rows = -1;
+    for (int c=0;c<=SALES_COLUMNS;c++) {
+        snprintf(path, sizeof(path), "%s/sales.%s", dir, c < SALES_COLUMNS ? salesColumnSpec[c].name : "dict");
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) != 0) {
+            if (fd != -1) close(fd);
+            salesUnmap(cols);
+            return -1;
+        }
+        cols->mapLen[c] = (size_t)st.st_size;
+        void *p = st.st_size > 0 ? mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+        close(fd);
+        if (p == MAP_FAILED) {
+            cols->mapLen[c] = 0;
+            salesUnmap(cols);
+            return -1;
+        }
+        cols->map[c] = p;
+        if (c < SALES_COLUMNS) {
+            long n = (long)(st.st_size / salesColumnSpec[c].width);
+            if (cols->rows == -1 || n < cols->rows) cols->rows = n;
+            cols->col[c] = p;
+        } else {
+            cols->dict = p;
+            cols->dictCount = (int)(st.st_size / (off_t)sizeof(uint64_t));
+        }
+    }
+    return 0;
+}
+
+void salesUnmap(SalesColumns *cols) {
+    for (int c=0;c<=SALES_COLUMNS;c++) {
+        if (cols->map[c]) munmap(cols->map[c], cols->mapLen[c]);
+        cols->map[c] = NULL;
+    }
+}
+
+/*
+ * Query kernels: one tight pass over the columns a report needs, with the time filter applied as
+ * a mask rather than a branch. Each worker scans its own row range into private buckets.
+ */
+static void salesScanCategories(const SalesQuery *q, long lo, long hi, Money *amount, int64_t *qty) {
+    const int64_t *ts = q->cols->col[SALES_TIME];
+    const Money *amt = q->cols->col[SALES_AMOUNT];
+    const int32_t *qt = q->cols->col[SALES_QTY];
+    const uint8_t *cat = q->cols->col[SALES_CATEGORY];
+    for (long i=lo;i<hi;i++) {
+        int64_t keep = -(int64_t)((ts[i] >= q->from) & (ts[i] < q->to));
+        amount[cat[i] & 7] += amt[i] & keep;
+        qty[cat[i] & 7] += qt[i] & keep;
+    }
+}
+
+static void salesScanHours(const SalesQuery *q, long lo, long hi, Money *amount, int64_t *qty) {
+    const int64_t *ts = q->cols->col[SALES_TIME];
+    const Money *amt = q->cols->col[SALES_AMOUNT];
+    const int32_t *qt = q->cols->col[SALES_QTY];
+    for (long i=lo;i<hi;i++) {
+        int64_t keep = -(int64_t)((ts[i] >= q->from) & (ts[i] < q->to));
+        uint64_t local = (uint64_t)(ts[i] + q->utcOffset);
+        int hour = (int)(local % 86400u / 3600u);
+        amount[hour] += amt[i] & keep;
+        qty[hour] += qt[i] & keep;
+    }
+}
+
+static void salesScanItems(const SalesQuery *q, long lo, long hi, Money *amount, int64_t *qty) {
+    const int64_t *ts = q->cols->col[SALES_TIME];
+    const Money *amt = q->cols->col[SALES_AMOUNT];
+    const int32_t *qt = q->cols->col[SALES_QTY];
+    const uint16_t *item = q->cols->col[SALES_ITEM];
+    for (long i=lo;i<hi;i++) {
+        int64_t keep = -(int64_t)((ts[i] >= q->from) & (ts[i] < q->to));
+        amount[item[i]] += amt[i] & keep;
+        qty[item[i]] += qt[i] & keep;
+    }
+}
+
+static int salesBucketCount(SalesReportKind kind) {
+    return kind == SALES_BY_ITEM ? SALES_MAX_ITEMS + 1 : kind == SALES_BY_HOUR ? 24 : 8;
+}
+
+typedef struct {
+    const SalesQuery *query;
+    long lo;
+    long hi;
+    Money *amount;
+    int64_t *qty;
+} SalesWorker;
+
+static void* salesWorkerMain(void *arg) {
+    SalesWorker *w = arg;
+    switch (w->query->kind) {
+        case SALES_BY_CATEGORY: salesScanCategories(w->query, w->lo, w->hi, w->amount, w->qty); break;
+        case SALES_BY_HOUR: salesScanHours(w->query, w->lo, w->hi, w->amount, w->qty); break;
+        case SALES_BY_ITEM: salesScanItems(w->query, w->lo, w->hi, w->amount, w->qty); break;
+    }
+    return NULL;
+}
+
+/* Splits the rows across up to `threads` workers and sums their buckets into amount/qty. */
+int salesAggregate(const SalesQuery *q, int threads, Money *amount, int64_t *qty) {
+    int buckets = salesBucketCount(q->kind);
+    long rows = q->cols->rows;
+    if (threads < 1) threads = 1;
+    if (threads > SALES_MAX_THREADS) threads = SALES_MAX_THREADS;
+    if (threads > rows / SALES_MIN_ROWS_PER_THREAD) threads = (int)(rows / SALES_MIN_ROWS_PER_THREAD) + 1;
+    SalesWorker workers[SALES_MAX_THREADS];
+    pthread_t tids[SALES_MAX_THREADS];
+    memset(amount, 0, sizeof(Money) * (size_t)buckets);
+    memset(qty, 0, sizeof(int64_t) * (size_t)buckets);
+    int ret = 0, started = 0;
+    for (int t=0;t<threads;t++) {
+        SalesWorker *w = &workers[t];
+        w->query = q;
+        w->lo = rows * t / threads;
+        w->hi = rows * (t + 1) / threads;
+        w->amount = t == 0 ? amount : calloc((size_t)buckets, sizeof(Money));
+        w->qty = t == 0 ? qty : calloc((size_t)buckets, sizeof(int64_t));
+        if (!w->amount || !w->qty) { free(w->amount); free(w->qty); ret = -1; break; }
+        if (t > 0 && pthread_create(&tids[t], NULL, salesWorkerMain, w) != 0) {
+            free(w->amount); free(w->qty); ret = -1; break;
+        }
+        started = t + 1;
+    }
+    if (started > 0) salesWorkerMain(&workers[0]);
+    for (int t=1;t<started;t++) {
+        pthread_join(tids[t], NULL);
+        for (int b=0;b<buckets;b++) {
+            amount[b] += workers[t].amount[b];
+            qty[b] += workers[t].qty[b];
+        }
+        free(workers[t].amount);
+        free(workers[t].qty);
+    }
+    return ret;
+}
+
+static int salesThreadCount(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : n > SALES_MAX_THREADS ? SALES_MAX_THREADS : (int)n;
+}
+
+static const Money *salesSortAmount;
+
+static int compareSalesBuckets(const void *a, const void *b) {
+    Money x = salesSortAmount[*(const int*)a], y = salesSortAmount[*(const int*)b];
+    return (x < y) - (x > y);
+}
+
+static int parseDate(const char *s, time_t *t) {
+    struct tm tmv;
+    memset(&tmv, 0, sizeof(tmv));
+    if (sscanf(s, "%d-%d-%d", &tmv.tm_year, &tmv.tm_mon, &tmv.tm_mday) != 3) return -1;
+    tmv.tm_year -= 1900;
+    tmv.tm_mon -= 1;
+    tmv.tm_isdst = -1;
+    *t = mktime(&tmv);
+    return *t == (time_t)-1 ? -1 : 0;
+}
+
+/* --sales-report <dir> items|categories|hourly [from-date [to-date]], dates as YYYY-MM-DD, both inclusive. */
+int runSalesReport(const char *dir, const char *kindName, const char *fromDate, const char *toDate) {
+    static const char *categoryNames[] = { NULL, "Starters", "Main Course", "Beverages", "Desserts" };
+    SalesQuery q;
+    memset(&q, 0, sizeof(q));
+    if (strcmp(kindName, "items") == 0) q.kind = SALES_BY_ITEM;
+    else if (strcmp(kindName, "categories") == 0) q.kind = SALES_BY_CATEGORY;
+    else if (strcmp(kindName, "hourly") == 0) q.kind = SALES_BY_HOUR;
+    else { printf("Unknown report %s (items|categories|hourly)\n", kindName); return 1; }
+    time_t from = 0, to = 0;
+    q.from = INT64_MIN;
+    q.to = INT64_MAX;
+    if (fromDate) {
+        if (parseDate(fromDate, &from) != 0) { printf("Bad date %s (YYYY-MM-DD)\n", fromDate); return 1; }
+        q.from = from;
+    }
+    if (toDate) {
+        if (parseDate(toDate, &to) != 0) { printf("Bad date %s (YYYY-MM-DD)\n", toDate); return 1; }
+        q.to = (int64_t)to + 86400;
+    }
+    SalesColumns cols;
+    if (salesMap(dir, &cols) != 0) { printf("Cannot open sales store %s\n", dir); return 1; }
+    q.cols = &cols;
+    q.utcOffset = utcOffsetAt(fromDate ? from : cols.rows > 0 ? (time_t)((const int64_t*)cols.col[SALES_TIME])[0] : time(NULL));
+    int buckets = salesBucketCount(q.kind);
+    Money *amount = malloc(sizeof(Money) * (size_t)buckets);
+    int64_t *qty = malloc(sizeof(int64_t) * (size_t)buckets);
+    int *order = malloc(sizeof(int) * (size_t)buckets);
+    if (!amount || !qty || !order || salesAggregate(&q, salesThreadCount(), amount, qty) != 0) {
+        printf("Sales report failed.\n");
+        salesUnmap(&cols);
+        return 1;
+    }
+    char money[MONEY_STR_LEN];
+    Money total = 0;
+    printf("%s sales from %s (%ld lines)\n", kindName, dir, cols.rows);
+    if (q.kind == SALES_BY_CATEGORY) {
+        printf("%-12s | %-8s | %s\n", "Category", "Qty", "Revenue");
+        for (int c=STARTER;c<=DESSERT;c++) {
+            printf("%-12s | %-8" PRId64 " | %s\n", categoryNames[c], qty[c], formatMoney(amount[c], money));
+            total += amount[c];
+        }
+    } else if (q.kind == SALES_BY_HOUR) {
+        printf("%-5s | %-8s | %s\n", "Hour", "Qty", "Revenue");
+        for (int h=0;h<24;h++) {
+            if (qty[h] == 0 && amount[h] == 0) continue;
+            printf("%02d:00 | %-8" PRId64 " | %s\n", h, qty[h], formatMoney(amount[h], money));
+            total += amount[h];
+        }
+    } else {
+        int n = 0;
+        for (int b=0;b<cols.dictCount && b<buckets;b++) {
+            if (qty[b] != 0 || amount[b] != 0) order[n++] = b;
+        }
+        salesSortAmount = amount;
+        qsort(order, (size_t)n, sizeof(int), compareSalesBuckets);
+        const MenuCatalog *menu = menuPin();
+        printf("%-6s | %-25s | %-8s | %s\n", "Code", "Item", "Qty", "Revenue");
+        for (int k=0;k<n;k++) {
+            char code[CODE_LEN];
+            unpackMenuCode(cols.dict[order[k]], code);
+            printf("%-6s | %-25s | %-8" PRId64 " | %s\n", code, menuItemName(menu, findMenuIndexByCode(code)),
+                   qty[order[k]], formatMoney(amount[order[k]], money));
+            total += amount[order[k]];
+        }
+        menuUnpin();
+    }
+    printf("Total revenue: %s\n", formatMoney(total, money));
+    free(amount);
+    free(qty);
+    free(order);
+    salesUnmap(&cols);
+    return 0;
+}
+
+
+/*
+ * Consolidation: --consolidate <out> <outlet>... merges many outlets' bills into one set of daily
+ * totals. An outlet is a journal, replayed into private state from its first generation on and
+ * priced with priceOrder as each KOT closes, or a receipt archive directory or .rcp segment, whose amounts
+ * were priced at bill time. Every outlet starts its KOTs at 9001, so each bill gets a global id,
+ * dense in command-line order, listed in <out>.kots beside its outlet and KOT; <out>.days has the
+ * totals by the local day each order was opened, which is the only time a journal records.
+ */
+static double elapsedMs(struct timespec a, struct timespec b);
+
+static unsigned replaySlot(int orderId, int size) {
+    return ((unsigned)orderId * 2654435761u) & (unsigned)(size-1);
+}
+
+static int replayFind(const OutletReplay *r, int orderId) {
+    if (r->indexSize == 0) return -1;
+    for (unsigned h=replaySlot(orderId, r->indexSize);r->index[h].orderId!=0;h=(h+1)&(unsigned)(r->indexSize-1)) {
+        if (r->index[h].orderId == orderId) return r->index[h].orderIdx;
+    }
+    return -1;
+}
+
+static Order* replayOrder(OutletReplay *r, int orderId) {
+    int slot = replayFind(r, orderId);
+    return slot == -1 ? NULL : &r->orders[slot].order;
+}
+
+static void replayIndexPut(OutletReplay *r, int orderId, int slot) {
+    unsigned h = replaySlot(orderId, r->indexSize);
+    while (r->index[h].orderId != 0) h = (h+1) & (unsigned)(r->indexSize-1);
+    r->index[h].orderId = orderId;
+    r->index[h].orderIdx = slot;
+}
+
+static Order* replayCreate(OutletReplay *r, int orderId, int dineIn, int tableNumber, time_t timestamp) {
+    if (orderId <= 0 || replayFind(r, orderId) != -1) return NULL;
+    if (dineIn && (tableNumber < 1 || tableNumber > MAX_TABLES)) return NULL;
+    if ((r->indexUsed + 1) * 2 > r->indexSize) {
+        int oldSize = r->indexSize;
+        KotIndexEntry *old = r->index;
+        int newSize = oldSize ? oldSize * 2 : KOT_INDEX_MIN_SIZE;
+        KotIndexEntry *tbl = calloc((size_t)newSize, sizeof(KotIndexEntry));
+        if (!tbl) return NULL;
+        r->index = tbl;
+        r->indexSize = newSize;
+        for (int i=0;i<oldSize;i++) {
+            if (old[i].orderId != 0) replayIndexPut(r, old[i].orderId, old[i].orderIdx);
+        }
+        free(old);
+    }
+    int slot = r->freeHead;
+    if (slot != -1) {
+        r->freeHead = r->orders[slot].order.nextActive;
+    } else {
+        if (r->orderCount == r->orderCapacity) {
+            int capacity = r->orderCapacity ? r->orderCapacity * 2 : 64;
+            ReplayOrder *grown = realloc(r->orders, sizeof(ReplayOrder) * (size_t)capacity);
+            if (!grown) return NULL;
+            /* items point into the slab, so they follow it when it moves */
+            for (int i=0;i<r->orderCount;i++) grown[i].order.items = grown[i].lines;
+            r->orders = grown;
+            r->orderCapacity = capacity;
+        }
+        slot = r->orderCount++;
+    }
+    Order *o = &r->orders[slot].order;
+    memset(o, 0, sizeof(*o));
+    o->orderId = orderId;
+    o->dineIn = (uint8_t)(dineIn != 0);
+    o->tableNumber = (int16_t)(dineIn ? tableNumber : 0);
+    o->active = 1;
+    o->itemCapacity = MAX_ITEMS_PER_ORDER;
+    o->items = r->orders[slot].lines;
+    o->timestamp = timestamp;
+    replayIndexPut(r, orderId, slot);
+    r->indexUsed++;
+    if (dineIn) r->tableKot[tableNumber-1] = orderId;
+    return o;
+}
+
+static void replayRelease(OutletReplay *r, Order *o) {
+    unsigned mask = (unsigned)(r->indexSize-1);
+    unsigned h = replaySlot(o->orderId, r->indexSize);
+    while (r->index[h].orderId != o->orderId) h = (h+1) & mask;
+    int slot = r->index[h].orderIdx;
+    unsigned hole = h;
+    for (unsigned j=(h+1)&mask;r->index[j].orderId!=0;j=(j+1)&mask) {
+        unsigned home = replaySlot(r->index[j].orderId, r->indexSize);
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            r->index[hole] = r->index[j];
+            hole = j;
+        }
+    }
+    r->index[hole].orderId = 0;
+    r->indexUsed--;
+    o->active = 0;
+    o->nextActive = r->freeHead;
+    r->freeHead = slot;
+}
+
+static DayTotals* consolidationDay(ConsolidationTask *t, int32_t day) {
+    if (t->dayCount > 0 && t->days[t->lastDay].day == day) return &t->days[t->lastDay];
+    int lo = 0, hi = t->dayCount;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (t->days[mid].day < day) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == t->dayCount || t->days[lo].day != day) {
+        if (t->dayCount == t->dayCapacity) {
+            int capacity = t->dayCapacity ? t->dayCapacity * 2 : 16;
+            DayTotals *grown = realloc(t->days, sizeof(DayTotals) * (size_t)capacity);
+            if (!grown) return NULL;
+            t->days = grown;
+            t->dayCapacity = capacity;
+        }
+        memmove(&t->days[lo+1], &t->days[lo], sizeof(DayTotals) * (size_t)(t->dayCount - lo));
+        memset(&t->days[lo], 0, sizeof(DayTotals));
+        t->days[lo].day = day;
+        t->dayCount++;
+    }
+    t->lastDay = lo;
+    return &t->days[lo];
+}
+
+static int consolidateBill(ConsolidationTask *t, int orderId, time_t openedAt, const Bill *b) {
+    DayTotals *d = consolidationDay(t, (int32_t)localDayOf(openedAt));
+    if (!d) return -1;
+    if (t->billCount == t->billCapacity) {
+        int capacity = t->billCapacity ? t->billCapacity * 2 : 1024;
+        ConsolidatedBill *grown = realloc(t->bills, sizeof(ConsolidatedBill) * (size_t)capacity);
+        if (!grown) return -1;
+        t->bills = grown;
+        t->billCapacity = capacity;
+    }
+    ConsolidatedBill *c = &t->bills[t->billCount++];
+    c->orderId = orderId;
+    c->day = d->day;
+    c->total = b->total;
+    d->orders++;
+    d->subtotal += b->subtotal;
+    d->happyHour += b->happyHour;
+    d->gst += b->gst;
+    d->serviceCharge += b->serviceCharge;
+    d->discount += b->discount;
+    d->combo += b->combo;
+    d->coupon += b->coupon;
+    d->total += b->total;
+    return 0;
+}
+
+/* Follows mergeTable: joining a table held by another open order folds that order in, unbilled. */
+static void replayMerge(OutletReplay *r, Order *o, int table) {
+    if (!o->dineIn || table < 1 || table > MAX_TABLES) return;
+    int otherId = r->tableKot[table-1];
+    Order *b = otherId != 0 && otherId != o->orderId ? replayOrder(r, otherId) : NULL;
+    if (!b || !b->dineIn) {
+        r->tableKot[table-1] = o->orderId;
+        return;
+    }
+    for (int i=0;i<b->itemCount;i++) {
+        const OrderItem *line = &b->items[i];
+        addLineToOrder(o, line->menuIdx, line->qty, line->unitPrice, line->category);
+    }
+    for (int t=0;t<MAX_TABLES;t++) {
+        if (r->tableKot[t] == otherId) r->tableKot[t] = o->orderId;
+    }
+    /* the CLOSE journaled for b right after finds nothing, so it is not billed */
+    replayRelease(r, b);
+}
+
+static int replayJournalRecord(ConsolidationTask *t, OutletReplay *r, const JournalRecord *rec) {
+    if (rec->type == JOURNAL_CREATE) {
+        replayCreate(r, rec->orderId, rec->dineIn, rec->tableNumber, (time_t)rec->timestamp);
+        return 0;
+    }
+    Order *o = replayOrder(r, rec->orderId);
+    if (!o) return 0;
+    char code[CODE_LEN];
+    memcpy(code, rec->code, CODE_LEN);
+    code[CODE_LEN-1] = '\0';
+    int midx = -1, line = -1;
+    if (rec->type == JOURNAL_ADD || rec->type == JOURNAL_REMOVE || rec->type == JOURNAL_UPDATE) {
+        midx = internMenuCode(code);
+        for (int i=0;i<o->itemCount && line==-1;i++) {
+            if (o->items[i].menuIdx == midx) line = i;
+        }
+    }
+    switch (rec->type) {
+        case JOURNAL_ADD:
+            if (midx != -1) addRecoveredLine(o, midx, rec->qty, rec->price, rec->category);
+            break;
+        case JOURNAL_REMOVE:
+            if (line == -1) break;
+            adjustOrderTotals(o, &o->items[line], -o->items[line].qty);
+            memmove(&o->items[line], &o->items[line+1], sizeof(OrderItem) * (size_t)(o->itemCount - line - 1));
+            o->itemCount--;
+            break;
+        case JOURNAL_UPDATE:
+            if (line == -1 || rec->qty <= 0 || rec->qty > MAX_LINE_QTY) break;
+            adjustOrderTotals(o, &o->items[line], rec->qty - o->items[line].qty);
+            o->items[line].qty = (uint16_t)rec->qty;
+            break;
+        case JOURNAL_CLOSE: {
+            Bill b = priceOrder(pricing, o, NULL);
+            int ret = consolidateBill(t, o->orderId, o->timestamp, &b);
+            replayRelease(r, o);
+            return ret;
+        }
+        case JOURNAL_MERGE:
+            replayMerge(r, o, rec->qty);
+            break;
+        case JOURNAL_SPLIT:
+            if (rec->qty >= 1 && rec->qty <= MAX_TABLES && r->tableKot[rec->qty-1] == o->orderId) r->tableKot[rec->qty-1] = 0;
+            break;
+        case JOURNAL_MOVE:
+            if (!o->dineIn || rec->qty < 1 || rec->qty > MAX_TABLES) break;
+            if (r->tableKot[o->tableNumber-1] == o->orderId) r->tableKot[o->tableNumber-1] = 0;
+            r->tableKot[rec->qty-1] = o->orderId;
+            o->tableNumber = (int16_t)rec->qty;
+            break;
+    }
+    CHECK_ORDER_TOTALS(o);
+    return 0;
+}
+
+/* Replays one journal generation's records into r. */
+static int replayJournalGeneration(ConsolidationTask *t, OutletReplay *r, const char *data, size_t len) {
+    int ret = 0;
+    for (size_t off=sizeof(JournalHeader);off+sizeof(JournalRecord)<=len;off+=sizeof(JournalRecord)) {
+        JournalRecord rec;
+        memcpy(&rec, data + off, sizeof(rec));
+        if (rec.checksum != journalChecksum(&rec)) break;
+        if (replayJournalRecord(t, r, &rec) != 0) ret = -1;
+        t->records++;
+    }
+    return ret;
+}
+
+/* Replays <path>.<generation>, a generation an earlier checkpoint closed; -1 if it is missing or not that generation. */
+static int replayClosedGeneration(ConsolidationTask *t, OutletReplay *r, const char *path, uint64_t generation) {
+    char file[RECEIPT_PATH_LEN + 24];
+    snprintf(file, sizeof(file), "%s.%llu", path, (unsigned long long)generation);
+    int fd = open(file, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(JournalHeader)) {
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    size_t len = (size_t)st.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    posix_madvise(map, len, POSIX_MADV_SEQUENTIAL);
+    JournalHeader h;
+    memcpy(&h, map, sizeof(h));
+    int ret = h.magic == JOURNAL_MAGIC && h.generation == generation ? replayJournalGeneration(t, r, map, len) : -1;
+    munmap(map, len);
+    return ret;
+}
+
+/*
+ * A journal only holds the records since the last checkpoint, so every generation before it is
+ * replayed first, from <path>.0 on; without them the bills closed earlier would go uncounted.
+ */
+static int consolidateJournal(ConsolidationTask *t, const char *path, const char *data, size_t len) {
+    JournalHeader h;
+    memcpy(&h, data, sizeof(h));
+    OutletReplay *r = calloc(1, sizeof(*r));
+    if (!r) return -1;
+    r->freeHead = -1;
+    int ret = 0;
+    for (uint64_t g=0;g<h.generation && ret==0;g++) {
+        if (replayClosedGeneration(t, r, path, g) != 0) {
+            printf("%s: generation %llu is missing or damaged; consolidate from the receipt archive instead\n",
+                   path, (unsigned long long)g);
+            ret = -1;
+        }
+    }
+    if (ret == 0) ret = replayJournalGeneration(t, r, data, len);
+    t->stillOpen += r->indexUsed;
+    free(r->orders);
+    free(r->index);
+    free(r);
+    return ret;
+}
+
+static int consolidateArchive(ConsolidationTask *t, const char *path, const char *data, size_t len) {
+    size_t off = 0;
+    while (off + sizeof(ReceiptRecord) <= len) {
+        ReceiptRecord rec;
+        memcpy(&rec, data + off, sizeof(rec));
+        size_t next = off + sizeof(rec) + sizeof(ReceiptRecordLine) * rec.lineCount;
+        if (rec.magic != RECEIPT_RECORD_MAGIC || next > len) break;
+        Bill b;
+        memset(&b, 0, sizeof(b));
+        b.subtotal = rec.subtotal;
+        b.happyHour = rec.happyHour;
+        b.gst = rec.gst;
+        b.serviceCharge = rec.serviceCharge;
+        b.discount = rec.discount;
+        b.combo = rec.combo;
+        b.coupon = rec.coupon;
+        b.total = rec.total;
+        if (consolidateBill(t, rec.orderId, (time_t)rec.openedAt, &b) != 0) return -1;
+        t->records++;
+        off = next;
+    }
+    if (off != len) printf("%s: stopped at a damaged record at byte %zu\n", path, off);
+    return 0;
+}
+
+static int consolidateFile(ConsolidationTask *t, const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        if (fd != -1) close(fd);
+        printf("Cannot open %s\n", path);
+        return -1;
+    }
+    size_t len = (size_t)st.st_size;
+    void *map = len >= sizeof(JournalHeader) ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) {
+        if (len == 0) return 0;
+        printf("Cannot read %s\n", path);
+        return -1;
+    }
+    posix_madvise(map, len, POSIX_MADV_SEQUENTIAL);
+    uint32_t magic;
+    memcpy(&magic, map, sizeof(magic));
+    int ret = -1;
+    if (magic == JOURNAL_MAGIC) ret = consolidateJournal(t, path, map, len);
+    else if (magic == RECEIPT_RECORD_MAGIC) ret = consolidateArchive(t, path, map, len);
+    else printf("%s is neither a journal nor a receipt archive\n", path);
+    munmap(map, len);
+    return ret;
+}
+
+static int compareNames(const void *a, const void *b) {
+    return strcmp(*(char *const*)a, *(char *const*)b);
+}
+
+/* The .rcp segments of an archive directory, oldest day first; the caller frees the array and names. */
+static int listArchiveSegments(const char *dir, char ***names) {
+    DIR *d = opendir(dir);
+    if (!d) return -1;
+    char **list = NULL;
+    int count = 0, capacity = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        size_t len = strlen(de->d_name);
+        if (len < 4 || strncmp(de->d_name, "receipts_", 9) != 0 || strcmp(de->d_name + len - 4, ".rcp") != 0) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            char **grown = realloc(list, sizeof(char*) * (size_t)capacity);
+            if (!grown) break;
+            list = grown;
+        }
+        if ((list[count] = strdup(de->d_name)) != NULL) count++;
+    }
+    closedir(d);
+    qsort(list, (size_t)count, sizeof(char*), compareNames);
+    *names = list;
+    return count;
+}
+
+static off_t consolidationInputSize(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) return 0;
+    if (!S_ISDIR(st.st_mode)) {
+        /* a journal is replayed together with the generations before it */
+        off_t size = st.st_size;
+        JournalHeader h;
+        FILE *f = fopen(path, "rb");
+        if (f && fread(&h, sizeof(h), 1, f) == 1 && h.magic == JOURNAL_MAGIC) {
+            for (uint64_t g=0;g<h.generation;g++) {
+                char file[RECEIPT_PATH_LEN + 24];
+                snprintf(file, sizeof(file), "%s.%llu", path, (unsigned long long)g);
+                if (stat(file, &st) == 0) size += st.st_size;
+            }
+        }
+        if (f) fclose(f);
+        return size;
+    }
+    char **names;
+    int count = listArchiveSegments(path, &names);
+    off_t size = 0;
+    for (int i=0;i<count;i++) {
+        char file[RECEIPT_PATH_LEN];
+        snprintf(file, sizeof(file), "%s/%s", path, names[i]);
+        if (stat(file, &st) == 0) size += st.st_size;
+        free(names[i]);
+    }
+    if (count >= 0) free(names);
+    return size;
+}
+
+static void consolidateTask(ConsolidationTask *t) {
+    struct stat st;
+    if (stat(t->path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        char **names;
+        int count = listArchiveSegments(t->path, &names);
+        if (count < 0) { printf("Cannot open %s\n", t->path); t->failed = 1; return; }
+        for (int i=0;i<count;i++) {
+            char file[RECEIPT_PATH_LEN];
+            snprintf(file, sizeof(file), "%s/%s", t->path, names[i]);
+            if (!t->failed && consolidateFile(t, file) != 0) t->failed = 1;
+            free(names[i]);
+        }
+        free(names);
+    } else if (consolidateFile(t, t->path) != 0) {
+        t->failed = 1;
+    }
+}
+
+static void resetConsolidationTask(ConsolidationTask *t) {
+    free(t->bills);
+    free(t->days);
+    t->bills = NULL;
+    t->days = NULL;
+    t->billCount = t->billCapacity = 0;
+    t->dayCount = t->dayCapacity = t->lastDay = 0;
+    t->records = 0;
+    t->stillOpen = 0;
+    t->failed = 0;
+}
+
+/* Takes the owner's next task from the head, or steals from the tail; -1 once the run is empty. */
+static int taskDequeTake(TaskDeque *d, int steal) {
+    uint64_t range = atomic_load(&d->range);
+    while (1) {
+        uint32_t head = (uint32_t)range, tail = (uint32_t)(range >> 32);
+        if (head >= tail) return -1;
+        uint64_t next = steal ? (uint64_t)(tail - 1) << 32 | head : (uint64_t)tail << 32 | (head + 1);
+        if (atomic_compare_exchange_weak(&d->range, &range, next)) return steal ? (int)tail - 1 : (int)head;
+    }
+}
+
+typedef struct {
+    ConsolidationTask **slots;   /* deque positions -> tasks */
+    TaskDeque *deques;
+    int workers;
+    _Atomic long steals;
+} ConsolidationPool;
+
+typedef struct {
+    ConsolidationPool *pool;
+    int id;
+} ConsolidationWorker;
+
+static void* consolidationWorkerMain(void *arg) {
+    ConsolidationWorker *w = arg;
+    ConsolidationPool *p = w->pool;
+    while (1) {
+        int pos = taskDequeTake(&p->deques[w->id], 0);
+        for (int k=1;pos==-1 && k<p->workers;k++) {
+            pos = taskDequeTake(&p->deques[(w->id + k) % p->workers], 1);
+            if (pos != -1) atomic_fetch_add(&p->steals, 1);
+        }
+        /* nothing is ever pushed, so one empty sweep of every deque means the run is done */
+        if (pos == -1) return NULL;
+        consolidateTask(p->slots[pos]);
+    }
+}
+
+static int compareTasksBySize(const void *a, const void *b) {
+    off_t x = (*(ConsolidationTask *const*)a)->size, y = (*(ConsolidationTask *const*)b)->size;
+    return (x < y) - (x > y);
+}
+
+/*
+ * Deals the tasks largest first round-robin, so every worker starts on its share of the big
+ * outlets and works down its own run; a worker that runs dry steals the smallest task left in
+ * someone else's, which keeps the tail of the run short. Returns the number of steals.
+ */
+static long consolidateParallel(ConsolidationTask *tasks, int n, int threads) {
+    if (threads > CONSOLIDATE_MAX_THREADS) threads = CONSOLIDATE_MAX_THREADS;
+    if (threads > n) threads = n;
+    if (threads < 1) threads = 1;
+    ConsolidationTask **bySize = malloc(sizeof(ConsolidationTask*) * (size_t)(n > 0 ? n : 1));
+    ConsolidationTask **slots = malloc(sizeof(ConsolidationTask*) * (size_t)(n > 0 ? n : 1));
+    if (!bySize || !slots) {
+        free(bySize);
+        free(slots);
+        for (int i=0;i<n;i++) consolidateTask(&tasks[i]);
+        return 0;
+    }
+    for (int i=0;i<n;i++) bySize[i] = &tasks[i];
+    qsort(bySize, (size_t)n, sizeof(ConsolidationTask*), compareTasksBySize);
+    TaskDeque deques[CONSOLIDATE_MAX_THREADS];
+    ConsolidationWorker workers[CONSOLIDATE_MAX_THREADS];
+    pthread_t tids[CONSOLIDATE_MAX_THREADS];
+    ConsolidationPool pool = { slots, deques, threads, 0 };
+    int start = 0;
+    for (int w=0;w<threads;w++) {
+        int count = n / threads + (w < n % threads);
+        for (int k=0;k<count;k++) slots[start + k] = bySize[w + k * threads];
+        atomic_init(&deques[w].range, (uint64_t)(start + count) << 32 | (uint64_t)start);
+        workers[w].pool = &pool;
+        workers[w].id = w;
+        start += count;
+    }
+    /* a worker that fails to start leaves its run to be stolen by the others */
+    int started = 1;
+    for (int w=1;w<threads;w++) {
+        if (pthread_create(&tids[started], NULL, consolidationWorkerMain, &workers[w]) == 0) started++;
+    }
+    consolidationWorkerMain(&workers[0]);
+    for (int w=1;w<started;w++) pthread_join(tids[w], NULL);
+    free(bySize);
+    free(slots);
+    return atomic_load(&pool.steals);
+}
+
+static int compareDayTotals(const void *a, const void *b) {
+    const DayTotals *x = a, *y = b;
+    return (x->day > y->day) - (x->day < y->day);
+}
+
+static void formatDay(int32_t day, char *buf) {
+    time_t t = (time_t)day * 86400;
+    struct tm tmv;
+    gmtime_r(&t, &tmv);
+    strftime(buf, RECEIPT_DAY_LEN, "%Y-%m-%d", &tmv);
+}
+
+/* Folds the per-outlet day lists into one, sorted by day; returns the number of days or -1. */
+static int mergeDayTotals(const ConsolidationTask *tasks, int n, DayTotals **out) {
+    int count = 0;
+    for (int i=0;i<n;i++) count += tasks[i].dayCount;
+    DayTotals *all = malloc(sizeof(DayTotals) * (size_t)(count > 0 ? count : 1));
+    if (!all) return -1;
+    count = 0;
+    for (int i=0;i<n;i++) {
+        memcpy(&all[count], tasks[i].days, sizeof(DayTotals) * (size_t)tasks[i].dayCount);
+        count += tasks[i].dayCount;
+    }
+    qsort(all, (size_t)count, sizeof(DayTotals), compareDayTotals);
+    int days = 0;
+    for (int i=0;i<count;i++) {
+        if (days > 0 && all[days-1].day == all[i].day) {
+            DayTotals *d = &all[days-1];
+            d->orders += all[i].orders;
+            d->subtotal += all[i].subtotal;
+            d->happyHour += all[i].happyHour;
+            d->gst += all[i].gst;
+            d->serviceCharge += all[i].serviceCharge;
+            d->discount += all[i].discount;
+            d->combo += all[i].combo;
+            d->coupon += all[i].coupon;
+            d->total += all[i].total;
+        } else {
+            all[days++] = all[i];
+        }
+    }
+    *out = all;
+    return days;
+}
+
+static int writeConsolidation(const char *outPrefix, const ConsolidationTask *tasks, int n, const DayTotals *days, int dayCount) {
+    char path[RECEIPT_PATH_LEN], day[RECEIPT_DAY_LEN], money[MONEY_STR_LEN];
+    snprintf(path, sizeof(path), "%s.kots", outPrefix);
+    FILE *f = fopen(path, "w");
+    if (!f) { printf("Cannot write %s\n", path); return -1; }
+    fprintf(f, "# global|outlet|kot|opened|total\n");
+    for (int i=0;i<n;i++) fprintf(f, "# outlet %d = %s\n", tasks[i].outlet, tasks[i].path);
+    int64_t globalId = 0;
+    for (int i=0;i<n;i++) {
+        for (int k=0;k<tasks[i].billCount;k++) {
+            const ConsolidatedBill *c = &tasks[i].bills[k];
+            formatDay(c->day, day);
+            fprintf(f, "%" PRId64 "|%d|%d|%s|%s\n", ++globalId, tasks[i].outlet, c->orderId, day, formatMoney(c->total, money));
+        }
+    }
+    int ok = fclose(f) == 0;
+    snprintf(path, sizeof(path), "%s.days", outPrefix);
+    f = ok ? fopen(path, "w") : NULL;
+    if (!f) { printf("Cannot write %s\n", path); return -1; }
+    fprintf(f, "# date|orders|subtotal|happy_hour|gst|service|discount|combo|coupon|total\n");
+    for (int i=0;i<dayCount;i++) {
+        const DayTotals *d = &days[i];
+        char a[MONEY_STR_LEN], b[MONEY_STR_LEN], c[MONEY_STR_LEN], e[MONEY_STR_LEN], g[MONEY_STR_LEN], h[MONEY_STR_LEN], k[MONEY_STR_LEN];
+        formatDay(d->day, day);
+        fprintf(f, "%s|%d|%s|%s|%s|%s|%s|%s|%s|%s\n", day, d->orders, formatMoney(d->subtotal, a), formatMoney(d->happyHour, b),
+                formatMoney(d->gst, c), formatMoney(d->serviceCharge, e), formatMoney(d->discount, g),
+                formatMoney(d->combo, h), formatMoney(d->coupon, k), formatMoney(d->total, money));
+    }
+    if (fclose(f) != 0) { printf("Cannot write %s\n", path); return -1; }
+    return ok ? 0 : -1;
+}
+
+/* --consolidate <out> <outlet>...: each outlet a journal, a receipt archive directory or an .rcp segment. */
+int runConsolidation(const char *outPrefix, char **paths, int count) {
+    if (strlen(outPrefix) + 8 > RECEIPT_PATH_LEN) { printf("Output path too long.\n"); return 1; }
+    ConsolidationTask *tasks = calloc((size_t)count, sizeof(ConsolidationTask));
+    if (!tasks) { printf("Out of memory.\n"); return 1; }
+    for (int i=0;i<count;i++) {
+        tasks[i].path = paths[i];
+        tasks[i].outlet = i + 1;
+        tasks[i].size = consolidationInputSize(paths[i]);
+    }
+    int threads = salesThreadCount();
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    long steals = consolidateParallel(tasks, count, threads);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    int failed = 0, stillOpen = 0;
+    long records = 0, bills = 0;
+    for (int i=0;i<count;i++) {
+        failed += tasks[i].failed;
+        stillOpen += tasks[i].stillOpen;
+        records += tasks[i].records;
+        bills += tasks[i].billCount;
+    }
+    DayTotals *days = NULL;
+    int dayCount = failed ? -1 : mergeDayTotals(tasks, count, &days);
+    int ret = 1;
+    if (failed) printf("%d of %d outlets could not be read; nothing written.\n", failed, count);
+    else if (dayCount < 0) printf("Out of memory.\n");
+    else if (writeConsolidation(outPrefix, tasks, count, days, dayCount) == 0) ret = 0;
+    if (ret == 0) {
+        char money[MONEY_STR_LEN];
+        DayTotals all;
+        memset(&all, 0, sizeof(all));
+        printf("Consolidated %d outlets: %ld bills from %ld records in %.1f ms (%d threads, %ld steals)\n",
+               count, bills, records, elapsedMs(t0, t1), threads < count ? threads : count, steals);
+        printf("%-10s | %-7s | %-12s | %-10s | %-10s | %-10s | %s\n", "Date", "Orders", "Subtotal", "GST", "Service", "Discounts", "Total");
+        for (int i=0;i<dayCount;i++) {
+            const DayTotals *d = &days[i];
+            char day[RECEIPT_DAY_LEN], a[MONEY_STR_LEN], b[MONEY_STR_LEN], c[MONEY_STR_LEN], e[MONEY_STR_LEN];
+            formatDay(d->day, day);
+            printf("%-10s | %-7d | %-12s | %-10s | %-10s | %-10s | %s\n", day, d->orders, formatMoney(d->subtotal, a),
+                   formatMoney(d->gst, b), formatMoney(d->serviceCharge, c),
+                   formatMoney(d->happyHour + d->discount + d->combo + d->coupon, e), formatMoney(d->total, money));
+            all.orders += d->orders;
+            all.total += d->total;
+        }
+        printf("Total: %d bills, %s\n", all.orders, formatMoney(all.total, money));
+        if (stillOpen) printf("%d orders were still open at the end of their journals and are not counted.\n", stillOpen);
+        printf("Global KOTs written to %s.kots, daily totals to %s.days\n", outPrefix, outPrefix);
+    }
+    free(days);
+    for (int i=0;i<count;i++) resetConsolidationTask(&tasks[i]);
+    free(tasks);
+    return ret;
+}
+
+
+static int compareKotEntries(const void *a, const void *b) {
+    const KotIndexEntry *x = a, *y = b;
+    return (x->orderId > y->orderId) - (x->orderId < y->orderId);
+}
+
+/* Collects KOTs shard by shard, then prints each under its own lock in KOT (= creation) order. */
+void listActiveOrders(FILE *out) {
+    fprintf(out, "\nActive Orders:\n");
+    fprintf(out, "KOT   | Type     | Table | Items | Time\n");
+    fprintf(out, "----------------------------------------------\n");
+    int cap = activeOrderCount + KOT_SHARDS, n = 0;
+    KotIndexEntry *rows = malloc(sizeof(KotIndexEntry) * (size_t)cap);
+    if (!rows) return;
+    for (int k=0;k<KOT_SHARDS;k++) {
+        KotShard *s = &kotShards[k];
+        pthread_mutex_lock(&s->lock);
+        for (int i=s->activeHead;i!=-1;i=orderAt(i)->nextActive) {
+            if (n == cap) {
+                KotIndexEntry *more = realloc(rows, sizeof(KotIndexEntry) * (size_t)cap * 2);
+                if (!more) break;
+                rows = more;
+                cap *= 2;
+            }
+            rows[n].orderId = orderAt(i)->orderId;
+            rows[n].orderIdx = i;
+            n++;
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    qsort(rows, (size_t)n, sizeof(KotIndexEntry), compareKotEntries);
+    for (int k=0;k<n;k++) {
+        if (lockOrderById(rows[k].orderId) != rows[k].orderIdx) continue;
+        Order *o = orderAt(rows[k].orderIdx);
+        char when[32];
+        fprintf(out, "%-5d | %-8s | %-5d | %-5d | %s",
+               o->orderId,
+               o->dineIn ? "Dine-In" : "Takeaway",
+               o->tableNumber,
+               o->itemCount,
+               ctime_r(&o->timestamp, when));
+        unlockOrder(rows[k].orderIdx);
+    }
+    free(rows);
+}
+
+
+int findOrderIndexById(int orderId) {
+    if (orderId == 0) return -1;
+    KotShard *s = kotShardFor(orderId);
+    int idx = -1;
+    pthread_mutex_lock(&s->lock);
+    if (s->indexSize > 0) {
+        unsigned h = kotHashSlot(orderId, s->indexSize);
+        while (s->index[h].orderId != 0) {
+            if (s->index[h].orderId == orderId) { idx = s->index[h].orderIdx; break; }
+            h = (h+1) & (unsigned)(s->indexSize-1);
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return idx;
+}
+
+
+void showTableStatus(FILE *out) {
+    int occupied = 0;
+    for (int w=0;w<=(floorTableCount-1)>>6;w++) occupied += __builtin_popcountll(atomic_load(&floorOccupied[w]));
+    fprintf(out, "\nTable Status: %d of %d tables occupied\n", occupied, floorTableCount);
+    for (int k=0;k<floorSectionCount;k++) {
+        const FloorSection *s = &floorSections[k];
+        int last = s->firstTable + s->tableCount - 1, used = 0;
+        for (int w=(s->firstTable-1)>>6;w<=(last-1)>>6;w++) {
+            used += __builtin_popcountll(atomic_load(&floorOccupied[w]) & floorRangeMask(w, s->firstTable, last));
+        }
+        fprintf(out, "Section %d %-16s tables %d-%d, %d seats: %d/%d occupied\n",
+                k+1, s->name, s->firstTable, last, s->seats, used, s->tableCount);
+    }
+    /* only occupied tables are listed; each party is printed once, at its primary table */
+    for (int w=0;w<=(floorTableCount-1)>>6;w++) {
+        for (uint64_t m=atomic_load(&floorOccupied[w]);m;m&=m-1) {
+            int table = w * 64 + __builtin_ctzll(m) + 1;
+            int oi = tableOrderIndex[table-1];
+            if (oi == -1) continue;
+            Order *o = orderAt(oi);
+            pthread_mutex_lock(orderLock(oi));
+            if (o->active && o->dineIn && o->tableNumber == table) {
+                fprintf(out, "Table %2d: Occupied (KOT %d, items %d", table, o->orderId, o->itemCount);
+                for (int t=tableLink[table-1];t!=0;t=tableLink[t-1]) fprintf(out, t == tableLink[table-1] ? ", with %d" : " %d", t);
+                if (orderColdAt(oi)->paid > 0) {
+                    char amt[MONEY_STR_LEN];
+                    fprintf(out, ", paid %s", formatMoney(orderColdAt(oi)->paid, amt));
+                }
+                fprintf(out, ")\n");
+            }
+            pthread_mutex_unlock(orderLock(oi));
+        }
+    }
+}
+
+
+/* Splits line in place on whitespace; tokens point into line. */
+static int tokenize(char *line, char **tok, int maxTok) {
+    int n = 0;
+    char *p = line;
+    while (*p && n < maxTok) {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') *p++ = '\0';
+        if (!*p) break;
+        tok[n++] = p;
+        while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+    }
+    return n;
+}
+
+static int parseInt(const char *s, int *value) {
+    char *end;
+    long v = strtol(s, &end, 10);
+    if (end == s || *end != '\0' || v < -2147483647L || v > 2147483647L) return -1;
+    *value = (int)v;
+    return 0;
+}
+
+/* Parses "120", "120.5" or "120.50" rupees into paise. */
+static int parseMoney(const char *s, Money *value) {
+    char *end;
+    long long rupees = strtoll(s, &end, 10);
+    if (end == s || rupees < 0) return -1;
+    Money paise = 0;
+    if (*end == '.') {
+        if (end[1] < '0' || end[1] > '9') return -1;
+        paise = (end[1] - '0') * 10;
+        end += 2;
+        if (*end >= '0' && *end <= '9') paise += *end++ - '0';
+    }
+    if (*end != '\0') return -1;
+    *value = RUPEES(rupees) + paise;
+    return 0;
+}
+
+static int parseKitchenStation(const char *s) {
+    for (int i=0;i<KITCHEN_STATIONS;i++) {
+        if (strcasecmp(s, kitchenStationNames[i]) == 0) return i;
+    }
+    int n;
+    return parseInt(s, &n) == 0 && n >= 1 && n <= KITCHEN_STATIONS ? n - 1 : -1;
+}
+
+static int commandIs(const char *tok, const char *name) {
+    for (; *tok && *name; tok++, name++) {
+        char c = *tok;
+        if (c >= 'a' && c <= 'z') c = (char)(c - 'a' + 'A');
+        if (c != *name) return 0;
+    }
+    return *tok == '\0' && *name == '\0';
+}
+
+/* On success the order is locked for the rest of the command; the caller unlocks it. */
+static int lookupActiveOrder(FILE *out, const char *kotTok) {
+    int kot;
+    if (parseInt(kotTok, &kot) != 0) { fprintf(out, "ERR bad KOT\n"); return -1; }
+    int idx = lockOrderById(kot);
+    if (idx == -1) { fprintf(out, "ERR order %d not found\n", kot); return -1; }
+    return idx;
+}
+
+/* Executes one protocol line. Returns 1 when the session should end, 0 otherwise. */
+static int dispatchCommand(char **tok, int n, FILE *out);
+
+int runCommand(char *line, FILE *out) {
+    char *tok[COMMAND_MAX_TOKENS];
+    int n = tokenize(line, tok, COMMAND_MAX_TOKENS);
+    if (n == 0 || tok[0][0] == '#') return 0;
+    commandGateEnter();
+    int quit = dispatchCommand(tok, n, out);
+    commandGateExit();
+    return quit;
+}
+
+static int dispatchCommand(char **tok, int n, FILE *out) {
+
+    if (commandIs(tok[0], "CREATE")) {
+        int dineIn = n >= 2 && commandIs(tok[1], "DINE");
+        int tableNo = 0;
+        int party = n >= 2 && commandIs(tok[1], "PARTY");
+        if (n < 2 || (!dineIn && !party && !commandIs(tok[1], "TAKE"))) {
+            fprintf(out, "ERR usage: CREATE dine <table> | CREATE party <covers> [section] | CREATE take\n");
+            return 0;
+        }
+        if (dineIn && (n < 3 || parseInt(tok[2], &tableNo) != 0)) { fprintf(out, "ERR bad table\n"); return 0; }
+        if (party) {
+            int covers, section = 0;
+            if (n < 3 || parseInt(tok[2], &covers) != 0 || (n >= 4 && parseInt(tok[3], &section) != 0)) {
+                fprintf(out, "ERR usage: CREATE party <covers> [section]\n");
+                return 0;
+            }
+            /* another terminal may seat the table we found first; look again */
+            int idx = -1;
+            while (idx == -1 && (tableNo = findFreeTable(covers, section)) != -1) idx = createOrder(1, tableNo);
+            if (idx == -1) fprintf(out, "ERR no free table for %d\n", covers);
+            else fprintf(out, "OK %d %d\n", orderAt(idx)->orderId, tableNo);
+            return 0;
+        }
+        int idx = createOrder(dineIn, tableNo);
+        if (idx == -1) fprintf(out, "ERR cannot create order\n");
+        else fprintf(out, "OK %d\n", orderAt(idx)->orderId);
+    }
+    else if (commandIs(tok[0], "FREE")) {
+        int covers = 1, section = 0;
+        if ((n >= 2 && parseInt(tok[1], &covers) != 0) || (n >= 3 && parseInt(tok[2], &section) != 0)) {
+            fprintf(out, "ERR usage: FREE [covers] [section]\n");
+            return 0;
+        }
+        int table = findFreeTable(covers, section);
+        if (table == -1) fprintf(out, "ERR no free table for %d\n", covers);
+        else fprintf(out, "OK %d %d\n", table, tableSeats[table-1]);
+    }
+    else if (commandIs(tok[0], "MERGE") || commandIs(tok[0], "SPLIT") || commandIs(tok[0], "MOVE")) {
+        int kot, table;
+        if (n < 3 || parseInt(tok[1], &kot) != 0 || parseInt(tok[2], &table) != 0) {
+            fprintf(out, "ERR usage: %s <kot> <table>\n", tok[0]);
+            return 0;
+        }
+        int ret = commandIs(tok[0], "MERGE") ? mergeTable(kot, table)
+                : commandIs(tok[0], "SPLIT") ? splitTable(kot, table) : moveOrder(kot, table);
+        if (ret == -1) fprintf(out, "ERR cannot %s KOT %d with table %d\n", tok[0], kot, table);
+        else if (ret > 0) fprintf(out, "OK merged %d\n", ret);
+        else fprintf(out, "OK\n");
+    }
+    else if (commandIs(tok[0], "ADD") || commandIs(tok[0], "QTY")) {
+        int qty;
+        if (n < 4 || parseInt(tok[3], &qty) != 0) { fprintf(out, "ERR usage: %s <kot> <code> <qty>\n", tok[0]); return 0; }
+        int idx = lookupActiveOrder(out, tok[1]);
+        if (idx == -1) return 0;
+        int ret = commandIs(tok[0], "ADD") ? addItemToOrder(idx, tok[2], qty) : updateItemQtyInOrder(idx, tok[2], qty);
+        unlockOrder(idx);
+        if (ret == 0) fprintf(out, "OK\n");
+        else if (ret == -2) fprintf(out, "ERR order items full\n");
+        else if (ret == -3) fprintf(out, "ERR out of stock %s\n", tok[2]);
+        else if (ret == -4) fprintf(out, "ERR line already paid %s\n", tok[2]);
+        else fprintf(out, "ERR cannot apply %s %s\n", tok[2], tok[3]);
+    }
+    else if (commandIs(tok[0], "REMOVE")) {
+        if (n < 3) { fprintf(out, "ERR usage: REMOVE <kot> <code>\n"); return 0; }
+        int idx = lookupActiveOrder(out, tok[1]);
+        if (idx == -1) return 0;
+        int ret = removeItemFromOrder(idx, tok[2]);
+        unlockOrder(idx);
+        if (ret == 0) fprintf(out, "OK\n");
+        else if (ret == -4) fprintf(out, "ERR line already paid %s\n", tok[2]);
+        else fprintf(out, "ERR item not found\n");
+    }
+    else if (commandIs(tok[0], "SHOW")) {
+        if (n < 2) { fprintf(out, "ERR usage: SHOW <kot>\n"); return 0; }
+        int idx = lookupActiveOrder(out, tok[1]);
+        if (idx == -1) return 0;
+        printOrderDetails(out, idx);
+        unlockOrder(idx);
+        fprintf(out, "OK\n");
+    }
+    else if (commandIs(tok[0], "BILL")) {
+        if (n < 2) { fprintf(out, "ERR usage: BILL <kot> [coupon]\n"); return 0; }
+        const PricingCoupon *coupon = NULL;
+        if (n >= 3 && (coupon = findCoupon(tok[2])) == NULL) { fprintf(out, "ERR unknown coupon\n"); return 0; }
+        int idx = lookupActiveOrder(out, tok[1]);
+        if (idx == -1) return 0;
+        if (orderAt(idx)->itemCount == 0) { unlockOrder(idx); fprintf(out, "ERR order has no items\n"); return 0; }
+        if (coupon && orderColdAt(idx)->paid > 0) { unlockOrder(idx); fprintf(out, "ERR coupon after part payment\n"); return 0; }
+        printBillWithCoupon(out, idx, coupon);
+        unlockOrder(idx);
+        fprintf(out, "OK\n");
+    }
+    else if (commandIs(tok[0], "PAY")) {
+        int ways = 0;
+        Money amount = 0;
+        int byItems = n >= 4 && commandIs(tok[2], "ITEMS");
+        if (n < 4 || (!byItems && !(commandIs(tok[2], "SHARE") && parseInt(tok[3], &ways) == 0 && ways >= 1)
+                                && !(commandIs(tok[2], "AMOUNT") && parseMoney(tok[3], &amount) == 0 && amount > 0))) {
+            fprintf(out, "ERR usage: PAY <kot> items <code,...> | PAY <kot> share <n> | PAY <kot> amount <rupees>\n");
+            return 0;
+        }
+        int idx = lookupActiveOrder(out, tok[1]);
+        if (idx == -1) return 0;
+        /* codes name the order's lines while it is locked, so the mask cannot shift under the payment */
+        uint64_t lines = 0;
+        for (int k=3;byItems && k<n;k++) {
+            char *save;
+            for (char *code=strtok_r(tok[k], ",", &save);code;code=strtok_r(NULL, ",", &save)) {
+                const Order *o = orderAt(idx);
+                int midx = findMenuIndexByCode(code), i = 0;
+                while (i < o->itemCount && o->items[i].menuIdx != midx) i++;
+                if (midx == -1 || i == o->itemCount) { unlockOrder(idx); fprintf(out, "ERR item not found %s\n", code); return 0; }
+                lines |= 1ull << i;
+            }
+        }
+        Money taken, balance;
+        int ret = payOrder(out, idx, lines, ways, amount, &taken, &balance);
+        unlockOrder(idx);
+        char amt[2][MONEY_STR_LEN];
+        if (ret == 0) fprintf(out, "OK %s %s\n", formatMoney(taken, amt[0]), formatMoney(balance, amt[1]));
+        else if (ret == -4) fprintf(out, "ERR line already paid\n");
+        else fprintf(out, "ERR cannot pay KOT %s\n", tok[1]);
+    }
+    else if (commandIs(tok[0], "TOGGLE")) {
+        int available = n >= 2 ? toggleMenuItem(tok[1], NULL) : -1;
+        if (available == -1) { fprintf(out, "ERR invalid code\n"); return 0; }
+        fprintf(out, "OK %s %s\n", tok[1], available ? "available" : "unavailable");
+    }
+    else if (commandIs(tok[0], "PICKUP")) {
+        int station = n >= 2 ? parseKitchenStation(tok[1]) : -1, max = KITCHEN_PICKUP_MAX;
+        if (station == -1 || (n >= 3 && (parseInt(tok[2], &max) != 0 || max < 1))) {
+            fprintf(out, "ERR usage: PICKUP starters|mains|beverages|desserts [max]\n");
+            return 0;
+        }
+        KitchenTicket batch[KITCHEN_PICKUP_MAX];
+        if (max > KITCHEN_PICKUP_MAX) max = KITCHEN_PICKUP_MAX;
+        int got = kitchenPickup(station, batch, max);
+        uint64_t now = monotonicNs();
+        kitchenRecordPickup(station, batch, got, now);
+        for (int i=0;i<got;i++) {
+            fprintf(out, "TICKET %d %d %.*s %+d %llu\n", batch[i].orderId, batch[i].tableNumber, CODE_LEN, batch[i].code,
+                    batch[i].qtyDelta, (unsigned long long)((now - batch[i].enteredNs) / 1000));
+        }
+        fprintf(out, "OK %d\n", got);
+    }
+    else if (commandIs(tok[0], "METRICS")) {
+#ifdef BILLING_METRICS
+        writeMetrics(out);
+        fprintf(out, "OK\n");
+#else
+        fprintf(out, "ERR metrics not compiled in\n");
+#endif
+    }
+    else if (commandIs(tok[0], "KITCHEN")) { showKitchenStatus(out); fprintf(out, "OK\n"); }
+    else if (commandIs(tok[0], "LIST")) { listActiveOrders(out); fprintf(out, "OK\n"); }
+    else if (commandIs(tok[0], "TABLES")) { showTableStatus(out); fprintf(out, "OK\n"); }
+    else if (commandIs(tok[0], "MENU")) { printMenuAll(out); fprintf(out, "OK\n"); }
+    else if (commandIs(tok[0], "SEARCH")) {
+        if (n < 2) { fprintf(out, "ERR usage: SEARCH <text>\n"); return 0; }
+        char query[COMMAND_LINE_LEN];
+        int len = 0;
+        for (int k=1;k<n;k++) len += snprintf(query + len, sizeof(query) - (size_t)len, k > 1 ? " %s" : "%s", tok[k]);
+        fprintf(out, "OK %d\n", printMenuSearch(out, query));
+    }
+    else if (commandIs(tok[0], "STOCK")) { showStock(out); fprintf(out, "OK\n"); }
+    else if (commandIs(tok[0], "RESTOCK")) {
+        int units;
+        if (n < 3 || parseInt(tok[2], &units) != 0) { fprintf(out, "ERR usage: RESTOCK <code|ingredient> <units>\n"); return 0; }
+        int left = addStock(tok[1], units);
+        if (left == -1) fprintf(out, "ERR cannot restock %s\n", tok[1]);
+        else fprintf(out, "OK %d\n", left);
+    }
+    else if (commandIs(tok[0], "QUIT")) { fprintf(out, "OK bye\n"); return 1; }
+    else fprintf(out, "ERR unknown command %s\n", tok[0]);
+    return 0;
+}
+
+/* Returns the line length, -2 for an over-long (discarded) line, or -1 at end of input. */
+static int readLine(LineReader *r, char *line, int cap) {
+    int len = 0, overflow = 0;
+    while (1) {
+        if (r->start == r->end) {
+            if (r->eof) return (len > 0 || overflow) ? (overflow ? -2 : len) : -1;
+            ssize_t got = read(r->fd, r->buf, sizeof(r->buf));
+            if (got <= 0) { r->eof = 1; continue; }
+            r->start = 0;
+            r->end = (int)got;
+        }
+        char c = r->buf[r->start++];
+        if (c == '\n') break;
+        if (len < cap - 1) line[len++] = c;
+        else overflow = 1;
+    }
+    line[len] = '\0';
+    return overflow ? -2 : len;
+}
+
+int runBatch(FILE *in, FILE *out) {
+    /* one session per thread in server mode; stdout keeps the main thread's buffer until exit */
+    static _Thread_local char outBuf[BATCH_OUTPUT_BUFFER];
+    static _Thread_local LineReader reader;
+    char line[COMMAND_LINE_LEN];
+    reader.fd = fileno(in);
+    reader.start = reader.end = reader.eof = 0;
+    setvbuf(out, outBuf, _IOFBF, sizeof(outBuf));
+    while (1) {
+        /* about to block on input: make everything acknowledged so far durable and visible */
+        if (reader.start == reader.end) {
+            journalSync();
+            fflush(out);
+        }
+        int len = readLine(&reader, line, sizeof(line));
+        if (len == -1) break;
+        if (len == -2) { fprintf(out, "ERR line too long\n"); continue; }
+        int quit = runCommand(line, out);
+        journalCommit();
+        if (quit) break;
+    }
+    journalSync();
+    salesFlush();
+    fflush(out);
+    return 0;
+}
+
+
+/*
+ * Maps a catalog file written by --menu-compile. The records are used in place; a writable
+ * shared mapping lets availability toggles reach the file.
+ */
+MenuCatalog* loadMenuCatalog(const char *path) {
+    int writable = 1;
+    int fd = open(path, O_RDWR);
+    if (fd == -1) { fd = open(path, O_RDONLY); writable = 0; }
+    if (fd == -1) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(MenuFileHeader)) { close(fd); return NULL; }
+    size_t len = (size_t)st.st_size;
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+    const MenuFileHeader *h = map;
+    if (h->magic != MENU_MAGIC || h->version != 1 || h->itemCount > (len - sizeof(*h)) / sizeof(MenuItem)) {
+        munmap(map, len);
+        return NULL;
+    }
+    MenuCatalog *c = buildMenuCatalog((MenuItem*)((char*)map + sizeof(*h)), (int)h->itemCount, map, len);
+    if (!c) munmap(map, len);
+    return c;
+}
+
+static int writeMenuCatalog(const char *path, const MenuItem *items, int count) {
+    char tmp[JOURNAL_PATH_LEN + 8];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return -1;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return -1;
+    MenuFileHeader h = { MENU_MAGIC, 1, (uint32_t)count, 0 };
+    /* rename last, so a watching server only ever maps a complete file */
+    if (writeFully(fd, &h, sizeof(h)) != 0 || writeFully(fd, items, sizeof(MenuItem) * (size_t)count) != 0
+        || fsync(fd) != 0 || close(fd) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* Category names as menu source, pricing and stock files spell them, indexed by Category. */
+static const char *categoryFileNames[] = { NULL, "starter", "main", "beverage", "dessert" };
+
+static int parseCategory(const char *s) {
+    for (int c=STARTER;c<=DESSERT;c++) {
+        if (strcasecmp(s, categoryFileNames[c]) == 0) return c;
+    }
+    return -1;
+}
+
+/* Splits line in place at each '|' into at most max fields (anything after a further '|' is dropped); returns the count. */
+static int splitFields(char *line, char **field, int max) {
+    int n = 0;
+    for (char *p = line; n < max; ) {
+        field[n++] = p;
+        p = strchr(p, '|');
+        if (!p) break;
+        *p++ = '\0';
+    }
+    return n;
+}
+
+/* Source lines are code|name|category|price|available[|outlet]; blank lines and # comments are skipped. */
+int compileMenuCatalog(const char *srcPath, const char *outPath) {
+    FILE *f = fopen(srcPath, "r");
+    if (!f) { printf("Cannot open %s\n", srcPath); return 1; }
+    char line[COMMAND_LINE_LEN];
+    int lineNo = 0, errors = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineNo++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        char *field[6];
+        int n = splitFields(line, field, 6);
+        int cat = n >= 5 ? parseCategory(field[2]) : -1;
+        Money price = 0;
+        int avail = 0, outlet = 0;
+        if (n < 5 || strlen(field[0]) >= CODE_LEN || field[0][0] == '\0' || strlen(field[1]) >= NAME_LEN || cat == -1
+            || parseMoney(field[3], &price) != 0 || parseInt(field[4], &avail) != 0
+            || (n == 6 && (parseInt(field[5], &outlet) != 0 || outlet < 0 || outlet > 65535))) {
+            printf("%s:%d: expected code|name|category|price|available[|outlet]\n", srcPath, lineNo);
+            errors++;
+            continue;
+        }
+        addMenuItem(field[0], field[1], (Category)cat, price, avail);
+        menuDraft[menuDraftCount-1].outlet = (uint16_t)outlet;
+    }
+    fclose(f);
+    int ret = errors ? 1 : writeMenuCatalog(outPath, menuDraft, menuDraftCount) != 0;
+    if (ret == 0) printf("Wrote %d items to %s\n", menuDraftCount, outPath);
+    else if (!errors) printf("Cannot write %s\n", outPath);
+    free(menuDraft);
+    menuDraft = NULL;
+    menuDraftCount = menuDraftCapacity = 0;
+    return ret;
+}
+
+/*
+ * Floor file lines are outlet|section|tables|seats, numbered from table 1 per outlet in file order;
+ * a section with mixed table sizes is listed once per size. Only `outlet` is loaded (0 = the first listed).
+ */
+int loadFloorMap(const char *path, int outlet) {
+    FILE *f = fopen(path, "r");
+    if (!f) { printf("Cannot open %s\n", path); return -1; }
+    char line[COMMAND_LINE_LEN];
+    int lineNo = 0, errors = 0;
+    floorReset();
+    while (fgets(line, sizeof(line), f)) {
+        lineNo++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        char *field[4];
+        int n = splitFields(line, field, 4);
+        int lineOutlet, tables, seats;
+        if (n < 4 || parseInt(field[0], &lineOutlet) != 0 || parseInt(field[2], &tables) != 0 || parseInt(field[3], &seats) != 0) {
+            printf("%s:%d: expected outlet|section|tables|seats\n", path, lineNo);
+            errors++;
+            continue;
+        }
+        if (outlet == 0) outlet = lineOutlet;
+        if (lineOutlet != outlet) continue;
+        if (floorAddSection(lineOutlet, field[1], tables, seats) != 0) {
+            printf("%s:%d: section does not fit (up to %d tables, %d seats each)\n", path, lineNo, MAX_TABLES, FLOOR_MAX_SEATS);
+            errors++;
+        }
+    }
+    fclose(f);
+    if (errors || floorTableCount == 0) {
+        if (!errors) printf("%s has no tables for outlet %d\n", path, outlet);
+        return -1;
+    }
+    return 0;
+}
+
+/* "5", "12.5" or "100" percent as basis points. */
+static int parsePercent(const char *s, int *bp) {
+    Money v;
+    if (parseMoney(s, &v) != 0 || v > RATE_BP_SCALE) return -1;
+    *bp = (int)v;
+    return 0;
+}
+
+/* HH:MM on a quarter hour, 24:00 allowed as the end of the day. */
+static int parseClock(const char *s, int *minute) {
+    int h, m;
+    char extra;
+    if (sscanf(s, "%d:%d%c", &h, &m, &extra) != 2 || h < 0 || m < 0 || m > 59 || h * 60 + m > 24 * 60
+        || m % PRICING_SLOT_MINUTES != 0) return -1;
+    *minute = h * 60 + m;
+    return 0;
+}
+
+/* daily, weekdays, weekends or a list like mon,wed,fri. */
+static int parseDays(char *s, uint8_t *days) {
+    static const char *names[] = { "sun", "mon", "tue", "wed", "thu", "fri", "sat" };
+    if (strcasecmp(s, "daily") == 0) { *days = 0x7F; return 0; }
+    if (strcasecmp(s, "weekdays") == 0) { *days = 0x3E; return 0; }
+    if (strcasecmp(s, "weekends") == 0) { *days = 0x41; return 0; }
+    *days = 0;
+    for (char *p = s; p; ) {
+        char *next = strchr(p, ',');
+        if (next) *next++ = '\0';
+        int d = 0;
+        while (d < 7 && strcasecmp(p, names[d]) != 0) d++;
+        if (d == 7) return -1;
+        *days |= (uint8_t)(1u << d);
+        p = next;
+    }
+    return 0;
+}
+
+static int parseCombo(char *s, PricingCombo *cb) {
+    memset(cb, 0, sizeof(*cb));
+    for (char *p = s; p; ) {
+        char *next = strchr(p, '+');
+        if (next) *next++ = '\0';
+        int id = internMenuCode(p);
+        if (id == -1) return -1;
+        int j = 0;
+        while (j < cb->itemCount && cb->item[j] != id) j++;
+        if (j == cb->itemCount) {
+            if (j == PRICING_COMBO_ITEMS) return -1;
+            cb->item[cb->itemCount++] = (uint16_t)id;
+        }
+        cb->count[j]++;
+        cb->signature |= 1ull << (id & 63);
+        p = next;
+    }
+    return cb->itemCount >= 1 && (cb->itemCount > 1 || cb->count[0] > 1) ? 0 : -1;
+}
+
+/*
+ * Pricing file lines are outlet|kind|..., where outlet 0 applies everywhere and any other outlet only
+ * under the matching --outlet:
+ *   tax|category or all|pct            service|dine-in pct|takeaway pct     discount|above amount|pct
+ *   happy|days|HH:MM|HH:MM|category or all|pct     combo|S01+B02|saving     coupon|CODE|pct% or amount[|minimum]
+ * The first tax or discount rule replaces every built-in rule of its kind. Compiled once, here.
+ */
+int loadPricingRules(const char *path, int outlet) {
+    static const char *usage[] = {
+        "tax|category|pct", "service|dine-in pct|takeaway pct", "discount|above|pct",
+        "happy|days|HH:MM|HH:MM|category|pct", "combo|code+code|saving", "coupon|code|pct% or amount[|minimum]"
+    };
+    static const char *kinds[] = { "tax", "service", "discount", "happy", "combo", "coupon" };
+    static PricingTable table;
+    FILE *f = fopen(path, "r");
+    if (!f) { printf("Cannot open %s\n", path); return -1; }
+    PricingRules *r = calloc(1, sizeof(*r));
+    if (!r) { fclose(f); printf("Out of memory.\n"); return -1; }
+    for (int c=0;c<CATEGORY_COUNT;c++) r->taxBp[c] = FOOD_CATEGORY_MASK & CATEGORY_BIT(c + STARTER) ? GST_RATE_FOOD_BP : 0;
+    r->serviceBp[1] = SERVICE_RATE_BP;
+    r->tierCount = 2;
+    r->tierAbove[0] = DISCOUNT_TIER1_THRESHOLD;
+    r->tierBp[0] = DISCOUNT_TIER1_RATE_BP;
+    r->tierAbove[1] = DISCOUNT_TIER2_THRESHOLD;
+    r->tierBp[1] = DISCOUNT_TIER2_RATE_BP;
+    int taxSeen = 0, tiersSeen = 0;
+    char line[COMMAND_LINE_LEN];
+    int lineNo = 0, errors = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineNo++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        char *field[7];
+        int n = splitFields(line, field, 7);
+        int lineOutlet, kind = 0;
+        while (n >= 2 && kind < 6 && strcasecmp(field[1], kinds[kind]) != 0) kind++;
+        if (n < 2 || parseInt(field[0], &lineOutlet) != 0 || lineOutlet < 0 || kind == 6) {
+            printf("%s:%d: expected outlet|kind|... (kind is tax, service, discount, happy, combo or coupon)\n", path, lineNo);
+            errors++;
+            continue;
+        }
+        if (lineOutlet != 0 && lineOutlet != outlet) continue;
+        int bp, ok = 0;
+        const char *full = NULL;
+        if (kind == 0 && n == 4) {
+            int cat = strcasecmp(field[2], "all") == 0 ? 0 : parseCategory(field[2]);
+            if (cat != -1 && parsePercent(field[3], &bp) == 0) {
+                if (!taxSeen) memset(r->taxBp, 0, sizeof(r->taxBp));
+                taxSeen = 1;
+                for (int c=0;c<CATEGORY_COUNT;c++) if (cat == 0 || cat == c + STARTER) r->taxBp[c] = bp;
+                ok = 1;
+            }
+        }
+        else if (kind == 1 && n == 4) {
+            ok = parsePercent(field[2], &r->serviceBp[1]) == 0 && parsePercent(field[3], &r->serviceBp[0]) == 0;
+        }
+        else if (kind == 2 && n == 4) {
+            Money above;
+            if (!tiersSeen) r->tierCount = 0;
+            tiersSeen = 1;
+            if (r->tierCount == PRICING_MAX_TIERS) full = "discount tiers";
+            else if (parseMoney(field[2], &above) == 0 && parsePercent(field[3], &bp) == 0) {
+                r->tierAbove[r->tierCount] = above;
+                r->tierBp[r->tierCount++] = bp;
+                ok = 1;
+            }
+        }
+        else if (kind == 3 && n == 7) {
+            PricingHappyRule *h = &r->happy[r->happyCount];
+            int cat = strcasecmp(field[5], "all") == 0 ? 0 : parseCategory(field[5]);
+            if (r->happyCount == PRICING_MAX_HAPPY) full = "happy hours";
+            else if (parseDays(field[2], &h->days) == 0 && parseClock(field[3], &h->fromMinute) == 0
+                     && parseClock(field[4], &h->toMinute) == 0 && h->fromMinute != h->toMinute
+                     && cat != -1 && parsePercent(field[6], &h->rateBp) == 0) {
+                h->category = cat;
+                r->happyCount++;
+                ok = 1;
+            }
+        }
+        else if (kind == 4 && n == 4) {
+            PricingCombo *cb = &r->combos[r->comboCount];
+            if (r->comboCount == PRICING_MAX_COMBOS) full = "combos";
+            else if (parseCombo(field[2], cb) == 0 && parseMoney(field[3], &cb->saving) == 0 && cb->saving > 0) {
+                r->comboCount++;
+                ok = 1;
+            }
+        }
+        else if (kind == 5 && (n == 4 || n == 5)) {
+            PricingCoupon *cp = &r->coupons[r->couponCount];
+            memset(cp, 0, sizeof(*cp));
+            size_t len = strlen(field[3]);
+            int dup = 0;
+            for (int k=0;k<r->couponCount;k++) dup |= strcasecmp(r->coupons[k].code, field[2]) == 0;
+            if (r->couponCount == PRICING_MAX_COUPONS) full = "coupons";
+            else if (dup) full = "coupons with this code";
+            else if (field[2][0] != '\0' && strlen(field[2]) < COUPON_LEN && strchr(field[2], ' ') == NULL
+                     && (len > 1 && field[3][len-1] == '%'
+                         ? (field[3][len-1] = '\0', parsePercent(field[3], &cp->rateBp) == 0 && cp->rateBp > 0)
+                         : parseMoney(field[3], &cp->amount) == 0 && cp->amount > 0)
+                     && (n == 4 || parseMoney(field[4], &cp->minTotal) == 0)) {
+                strcpy(cp->code, field[2]);
+                r->couponCount++;
+                ok = 1;
+            }
+        }
+        if (full) {
+            printf("%s:%d: too many %s\n", path, lineNo, full);
+            errors++;
+        }
+        else if (!ok) {
+            printf("%s:%d: expected outlet|%s\n", path, lineNo, usage[kind]);
+            errors++;
+        }
+    }
+    fclose(f);
+    if (!errors && compilePricing(r, &table) != 0) {
+        printf("%s: overlapping happy hours need more than %d distinct rate sets\n", path, PRICING_MAX_HAPPY);
+        errors++;
+    }
+    free(r);
+    if (errors) return -1;
+    pricing = &table;
+    return 0;
+}
+
+/* Re-deals every count evenly so no terminal's slice runs dry while another's holds units, and re-checks availability. */
+static void* stockReconcilerMain(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&stockLock);
+    while (!stockReconcilerStopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += STOCK_RECONCILE_MS / 1000;
+        deadline.tv_nsec += (STOCK_RECONCILE_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) { deadline.tv_sec++; deadline.tv_nsec -= 1000000000L; }
+        /* woken early only by stockClose */
+        if (pthread_cond_timedwait(&stockReconcilerWake, &stockLock, &deadline) != 0) stockReconcile();
+    }
+    pthread_mutex_unlock(&stockLock);
+    return NULL;
+}
 
-typedef struct {
-    int orderId;                
-    int dineIn;                  
-    int tableNumber;             
-    OrderItem items[MAX_ITEMS_PER_ORDER];
-    int itemCount;
-    time_t timestamp;
-    int active;                  
-} Order;
+void stockClose(void) {
+    if (!stockReconcilerRunning) return;
+    pthread_mutex_lock(&stockLock);
+    stockReconcilerStopping = 1;
+    pthread_cond_signal(&stockReconcilerWake);
+    pthread_mutex_unlock(&stockLock);
+    pthread_join(stockReconcilerThread, NULL);
+    stockReconcilerRunning = 0;
+}
 
-typedef struct {
-    float subtotal;
-    float gst;
-    float serviceCharge;
-    float discount;
-    float total;
-} Bill;
+/*
+ * Stock file lines are outlet|kind|..., where outlet 0 applies everywhere and any other outlet only
+ * under the matching --outlet:
+ *   item|code|portions       ingredient|name|units       recipe|code|ingredient|units per portion
+ * An ingredient is listed before the recipes that use it; items without a line are not counted.
+ */
+int stockOpen(const char *path, int outlet) {
+    static const char *usage[] = { "item|code|portions", "ingredient|name|units", "recipe|code|ingredient|units" };
+    static const char *kinds[] = { "item", "ingredient", "recipe" };
+    FILE *f = fopen(path, "r");
+    if (!f) { printf("Cannot open %s\n", path); return -1; }
+    int64_t *units = calloc(STOCK_MAX, sizeof(int64_t));
+    if (!units) { fclose(f); printf("Out of memory.\n"); return -1; }
+    char line[COMMAND_LINE_LEN];
+    int lineNo = 0, errors = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineNo++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        char *field[5];
+        int n = splitFields(line, field, 5);
+        int lineOutlet, kind = 0;
+        while (n >= 2 && kind < 3 && strcasecmp(field[1], kinds[kind]) != 0) kind++;
+        if (n < 2 || parseInt(field[0], &lineOutlet) != 0 || lineOutlet < 0 || kind == 3) {
+            printf("%s:%d: expected outlet|kind|... (kind is item, ingredient or recipe)\n", path, lineNo);
+            errors++;
+            continue;
+        }
+        if (lineOutlet != 0 && lineOutlet != outlet) continue;
+        int count, id = -1, r = -1, ok = 0;
+        const char *why = NULL;
+        if (kind == 0 && n == 4) {
+            id = findMenuIndexByCode(field[2]);
+            if (id == -1) why = "no such item on the menu";
+            else if (stockFind(field[2]) != -1) why = "item already counted";
+            else if (parseInt(field[3], &count) == 0 && count >= 0 && count <= STOCK_MAX_UNITS) {
+                if ((r = stockAddResource(field[2], id)) == -1 || stockAddUse(id, r, 1) != 0) why = "too many counted items";
+                else units[r] = count;
+                ok = 1;
+            }
+        }
+        else if (kind == 1 && n == 4) {
+            if (stockFind(field[2]) != -1) why = "name already counted";
+            else if (field[2][0] != '\0' && strchr(field[2], ' ') == NULL && strlen(field[2]) < STOCK_NAME_LEN
+                     && parseInt(field[3], &count) == 0 && count >= 0 && count <= STOCK_MAX_UNITS) {
+                if ((r = stockAddResource(field[2], -1)) == -1) why = "too many ingredients";
+                else units[r] = count;
+                ok = 1;
+            }
+        }
+        else if (kind == 2 && n == 5) {
+            id = findMenuIndexByCode(field[2]);
+            r = stockFind(field[3]);
+            if (id == -1) why = "no such item on the menu";
+            else if (r == -1 || stockResources[r].menuId != -1) why = "no such ingredient (list it first)";
+            else if (parseInt(field[4], &count) == 0 && count > 0 && count <= STOCK_MAX_UNITS) {
+                if (stockAddUse(id, r, count) != 0) why = "too many ingredients for this item";
+                ok = 1;
+            }
+        }
+        if (why) {
+            printf("%s:%d: %s\n", path, lineNo, why);
+            errors++;
+        }
+        else if (!ok) {
+            printf("%s:%d: expected outlet|%s\n", path, lineNo, usage[kind]);
+            errors++;
+        }
+    }
+    fclose(f);
+    if (!errors) stockInstall(units);
+    free(units);
+    if (errors) return -1;
+    if (pthread_create(&stockReconcilerThread, NULL, stockReconcilerMain, NULL) == 0) stockReconcilerRunning = 1;
+    return 0;
+}
 
+int exportMenuSource(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) { printf("Cannot open %s\n", path); return 1; }
+    const MenuCatalog *menu = menuPin();
+    fprintf(f, "# code|name|category|price|available|outlet\n");
+    for (int i=0;i<menu->itemCount;i++) {
+        const MenuItem *mi = &menu->items[i];
+        if (!menuItemUsable(mi)) continue;
+        char price[MONEY_STR_LEN];
+        fprintf(f, "%s|%s|%s|%s|%d|%d\n", mi->code, mi->name, categoryFileNames[mi->category],
+                formatMoney(mi->price, price), (int)mi->available, (int)mi->outlet);
+    }
+    menuUnpin();
+    return fclose(f) == 0 ? 0 : 1;
+}
 
-static MenuItem menuList[MAX_MENU];
-static int menuCount = 0;
-static Order orders[MAX_ORDERS];
-static int orderCount = 0;
-static int nextOrderId = 9001;
-static int tableOrderIndex[MAX_TABLES]; 
+/* Polls the catalog file and hot-swaps a replaced one; bills in flight keep the version they pinned. */
+static void* menuWatcherMain(void *arg) {
+    (void)arg;
+    struct timespec pause = { MENU_POLL_MS / 1000, (MENU_POLL_MS % 1000) * 1000000L };
+    while (!menuWatcherStopping) {
+        nanosleep(&pause, NULL);
+        struct stat st;
+        if (stat(menuPath, &st) != 0) continue;
+        if (st.st_ino == menuFileStat.st_ino && st.st_size == menuFileStat.st_size
+            && st.st_mtime == menuFileStat.st_mtime) continue;
+        menuFileStat = st;
+        MenuCatalog *c = loadMenuCatalog(menuPath);
+        if (!c) {
+            fprintf(stderr, "Menu %s is not a valid catalog; keeping the current menu.\n", menuPath);
+            continue;
+        }
+        publishMenu(c);
+        fprintf(stderr, "Menu reloaded from %s (version %" PRIu64 ", %d records).\n", menuPath, c->version, c->itemCount);
+    }
+    return NULL;
+}
 
-void initMenu(void);
-void printMenuAll(void);
-void printMenuByCategory(Category c);
-int findMenuIndexByCode(const char* code);
-int createOrder(int dineIn, int tableNumber);
-int addItemToOrder(int orderIdx, const char* code, int qty);
-int removeItemFromOrder(int orderIdx, const char* code);
-int updateItemQtyInOrder(int orderIdx, const char* code, int newQty);
-Bill calculateBill(int orderIdx);
-void printBill(int orderIdx);
-void saveReceiptToFile(int orderIdx, Bill b);
-void listActiveOrders(void);
-int findOrderIndexById(int orderId);
-void showTableStatus(void);
-void clearInputBuffer(void);
+int menuOpen(const char *path) {
+    if (strlen(path) >= sizeof(menuPath)) return -1;
+    strcpy(menuPath, path);
+    if (stat(path, &menuFileStat) != 0) return -1;
+    MenuCatalog *c = loadMenuCatalog(path);
+    if (!c) return -1;
+    publishMenu(c);
+    if (pthread_create(&menuWatcherThread, NULL, menuWatcherMain, NULL) == 0) menuWatcherRunning = 1;
+    return 0;
+}
 
+void menuClose(void) {
+    if (!menuWatcherRunning) return;
+    menuWatcherStopping = 1;
+    pthread_join(menuWatcherThread, NULL);
+    menuWatcherRunning = 0;
+}
 
 
-void clearInputBuffer(void) {
-    int c;
-    while ((c = getchar()) != '\n' && c != EOF) { }
+static double elapsedMs(struct timespec a, struct timespec b) {
+    return (double)(b.tv_sec - a.tv_sec) * 1e3 + (double)(b.tv_nsec - a.tv_nsec) / 1e6;
 }
 
-void addMenuItem(const char* code, const char* name, Category cat, float price, int avail) {
-    if (menuCount >= MAX_MENU) return;
-    strncpy(menuList[menuCount].code, code, CODE_LEN-1);
-    menuList[menuCount].code[CODE_LEN-1] = '\0';
-    strncpy(menuList[menuCount].name, name, NAME_LEN-1);
-    menuList[menuCount].name[NAME_LEN-1] = '\0';
-    menuList[menuCount].category = cat;
-    menuList[menuCount].price = price;
-    menuList[menuCount].available = avail ? 1 : 0;
-    menuCount++;
+static int runBatchBillingBenchmark(void) {
+    static const int sizes[] = { 10000, 1000000 };
+    const MenuCatalog *menu = menuPin();
+    printf("Batch billing benchmark (%d menu items, 1-8 lines per order, half dine-in)\n", menu->itemCount);
+    printf("%-9s | %-12s | %-10s | %-10s | %-12s | %-14s | %s\n", "Orders", "Per-order ms", "Gather ms", "Compute ms",
+           "vs compute", "vs gather+comp", "Mismatches");
+    srand(42);
+    for (size_t s=0;s<sizeof(sizes)/sizeof(sizes[0]);s++) {
+        int n = sizes[s];
+        int *idxs = malloc(sizeof(int) * (size_t)n);
+        Bill *single = malloc(sizeof(Bill) * (size_t)n);
+        Bill *batch = malloc(sizeof(Bill) * (size_t)n);
+        if (!idxs || !single || !batch) { printf("Out of memory.\n"); return 1; }
+        for (int k=0;k<n;k++) {
+            idxs[k] = createOrder(0, 0);
+            if (idxs[k] == -1) { printf("Failed to create order.\n"); return 1; }
+            /* tables cap real dine-in orders; flag half of them so service charge is exercised */
+            orderAt(idxs[k])->dineIn = k & 1;
+            int lines = 1 + rand() % 8;
+            for (int i=0;i<lines;i++) {
+                addItemToOrder(idxs[k], menu->items[rand() % menu->itemCount].code, 1 + rand() % 4);
+            }
+        }
+        BillingColumns cols = {0};
+        double ms1 = 0, msBuild = 0, msCompute = 0;
+        /* the first round only faults in the output and column pages; report the best of the rest */
+        for (int round=0;round<=BENCH_ROUNDS;round++) {
+            struct timespec t0, t1, t2, t3;
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            for (int k=0;k<n;k++) single[k] = calculateBill(idxs[k]);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            buildBillingColumns(&cols, idxs, n);
+            clock_gettime(CLOCK_MONOTONIC, &t2);
+            computeBillsBatch(&cols, batch);
+            clock_gettime(CLOCK_MONOTONIC, &t3);
+            if (round == 1 || (round > 1 && elapsedMs(t0, t1) < ms1)) ms1 = elapsedMs(t0, t1);
+            if (round == 1 || (round > 1 && elapsedMs(t1, t2) < msBuild)) msBuild = elapsedMs(t1, t2);
+            if (round == 1 || (round > 1 && elapsedMs(t2, t3) < msCompute)) msCompute = elapsedMs(t2, t3);
+        }
+        freeBillingColumns(&cols);
+        int mismatches = 0;
+        for (int k=0;k<n;k++) {
+            if (memcmp(&single[k], &batch[k], sizeof(Bill)) != 0) mismatches++;
+        }
+        printf("%-9d | %12.2f | %10.2f | %10.2f | %11.2fx | %13.2fx | %d\n", n, ms1, msBuild, msCompute,
+               msCompute > 0 ? ms1 / msCompute : 0.0,
+               msBuild + msCompute > 0 ? ms1 / (msBuild + msCompute) : 0.0, mismatches);
+        for (int k=0;k<n;k++) {
+            orderAt(idxs[k])->dineIn = 0;
+            closeOrder(idxs[k]);
+        }
+        free(idxs);
+        free(single);
+        free(batch);
+    }
+    menuUnpin();
+    return 0;
 }
 
-void initMenu(void) {
-    
-    addMenuItem("S01","Garlic Bread", STARTER, 120.00f, 1);
-    addMenuItem("S02","Veg Spring Roll", STARTER, 140.00f, 1);
-    addMenuItem("S03","Chicken Tikka", STARTER, 260.00f, 1);
-    addMenuItem("S04","Paneer Tikka", STARTER, 220.00f, 1);
-    addMenuItem("S05","French Fries", STARTER, 130.00f, 1);
-    addMenuItem("S06","Chicken Wings", STARTER, 290.00f, 1);
-    addMenuItem("S07","Masala Papad", STARTER, 60.00f, 1);
-
-    addMenuItem("M01","Butter Chicken", MAIN_COURSE, 320.00f, 1);
-    addMenuItem("M02","Paneer Butter Masala", MAIN_COURSE, 300.00f, 1);
-    addMenuItem("M03","Hyderabadi Chicken Biryani", MAIN_COURSE, 280.00f, 1);
-    addMenuItem("M04","Veg Biryani", MAIN_COURSE, 240.00f, 1);
-    addMenuItem("M05","Margherita Pizza", MAIN_COURSE, 350.00f, 1);
-    addMenuItem("M06","Farmhouse Pizza", MAIN_COURSE, 420.00f, 1);
-    addMenuItem("M07","Grilled Fish", MAIN_COURSE, 380.00f, 1);
-    addMenuItem("M08","Chicken Fried Rice", MAIN_COURSE, 220.00f, 1);
-    addMenuItem("M09","Mixed Veg Curry + Roti", MAIN_COURSE, 180.00f, 1);
-
-    addMenuItem("B01","Masala Chai", BEVERAGE, 40.00f, 1);
-    addMenuItem("B02","Cold Coffee", BEVERAGE, 120.00f, 1);
-    addMenuItem("B03","Mango Lassi", BEVERAGE, 110.00f, 1);
-    addMenuItem("B04","Soft Drink (500ml)", BEVERAGE, 80.00f, 1);
-    addMenuItem("B05","Lemonade", BEVERAGE, 85.00f, 1);
-    addMenuItem("B06","Mineral Water (1L)", BEVERAGE, 50.00f, 1);
-
-    addMenuItem("D01","Gulab Jamun (2 pcs)", DESSERT, 90.00f, 1);
-    addMenuItem("D02","Brownie with Ice Cream", DESSERT, 210.00f, 1);
-    addMenuItem("D03","Rasmalai (2 pcs)", DESSERT, 130.00f, 1);
-    addMenuItem("D04","Fruit Salad", DESSERT, 150.00f, 1);
-    addMenuItem("D05","Kulfi", DESSERT, 110.00f, 1);
-    addMenuItem("D06","Ice Cream Scoop", DESSERT, 70.00f, 1);
-    addMenuItem("D07","Jalebi (2 pcs)", DESSERT, 95.00f, 1);
 
-    
-    for (int i=0;i<MAX_TABLES;i++) tableOrderIndex[i] = -1;
+/* calculateBill as it was before the pricing engine: the built-in rates written out as constants. */
+static Bill hardcodedBill(const Order *o) {
+    Bill b;
+    memset(&b, 0, sizeof(b));
+    b.subtotal = orderSubtotal(o);
+    Money foodSubtotal = b.subtotal - o->categorySubtotal[BEVERAGE - STARTER];
+    b.gst = applyRateBp(foodSubtotal, GST_RATE_FOOD_BP);
+    b.serviceCharge = o->dineIn ? applyRateBp(b.subtotal, SERVICE_RATE_BP) : 0;
+    Money temp = b.subtotal + b.gst + b.serviceCharge;
+    b.discountBp = temp > DISCOUNT_TIER2_THRESHOLD ? DISCOUNT_TIER2_RATE_BP : temp > DISCOUNT_TIER1_THRESHOLD ? DISCOUNT_TIER1_RATE_BP : 0;
+    b.discount = applyRateBp(temp, b.discountBp);
+    b.total = temp - b.discount;
+    return b;
 }
 
-
-void printMenuAll(void) {
-    printf("\n========== MENU ==========\n");
-    printf("Starters:\n");
-    printMenuByCategory(STARTER);
-    printf("\nMain Course:\n");
-    printMenuByCategory(MAIN_COURSE);
-    printf("\nBeverages:\n");
-    printMenuByCategory(BEVERAGE);
-    printf("\nDesserts:\n");
-    printMenuByCategory(DESSERT);
-    printf("==========================\n");
+/* A busy outlet's worth of rules: a tax rate per category, 100 tiers, 50 happy hours, 100 combos, 50 coupons. */
+static int buildBenchPricing(PricingTable *t, const MenuCatalog *menu) {
+    PricingRules *r = calloc(1, sizeof(*r));
+    if (!r) return -1;
+    for (int c=0;c<CATEGORY_COUNT;c++) r->taxBp[c] = 500 + 300 * c;
+    r->serviceBp[1] = SERVICE_RATE_BP;
+    r->serviceBp[0] = 250;
+    for (int i=0;i<100;i++) {
+        r->tierAbove[i] = RUPEES(500 + 50 * (99 - i));
+        r->tierBp[i] = 10 * (99 - i);
+    }
+    r->tierCount = 100;
+    for (int i=0;i<50;i++) {
+        PricingHappyRule h = { (uint8_t)(1u << (i % 7) | 1u << ((i + 3) % 7)), (i % 24) * 60, ((i + 3) % 24) * 60 + 30,
+                               i % (CATEGORY_COUNT + 1), 500 + 100 * (i % 20) };
+        r->happy[r->happyCount++] = h;
+    }
+    for (int i=0;i<100;i++) {
+        PricingCombo *cb = &r->combos[r->comboCount++];
+        for (int j=0;j<2 + i % 2;j++) {
+            int id = findMenuIndexByCode(menu->items[(i * 7 + j * 13) % menu->itemCount].code);
+            int k = 0;
+            while (k < cb->itemCount && cb->item[k] != id) k++;
+            if (k == cb->itemCount) cb->item[cb->itemCount++] = (uint16_t)id;
+            cb->count[k]++;
+            cb->signature |= 1ull << (id & 63);
+        }
+        cb->saving = RUPEES(20 + i % 30);
+    }
+    for (int i=0;i<50;i++) {
+        PricingCoupon *cp = &r->coupons[r->couponCount++];
+        snprintf(cp->code, sizeof(cp->code), "BENCH%02d", i);
+        cp->rateBp = i % 2 ? 500 + 50 * i : 0;
+        cp->amount = RUPEES(25 + i);
+        cp->minTotal = RUPEES(100 * (i % 5));
+    }
+    int ret = compilePricing(r, t);
+    free(r);
+    return ret;
 }
 
-void printMenuByCategory(Category c) {
-    printf("Code  | %-20s | Price  | Avail\n", "Name");
-    printf("-----------------------------------------------\n");
-    for (int i=0;i<menuCount;i++) {
-        if (menuList[i].category == c) {
-            printf("%-5s | %-20s | %6.2f | %s\n",
-                   menuList[i].code,
-                   menuList[i].name,
-                   menuList[i].price,
-                   menuList[i].available ? "Yes" : "No");
+/*
+ * Prices the same orders three ways: the old constants, the engine on the built-in table (which
+ * must agree exactly) and the engine on a few hundred rules with a coupon on every bill.
+ */
+static int runPricingBenchmark(void) {
+    const int n = PRICING_BENCH_ORDERS;
+    const MenuCatalog *menu = menuPin();
+    static PricingTable rules;
+    if (buildBenchPricing(&rules, menu) != 0) { printf("Out of memory.\n"); return 1; }
+    int *idxs = malloc(sizeof(int) * (size_t)n);
+    Bill *bills[4];
+    for (int v=0;v<4;v++) bills[v] = malloc(sizeof(Bill) * (size_t)n);
+    if (!idxs || !bills[0] || !bills[1] || !bills[2] || !bills[3]) { printf("Out of memory.\n"); return 1; }
+    srand(42);
+    for (int k=0;k<n;k++) {
+        idxs[k] = createOrder(0, 0);
+        if (idxs[k] == -1) { printf("Failed to create order.\n"); return 1; }
+        Order *o = orderAt(idxs[k]);
+        o->dineIn = k & 1;
+        /* spread over a week so every happy-hour window is hit */
+        o->timestamp -= (time_t)(k % PRICING_WEEK_SLOTS) * PRICING_SLOT_MINUTES * 60;
+        int lines = 1 + rand() % 8;
+        for (int i=0;i<lines;i++) addItemToOrder(idxs[k], menu->items[rand() % menu->itemCount].code, 1 + rand() % 4);
+    }
+    menuUnpin();
+    static const char *names[] = { "Hardcoded", "Built-in table", "300 rules + coupon", "300 rules, 2 parts" };
+    double best[4] = { 0, 0, 0, 0 };
+    Money drift = 0;
+    for (int round=0;round<=BENCH_ROUNDS;round++) {
+        for (int v=0;v<4;v++) {
+            struct timespec t0, t1;
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            for (int k=0;k<n;k++) {
+                const Order *o = orderAt(idxs[k]);
+                if (v == 3) {
+                    /* the whole bill, then the even and odd lines as two guests' parts of it */
+                    Bill whole = priceOrder(&rules, o, NULL);
+                    uint64_t even = 0x5555555555555555ull & ((1ull << o->itemCount) - 1);
+                    bills[3][k] = priceLines(&rules, o, &whole, even);
+                    bills[3][k].total += priceLines(&rules, o, &whole, ~even & ((1ull << o->itemCount) - 1)).total;
+                    Money d = bills[3][k].total - whole.total;
+                    if (d < 0) d = -d;
+                    if (d > drift) drift = d;
+                    continue;
+                }
+                bills[v][k] = v == 0 ? hardcodedBill(o) : v == 1 ? priceOrder(&pricingBuiltin, o, NULL)
+                            : priceOrder(&rules, o, &rules.coupons[k % rules.couponCount]);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            double ms = elapsedMs(t0, t1);
+            if (round == 1 || (round > 1 && ms < best[v])) best[v] = ms;
         }
     }
+    int mismatches = 0;
+    Money totals[4] = { 0, 0, 0, 0 };
+    for (int k=0;k<n;k++) {
+        if (memcmp(&bills[0][k], &bills[1][k], sizeof(Bill)) != 0) mismatches++;
+        for (int v=0;v<4;v++) totals[v] += bills[v][k].total;
+    }
+    printf("Pricing benchmark (%d orders, 1-8 lines each, half dine-in; %d happy-hour rate sets compiled)\n",
+           n, rules.happyCount);
+    printf("%-20s | %-10s | %-8s | %s\n", "Pricing", "ms", "ns/bill", "Sum of totals");
+    for (int v=0;v<4;v++) {
+        char amt[MONEY_STR_LEN];
+        printf("%-20s | %10.2f | %8.1f | %s\n", names[v], best[v], best[v] * 1e6 / n, formatMoney(totals[v], amt));
+    }
+    printf("Built-in table vs hardcoded mismatches: %d\n", mismatches);
+    printf("Two parts vs the whole bill: at most %" PRId64 " paise apart (the last payment settles the rest)\n", drift);
+    for (int k=0;k<n;k++) {
+        orderAt(idxs[k])->dineIn = 0;
+        closeOrder(idxs[k]);
+    }
+    free(idxs);
+    for (int v=0;v<4;v++) free(bills[v]);
+    return mismatches != 0;
 }
 
 
-int findMenuIndexByCode(const char* code) {
-    for (int i=0;i<menuCount;i++) {
-        if (strcmp(menuList[i].code, code) == 0) return i;
+static int runRenderBenchmark(void) {
+    static char receipt[RECEIPT_BUF_LEN];
+    const int iterations = 200000;
+    int idx = createOrder(1, 1);
+    if (idx == -1) { printf("Failed to create order.\n"); return 1; }
+    const MenuCatalog *menu = menuPin();
+    for (int i=0;i<8 && i<menu->itemCount;i++) addItemToOrder(idx, menu->items[i*3 % menu->itemCount].code, 1 + i % 3);
+    menuUnpin();
+    Order *o = orderAt(idx);
+    Bill b = calculateBill(idx);
+    size_t checksum = 0;
+    double best = 0;
+    for (int round=0;round<=BENCH_ROUNDS;round++) {
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int i=0;i<iterations;i++) {
+            checksum += (size_t)renderReceipt(receipt, sizeof(receipt), o, b);
+            checksum += (unsigned char)receipt[i & 63];
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double ms = elapsedMs(t0, t1);
+        if (round == 1 || (round > 1 && ms < best)) best = ms;
     }
-    return -1;
+    int len = renderReceipt(receipt, sizeof(receipt), o, b);
+    printf("Receipt render benchmark (%d lines, %d bytes per receipt)\n", o->itemCount, len);
+    printf("%d receipts: %.2f ms, %.0f ns per receipt (checksum %zu)\n",
+           iterations, best, best * 1e6 / iterations, checksum);
+    closeOrder(idx);
+    return 0;
 }
 
+/* The order layout before lines were packed and the hot fields split out, kept as the baseline for --bench-scan. */
+typedef struct {
+    int menuIdx;
+    int qty;
+    Money unitPrice;
+    int category;
+} LegacyOrderItem;
 
-int createOrder(int dineIn, int tableNumber) {
-    if (orderCount >= MAX_ORDERS) return -1;
-    if (dineIn) {
-        if (tableNumber < 1 || tableNumber > MAX_TABLES) return -1;
-        if (tableOrderIndex[tableNumber-1] != -1) return -1; 
-    }
-    int idx = orderCount++;
-    orders[idx].orderId = nextOrderId++;
-    orders[idx].dineIn = dineIn ? 1 : 0;
-    orders[idx].tableNumber = dineIn ? tableNumber : 0;
-    orders[idx].itemCount = 0;
-    orders[idx].timestamp = time(NULL);
-    orders[idx].active = 1;
-    if (dineIn) tableOrderIndex[tableNumber-1] = idx;
-    return idx;
-}
+typedef struct {
+    int orderId;
+    int dineIn;
+    int tableNumber;
+    LegacyOrderItem *items;
+    int itemCount;
+    int itemCapacity;
+    Money subtotal;
+    Money foodSubtotal;
+    time_t timestamp;
+    int active;
+    int nextFree;
+    int prevActive;
+    int nextActive;
+    pthread_mutex_t lock;
+} LegacyOrder;
 
+typedef struct {
+    long active;
+    long dineIn;
+    long items;
+    Money subtotal;
+    Money foodSubtotal;
+} ScanTotals;
 
-int addItemToOrder(int orderIdx, const char* code, int qty) {
-    if (qty <= 0) return -1;
-    if (orderIdx < 0 || orderIdx >= orderCount) return -1;
-    if (!orders[orderIdx].active) return -1;
-    int midx = findMenuIndexByCode(code);
-    if (midx == -1) return -1;
-    if (!menuList[midx].available) return -1;
-    
-    for (int i=0;i<orders[orderIdx].itemCount;i++) {
-        if (strcmp(orders[orderIdx].items[i].code, code) == 0) {
-            orders[orderIdx].items[i].qty += qty;
-            return 0;
+/* What LIST and TABLES read per order: the flags, table, line count and running totals. */
+static ScanTotals scanLegacyOrders(const LegacyOrder *orders, int n) {
+    ScanTotals t = {0};
+    for (int k=0;k<n;k++) {
+        const LegacyOrder *o = &orders[k];
+        if (!o->active) continue;
+        t.active++;
+        t.dineIn += o->dineIn && o->tableNumber > 0;
+        t.items += o->itemCount;
+        t.subtotal += o->subtotal;
+    }
+    return t;
+}
+
+static ScanTotals scanOrders(int n) {
+    ScanTotals t = {0};
+    for (int sl=0;sl*ORDER_SLAB_SIZE<n;sl++) {
+        const Order *slab = orderSlabs[sl];
+        int end = n - sl * ORDER_SLAB_SIZE < ORDER_SLAB_SIZE ? n - sl * ORDER_SLAB_SIZE : ORDER_SLAB_SIZE;
+        for (int k=0;k<end;k++) {
+            const Order *o = &slab[k];
+            if (!o->active) continue;
+            t.active++;
+            t.dineIn += o->dineIn && o->tableNumber > 0;
+            t.items += o->itemCount;
+            t.subtotal += orderSubtotal(o);
         }
     }
-    if (orders[orderIdx].itemCount >= MAX_ITEMS_PER_ORDER) return -2;
-    strncpy(orders[orderIdx].items[orders[orderIdx].itemCount].code, code, CODE_LEN-1);
-    orders[orderIdx].items[orders[orderIdx].itemCount].code[CODE_LEN-1] = '\0';
-    orders[orderIdx].items[orders[orderIdx].itemCount].qty = qty;
-    orders[orderIdx].itemCount++;
-    return 0;
+    return t;
 }
 
+/* What billing reads: every line of every order, priced from scratch. */
+static ScanTotals scanLegacyLines(const LegacyOrder *orders, int n) {
+    ScanTotals t = {0};
+    for (int k=0;k<n;k++) {
+        const LegacyOrder *o = &orders[k];
+        for (int i=0;i<o->itemCount;i++) {
+            Money line = o->items[i].unitPrice * o->items[i].qty;
+            t.subtotal += line;
+            if (o->items[i].category != BEVERAGE) t.foodSubtotal += line;
+        }
+        t.items += o->itemCount;
+    }
+    return t;
+}
 
-int removeItemFromOrder(int orderIdx, const char* code) {
-    if (orderIdx < 0 || orderIdx >= orderCount) return -1;
-    if (!orders[orderIdx].active) return -1;
-    for (int i=0;i<orders[orderIdx].itemCount;i++) {
-        if (strcmp(orders[orderIdx].items[i].code, code) == 0) {
-            
-            for (int j=i;j<orders[orderIdx].itemCount-1;j++) {
-                orders[orderIdx].items[j] = orders[orderIdx].items[j+1];
+static ScanTotals scanLines(int n) {
+    ScanTotals t = {0};
+    for (int sl=0;sl*ORDER_SLAB_SIZE<n;sl++) {
+        const Order *slab = orderSlabs[sl];
+        int end = n - sl * ORDER_SLAB_SIZE < ORDER_SLAB_SIZE ? n - sl * ORDER_SLAB_SIZE : ORDER_SLAB_SIZE;
+        for (int k=0;k<end;k++) {
+            const Order *o = &slab[k];
+            for (int i=0;i<o->itemCount;i++) {
+                Money line = lineAmount(&o->items[i]);
+                t.subtotal += line;
+                if (o->items[i].category != BEVERAGE) t.foodSubtotal += line;
             }
-            orders[orderIdx].itemCount--;
-            return 0;
+            t.items += o->itemCount;
         }
     }
-    return -1;
+    return t;
 }
 
-
-int updateItemQtyInOrder(int orderIdx, const char* code, int newQty) {
-    if (orderIdx < 0 || orderIdx >= orderCount) return -1;
-    if (!orders[orderIdx].active) return -1;
-    for (int i=0;i<orders[orderIdx].itemCount;i++) {
-        if (strcmp(orders[orderIdx].items[i].code, code) == 0) {
-            if (newQty <= 0) {
-                return removeItemFromOrder(orderIdx, code);
-            } else {
-                orders[orderIdx].items[i].qty = newQty;
-                return 0;
+/*
+ * Builds the same orders in both layouts and times the order scan and the line scan over the
+ * first n slots: a few thousand orders (one busy outlet, cache resident) and a few hundred thousand.
+ */
+static int runScanBenchmark(void) {
+    static const int sizes[] = { 2000, 200000 };
+    const int total = sizes[sizeof(sizes)/sizeof(sizes[0]) - 1];
+    const MenuCatalog *menu = menuPin();
+    LegacyOrder *legacy = calloc((size_t)total, sizeof(LegacyOrder));
+    LegacyOrderItem *legacyLines = calloc((size_t)total * 8, sizeof(LegacyOrderItem));
+    if (!legacy || !legacyLines) { printf("Out of memory.\n"); return 1; }
+    srand(42);
+    for (int k=0;k<total;k++) {
+        int idx = createOrder(0, 0);
+        if (idx != k) { printf("Failed to create order.\n"); return 1; }
+        orderAt(idx)->dineIn = k & 1;
+        orderAt(idx)->tableNumber = (int16_t)(k & 1 ? 1 + k % FLOOR_DEFAULT_TABLES : 0);
+        int lines = 1 + rand() % 8;
+        for (int i=0;i<lines;i++) addItemToOrder(idx, menu->items[rand() % menu->itemCount].code, 1 + rand() % 4);
+        const Order *o = orderAt(idx);
+        LegacyOrder *l = &legacy[k];
+        l->orderId = o->orderId;
+        l->dineIn = o->dineIn;
+        l->tableNumber = o->tableNumber;
+        l->items = &legacyLines[(size_t)k * 8];
+        l->itemCount = l->itemCapacity = o->itemCount;
+        l->subtotal = orderSubtotal(o);
+        l->foodSubtotal = l->subtotal - o->categorySubtotal[BEVERAGE - STARTER];
+        l->timestamp = o->timestamp;
+        l->active = 1;
+        for (int i=0;i<o->itemCount;i++) {
+            LegacyOrderItem li = { o->items[i].menuIdx, o->items[i].qty, o->items[i].unitPrice, o->items[i].category };
+            l->items[i] = li;
+        }
+    }
+    menuUnpin();
+    printf("Order scan benchmark (1-8 lines per order; %zu -> %zu bytes per order, %zu -> %zu bytes per line)\n",
+           sizeof(LegacyOrder), sizeof(Order), sizeof(LegacyOrderItem), sizeof(OrderItem));
+    printf("%-8s | %-6s | %-10s | %-10s | %-8s | %s\n", "Orders", "Scan", "Before ns", "After ns", "Speedup", "Totals match");
+    for (size_t s=0;s<sizeof(sizes)/sizeof(sizes[0]);s++) {
+        int n = sizes[s];
+        for (int kind=0;kind<2;kind++) {
+            double ms[2] = { 0, 0 };
+            ScanTotals r[2];
+            for (int pass=0;pass<2;pass++) {
+                /* many passes over the small set so the timer resolution does not matter */
+                int reps = total / n;
+                for (int round=0;round<=BENCH_ROUNDS;round++) {
+                    struct timespec t0, t1;
+                    clock_gettime(CLOCK_MONOTONIC, &t0);
+                    for (int rep=0;rep<reps;rep++) {
+                        r[pass] = pass == 0 ? (kind == 0 ? scanLegacyOrders(legacy, n) : scanLegacyLines(legacy, n))
+                                            : (kind == 0 ? scanOrders(n) : scanLines(n));
+                        __asm__ __volatile__("" : : "g"(&r[pass]) : "memory");
+                    }
+                    clock_gettime(CLOCK_MONOTONIC, &t1);
+                    double perOrder = elapsedMs(t0, t1) * 1e6 / ((double)reps * n);
+                    if (round == 1 || (round > 1 && perOrder < ms[pass])) ms[pass] = perOrder;
+                }
             }
+            printf("%-8d | %-6s | %10.2f | %10.2f | %7.2fx | %s\n", n, kind == 0 ? "orders" : "lines", ms[0], ms[1],
+                   ms[1] > 0 ? ms[0] / ms[1] : 0.0, memcmp(&r[0], &r[1], sizeof(ScanTotals)) == 0 ? "yes" : "NO");
         }
     }
-    return -1;
+    for (int k=0;k<total;k++) {
+        orderAt(k)->dineIn = 0;
+        closeOrder(k);
+    }
+    free(legacy);
+    free(legacyLines);
+    return 0;
 }
 
 
-Bill calculateBill(int orderIdx) {
-    Bill b = {0.0f,0.0f,0.0f,0.0f,0.0f};
-    if (orderIdx < 0 || orderIdx >= orderCount) return b;
-    Order *o = &orders[orderIdx];
-    float foodSubtotal = 0.0f;
-    for (int i=0;i<o->itemCount;i++) {
-        int m = findMenuIndexByCode(o->items[i].code);
-        if (m == -1) continue;
-        float line = menuList[m].price * (float)o->items[i].qty; 
-        b.subtotal += line;
-        if (menuList[m].category != BEVERAGE) foodSubtotal += line;
-    }
-    b.gst = foodSubtotal * GST_RATE_FOOD;
-    b.serviceCharge = o->dineIn ? (b.subtotal * SERVICE_RATE) : 0.0f;
-    float temp = b.subtotal + b.gst + b.serviceCharge;
-    if (temp > DISCOUNT_TIER2_THRESHOLD) b.discount = temp * DISCOUNT_TIER2_RATE;
-    else if (temp > DISCOUNT_TIER1_THRESHOLD) b.discount = temp * DISCOUNT_TIER1_RATE;
-    else b.discount = 0.0f;
-    b.total = temp - b.discount;
-    return b;
+/* Compiles a large generated menu, then times mapping it, code lookups and a reload + swap. */
+static int runMenuBenchmark(void) {
+    const int items = 50000, lookups = 2000000, searches = 200000;
+    char src[] = "menu_bench.txt", cat[] = "menu_bench.cat";
+    FILE *f = fopen(src, "w");
+    if (!f) { printf("Cannot write %s\n", src); return 1; }
+    for (int i=0;i<items;i++) {
+        fprintf(f, "X%04X|Bench Item %d|%s|%d.%02d|1|%d\n", i, i, categoryFileNames[1 + i % 4], 40 + i % 400, i % 100, i % 8);
+    }
+    fclose(f);
+    struct timespec t0, t1, t2, t3, t4;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int ret = compileMenuCatalog(src, cat);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    MenuCatalog *c = ret == 0 ? loadMenuCatalog(cat) : NULL;
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+    unlink(src);
+    if (!c) { unlink(cat); printf("Menu benchmark failed.\n"); return 1; }
+    publishMenu(c);
+    static char codes[4096][CODE_LEN];
+    for (int i=0;i<4096;i++) snprintf(codes[i], CODE_LEN, "X%04X", (unsigned)i * 7919u % (unsigned)items);
+    const MenuCatalog *menu = menuPin();
+    Money sum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t3);
+    for (int i=0;i<lookups;i++) {
+        const MenuItem *mi = menuItemById(menu, findMenuIndexByCode(codes[i & 4095]));
+        if (mi) sum += mi->price;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t4);
+    static char queries[4096][16];
+    for (int i=0;i<4096;i++) {
+        unsigned k = (unsigned)i * 7919u % (unsigned)items;
+        if (i & 1) snprintf(queries[i], sizeof(queries[i]), "item %u", k);
+        else snprintf(queries[i], sizeof(queries[i]), "x%x", k % 16);
+    }
+    MenuItem *hits[MENU_SEARCH_MAX];
+    long found[2] = { 0, 0 };
+    double searchNs[2] = { 0, 0 };
+    for (int kind=0;kind<2;kind++) {
+        struct timespec s0, s1;
+        clock_gettime(CLOCK_MONOTONIC, &s0);
+        for (int i=0;i<searches;i++) found[kind] += searchMenu(menu, queries[(i * 2 + kind) & 4095], 1, hits, MENU_SEARCH_MAX);
+        clock_gettime(CLOCK_MONOTONIC, &s1);
+        searchNs[kind] = elapsedMs(s0, s1) * 1e6 / searches;
+    }
+    struct timespec s2, s3;
+    clock_gettime(CLOCK_MONOTONIC, &s2);
+    for (int i=0;i<searches;i++) toggleMenuItem(codes[i & 4095], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &s3);
+    menuUnpin();
+    struct timespec t5, t6;
+    clock_gettime(CLOCK_MONOTONIC, &t5);
+    MenuCatalog *next = loadMenuCatalog(cat);
+    if (next) publishMenu(next);
+    clock_gettime(CLOCK_MONOTONIC, &t6);
+    unlink(cat);
+    printf("Menu catalog benchmark (%d items, %zu-byte records)\n", items, sizeof(MenuItem));
+    printf("Compile text -> catalog:  %8.2f ms\n", elapsedMs(t0, t1));
+    printf("Map + index catalog:      %8.2f ms\n", elapsedMs(t1, t2));
+    printf("Code lookup:              %8.1f ns  (checksum %" PRId64 ")\n", elapsedMs(t3, t4) * 1e6 / lookups, sum);
+    printf("Search, word prefix:      %8.1f ns  (%.1f hits, e.g. \"%s\")\n", searchNs[0], (double)found[0] / searches, queries[0]);
+    printf("Search, substring:        %8.1f ns  (%.1f hits, e.g. \"%s\")\n", searchNs[1], (double)found[1] / searches, queries[1]);
+    printf("Availability toggle:      %8.1f ns\n", elapsedMs(s2, s3) * 1e6 / searches);
+    printf("Reload + swap:            %8.2f ms\n", elapsedMs(t5, t6));
+    return 0;
 }
 
 
-void printBill(int orderIdx) {
-    if (orderIdx < 0 || orderIdx >= orderCount) {
-        printf("Invalid order index.\n");
-        return;
+static void stopServer(int sig) {
+    (void)sig;
+    serverStopping = 1;
+}
+
+static void* serverClientMain(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    FILE *in = fdopen(fd, "r");
+    int outFd = dup(fd);
+    FILE *out = outFd != -1 ? fdopen(outFd, "w") : NULL;
+    if (in && out) runBatch(in, out);
+    pthread_mutex_lock(&serverLock);
+    for (int i=0;i<serverClientCount;i++) {
+        if (serverClientFds[i] == fd) {
+            serverClientFds[i] = serverClientFds[--serverClientCount];
+            break;
+        }
     }
-    Order *o = &orders[orderIdx];
-    if (!o->active) {
-        printf("Order already billed/closed.\n");
-        return;
+    pthread_cond_signal(&serverIdle);
+    pthread_mutex_unlock(&serverLock);
+    if (out) fclose(out);
+    else if (outFd != -1) close(outFd);
+    if (in) fclose(in);
+    else close(fd);
+    return NULL;
+}
+
+/* Serves the command protocol on a Unix socket, one thread per terminal, until SIGINT/SIGTERM. */
+int runServer(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    if (strlen(path) >= sizeof(addr.sun_path)) { printf("Socket path too long.\n"); return 1; }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (lfd == -1) { printf("Cannot create socket.\n"); return 1; }
+    unlink(path);
+    if (bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(lfd, SERVER_BACKLOG) != 0) {
+        printf("Cannot listen on %s\n", path);
+        close(lfd);
+        return 1;
     }
-    Bill b = calculateBill(orderIdx);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+    sa.sa_handler = stopServer;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    printf("Serving on %s (Ctrl+C to stop)\n", path);
+    fflush(stdout);
 
-    
-    float discountPercent = 0.0f;
-    float preDiscountTotal = b.subtotal + b.gst + b.serviceCharge;
-    if (preDiscountTotal > DISCOUNT_TIER2_THRESHOLD)
-        discountPercent = DISCOUNT_TIER2_RATE * 100.0f;
-    else if (preDiscountTotal > DISCOUNT_TIER1_THRESHOLD)
-        discountPercent = DISCOUNT_TIER1_RATE * 100.0f;
-    else
-        discountPercent = 0.0f;
-
-    printf("\n========================================\n");
-    printf("               BILL / RECEIPT           \n");
-    printf("KOT: %d\n", o->orderId);
-    printf("Type: %s\n", o->dineIn ? "Dine-In" : "Takeaway");
-    if (o->dineIn) printf("Table: %d\n", o->tableNumber);
-    printf("Date/Time: %s", ctime(&o->timestamp));
-    printf("----------------------------------------\n");
-    printf("%-6s %-25s %-6s %-8s\n", "Code", "Item", "Qty", "Amount");
-    printf("----------------------------------------\n");
-    for (int i=0;i<o->itemCount;i++) {
-        int m = findMenuIndexByCode(o->items[i].code);
-        if (m == -1) continue;
-        float line = menuList[m].price * (float)o->items[i].qty;
-        printf("%-6s %-25s %-6d %-8.2f\n",
-               menuList[m].code, menuList[m].name, o->items[i].qty, line);
-    }
-    printf("----------------------------------------\n");
-    printf("Subtotal:        %8.2f\n", b.subtotal);
-    printf("GST (5%% on food):%8.2f\n", b.gst);
-    printf("Service:         %8.2f\n", b.serviceCharge);
-
-    if (discountPercent > 0.0f) {
-        printf("Discount (%.0f%%):  %8.2f\n", discountPercent, b.discount);
-    } else {
-        printf("Discount:        %8.2f\n", b.discount);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    struct pollfd pfd = { lfd, POLLIN, 0 };
+    while (!serverStopping) {
+        if (poll(&pfd, 1, SERVER_POLL_MS) <= 0) {
+            salesFlush();
+            continue;
+        }
+        int cfd = accept(lfd, NULL, NULL);
+        if (cfd == -1) continue;
+        pthread_mutex_lock(&serverLock);
+        int ok = serverClientCount < MAX_SERVER_CLIENTS;
+        if (ok) serverClientFds[serverClientCount++] = cfd;
+        pthread_mutex_unlock(&serverLock);
+        pthread_t tid;
+        if (ok && pthread_create(&tid, &attr, serverClientMain, (void*)(intptr_t)cfd) == 0) continue;
+        if (ok) {
+            pthread_mutex_lock(&serverLock);
+            serverClientFds[--serverClientCount] = -1;
+            pthread_mutex_unlock(&serverLock);
+        }
+        static const char busy[] = "ERR server busy\n";
+        writeFully(cfd, busy, sizeof(busy) - 1);
+        close(cfd);
     }
+    pthread_attr_destroy(&attr);
+    close(lfd);
+    unlink(path);
+
+    /* hang up on every terminal and wait for their sessions to finish their last command */
+    pthread_mutex_lock(&serverLock);
+    for (int i=0;i<serverClientCount;i++) shutdown(serverClientFds[i], SHUT_RDWR);
+    while (serverClientCount > 0) pthread_cond_wait(&serverIdle, &serverLock);
+    pthread_mutex_unlock(&serverLock);
+    printf("Server stopped.\n");
+    return 0;
+}
 
-    printf("TOTAL:           %8.2f\n", b.total);
-    printf("========================================\n");
 
-    saveReceiptToFile(orderIdx, b);
+typedef struct {
+    const char *path;
+    int ops;
+    uint32_t seed;
+    pthread_barrier_t *start;
+    LatencyHistogram hist;
+    long errors;
+    long tableConflicts;
+    int failed;
+} LoadgenClient;
 
-    
-    o->active = 0;
-    if (o->dineIn && o->tableNumber >=1 && o->tableNumber <= MAX_TABLES) {
-        tableOrderIndex[o->tableNumber-1] = -1;
+static uint32_t loadgenRandom(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/* Sends one command and waits for its OK/ERR line. Returns 0 for OK, 1 for ERR, -1 on a broken connection. */
+static int loadgenRequest(LoadgenClient *c, int fd, LineReader *r, const char *cmd, char *reply) {
+    char line[COMMAND_LINE_LEN];
+    uint64_t t0 = monotonicNs();
+    if (writeFully(fd, cmd, strlen(cmd)) != 0) return -1;
+    while (1) {
+        int len = readLine(r, line, sizeof(line));
+        if (len == -1) return -1;
+        if (strncmp(line, "OK", 2) == 0 && (line[2] == '\0' || line[2] == ' ')) break;
+        if (strncmp(line, "ERR ", 4) == 0) break;
     }
+    latencyRecord(&c->hist, monotonicNs() - t0);
+    if (reply) strcpy(reply, line);
+    return line[0] == 'O' ? 0 : 1;
 }
 
+/* Each client runs whole order lifecycles: create (a quarter of them racing for tables), 3 adds, a qty change, bill. */
+static void* loadgenClientMain(void *arg) {
+    LoadgenClient *c = arg;
+    LineReader *r = malloc(sizeof(LineReader));
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, c->path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (!r || fd == -1 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) c->failed = 1;
+    if (r) r->fd = fd, r->start = r->end = r->eof = 0;
+    pthread_barrier_wait(c->start);
+    char cmd[COMMAND_LINE_LEN], reply[COMMAND_LINE_LEN];
+    const MenuCatalog *menu = menuPin();
+    int done = 0;
+    while (!c->failed && done < c->ops) {
+        int kot = 0, ret = 1;
+        if (loadgenRandom(&c->seed) % 4 == 0) {
+            snprintf(cmd, sizeof(cmd), "CREATE dine %u\n", 1 + loadgenRandom(&c->seed) % FLOOR_DEFAULT_TABLES);
+            ret = loadgenRequest(c, fd, r, cmd, reply);
+            done++;
+            if (ret == 1) c->tableConflicts++;
+        }
+        if (ret == 1) {
+            ret = loadgenRequest(c, fd, r, "CREATE take\n", reply);
+            done++;
+        }
+        if (ret != 0 || sscanf(reply, "OK %d", &kot) != 1) { c->failed = ret < 0; c->errors++; continue; }
+        const char *code = NULL;
+        for (int i=0;i<3;i++) {
+            code = menu->items[loadgenRandom(&c->seed) % (uint32_t)menu->itemCount].code;
+            snprintf(cmd, sizeof(cmd), "ADD %d %s %u\n", kot, code, 1 + loadgenRandom(&c->seed) % 3);
+            if ((ret = loadgenRequest(c, fd, r, cmd, NULL)) != 0) c->errors++;
+        }
+        snprintf(cmd, sizeof(cmd), "QTY %d %s %u\n", kot, code, 1 + loadgenRandom(&c->seed) % 4);
+        if (loadgenRequest(c, fd, r, cmd, NULL) != 0) c->errors++;
+        snprintf(cmd, sizeof(cmd), "BILL %d\n", kot);
+        if ((ret = loadgenRequest(c, fd, r, cmd, NULL)) != 0) c->errors++;
+        c->failed = ret < 0;
+        done += 5;
+    }
+    menuUnpin();
+    if (fd != -1) close(fd);
+    free(r);
+    return NULL;
+}
 
-void saveReceiptToFile(int orderIdx, Bill b) {
-    char fname[RECEIPT_FILENAME_LEN];
-    Order *o = &orders[orderIdx];
+/* Drives a running --serve instance with 1..64 concurrent terminals and reports throughput and latency. */
+int runLoadgen(const char *path, int opsPerClient) {
+    static LoadgenClient clients[LOADGEN_MAX_CLIENTS];
+    printf("Load generator against %s (%d ops per client)\n", path, opsPerClient);
+    printf("%-7s | %-9s | %-11s | %-8s | %-8s | %-8s | %-9s | %s\n",
+           "Clients", "Ops", "Ops/sec", "p50 us", "p99 us", "max us", "Tbl busy", "Errors");
+    for (int n=1;n<=LOADGEN_MAX_CLIENTS;n*=2) {
+        pthread_t tids[LOADGEN_MAX_CLIENTS];
+        pthread_barrier_t start;
+        pthread_barrier_init(&start, NULL, (unsigned)n + 1);
+        for (int i=0;i<n;i++) {
+            memset(&clients[i], 0, sizeof(clients[i]));
+            clients[i].path = path;
+            clients[i].ops = opsPerClient;
+            clients[i].seed = 2463534242u + (uint32_t)i * 7919u;
+            clients[i].start = &start;
+            pthread_create(&tids[i], NULL, loadgenClientMain, &clients[i]);
+        }
+        pthread_barrier_wait(&start);
+        uint64_t t0 = monotonicNs();
+        for (int i=0;i<n;i++) pthread_join(tids[i], NULL);
+        double secs = (double)(monotonicNs() - t0) / 1e9;
+        pthread_barrier_destroy(&start);
+        LatencyHistogram all;
+        memset(&all, 0, sizeof(all));
+        long errors = 0, conflicts = 0;
+        int failed = 0;
+        for (int i=0;i<n;i++) {
+            latencyMerge(&all, &clients[i].hist);
+            errors += clients[i].errors;
+            conflicts += clients[i].tableConflicts;
+            failed |= clients[i].failed;
+        }
+        if (failed) { printf("Connection to %s failed.\n", path); return 1; }
+        printf("%-7d | %-9" PRIu64 " | %11.0f | %8.1f | %8.1f | %8.1f | %-9ld | %ld\n", n, all.total,
+               secs > 0 ? (double)all.total / secs : 0.0,
+               latencyPercentile(&all, 50) / 1e3, latencyPercentile(&all, 99) / 1e3, all.maxNs / 1e3,
+               conflicts, errors);
+    }
+    return 0;
+}
 
-    
-    float discountPercent = 0.0f;
-    float preDiscountTotal = b.subtotal + b.gst + b.serviceCharge;
-    if (preDiscountTotal > DISCOUNT_TIER2_THRESHOLD)
-        discountPercent = DISCOUNT_TIER2_RATE * 100.0f;
-    else if (preDiscountTotal > DISCOUNT_TIER1_THRESHOLD)
-        discountPercent = DISCOUNT_TIER1_RATE * 100.0f;
-    else
-        discountPercent = 0.0f;
-
-    snprintf(fname, sizeof(fname), "receipt_%d.txt", o->orderId);
-    FILE *f = fopen(fname, "w");
-    if (!f) {
-        printf("Failed to write receipt to file.\n");
-        return;
+
+typedef struct {
+    int station;
+    int tickets;
+    _Atomic int *producersDone;
+    pthread_barrier_t *start;
+    LatencyHistogram hist;
+    long picked;
+} KitchenBenchThread;
+
+static void *kitchenBenchProducer(void *arg) {
+    KitchenBenchThread *t = arg;
+    KitchenTicket ticket;
+    memset(&ticket, 0, sizeof(ticket));
+    snprintf(ticket.code, sizeof(ticket.code), "%c01", "SMBD"[t->station]);
+    pthread_barrier_wait(t->start);
+    for (int i=0;i<t->tickets;i++) {
+        ticket.orderId = 9001 + i;
+        ticket.tableNumber = 1 + i % FLOOR_DEFAULT_TABLES;
+        ticket.qtyDelta = 1;
+        ticket.enteredNs = monotonicNs();
+        kitchenPush(&kitchenStations[t->station], &ticket);
     }
-    fprintf(f, "========================================\n");
-    fprintf(f, "               BILL / RECEIPT           \n");
-    fprintf(f, "KOT: %d\n", o->orderId);
-    fprintf(f, "Type: %s\n", o->dineIn ? "Dine-In" : "Takeaway");
-    if (o->dineIn) fprintf(f, "Table: %d\n", o->tableNumber);
-    fprintf(f, "Date/Time: %s", ctime(&o->timestamp));
-    fprintf(f, "----------------------------------------\n");
-    fprintf(f, "%-6s %-25s %-6s %-8s\n", "Code", "Item", "Qty", "Amount");
-    fprintf(f, "----------------------------------------\n");
-    for (int i=0;i<o->itemCount;i++) {
-        int m = findMenuIndexByCode(o->items[i].code);
-        if (m == -1) continue;
-        float line = menuList[m].price * (float)o->items[i].qty;
-        fprintf(f, "%-6s %-25s %-6d %-8.2f\n",
-               menuList[m].code, menuList[m].name, o->items[i].qty, line);
-    }
-    fprintf(f, "----------------------------------------\n");
-    fprintf(f, "Subtotal:        %8.2f\n", b.subtotal);
-    fprintf(f, "GST (5%% on food):%8.2f\n", b.gst);
-    fprintf(f, "Service:         %8.2f\n", b.serviceCharge);
-
-    if (discountPercent > 0.0f) {
-        fprintf(f, "Discount (%.0f%%):  %8.2f\n", discountPercent, b.discount);
-    } else {
-        fprintf(f, "Discount:        %8.2f\n", b.discount);
+    atomic_fetch_add(t->producersDone, 1);
+    return NULL;
+}
+
+static void *kitchenBenchConsumer(void *arg) {
+    KitchenBenchThread *t = arg;
+    KitchenTicket batch[KITCHEN_PICKUP_MAX];
+    pthread_barrier_wait(t->start);
+    while (1) {
+        int done = atomic_load(t->producersDone) == KITCHEN_STATIONS;
+        int got = kitchenPickup(t->station, batch, KITCHEN_PICKUP_MAX);
+        if (got == 0) {
+            if (done) break;
+            sched_yield();
+            continue;
+        }
+        uint64_t now = monotonicNs();
+        for (int i=0;i<got;i++) latencyRecord(&t->hist, now - batch[i].enteredNs);
+        t->picked += got;
     }
+    return NULL;
+}
 
-    fprintf(f, "TOTAL:           %8.2f\n", b.total);
-    fprintf(f, "========================================\n");
-    fclose(f);
-    printf("Receipt saved to: %s\n", fname);
+/* One producer per station against 1, 2 and 4 screens per station, in batches of KITCHEN_PICKUP_MAX. */
+static int runKitchenBenchmark(int tickets) {
+    static const int screens[] = { 1, 2, 4 };
+    printf("Kitchen dispatch benchmark (%d tickets per station, %d stations)\n", tickets, KITCHEN_STATIONS);
+    printf("%-7s | %-12s | %-8s | %-8s | %-8s | %s\n", "Screens", "tickets/s", "p50 us", "p99 us", "max us", "Dropped");
+    for (int r=0;r<(int)(sizeof(screens)/sizeof(screens[0]));r++) {
+        int consumers = screens[r] * KITCHEN_STATIONS;
+        int threads = KITCHEN_STATIONS + consumers;
+        KitchenBenchThread *bench = calloc((size_t)threads, sizeof(KitchenBenchThread));
+        pthread_t *tid = calloc((size_t)threads, sizeof(pthread_t));
+        if (!bench || !tid) { printf("Out of memory.\n"); return 1; }
+        _Atomic int producersDone = 0;
+        pthread_barrier_t start;
+        pthread_barrier_init(&start, NULL, (unsigned)threads + 1);
+        for (int s=0;s<KITCHEN_STATIONS;s++) {
+            atomic_store(&kitchenStations[s].head, 0);
+            atomic_store(&kitchenStations[s].tail, 0);
+            kitchenStations[s].dispatched = kitchenStations[s].dropped = 0;
+            kitchenStations[s].stalled = 0;
+        }
+        for (int i=0;i<threads;i++) {
+            bench[i].station = i < KITCHEN_STATIONS ? i : (i - KITCHEN_STATIONS) % KITCHEN_STATIONS;
+            bench[i].tickets = tickets;
+            bench[i].producersDone = &producersDone;
+            bench[i].start = &start;
+            pthread_create(&tid[i], NULL, i < KITCHEN_STATIONS ? kitchenBenchProducer : kitchenBenchConsumer, &bench[i]);
+        }
+        struct timespec t0, t1;
+        pthread_barrier_wait(&start);
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int i=0;i<threads;i++) pthread_join(tid[i], NULL);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        pthread_barrier_destroy(&start);
+        LatencyHistogram all;
+        memset(&all, 0, sizeof(all));
+        long picked = 0;
+        uint64_t dropped = 0;
+        for (int i=KITCHEN_STATIONS;i<threads;i++) {
+            latencyMerge(&all, &bench[i].hist);
+            picked += bench[i].picked;
+        }
+        for (int s=0;s<KITCHEN_STATIONS;s++) dropped += kitchenStations[s].dropped;
+        double ms = elapsedMs(t0, t1);
+        printf("%7d | %12.0f | %8.1f | %8.1f | %8.1f | %llu\n", screens[r], ms > 0 ? picked / ms * 1e3 : 0.0,
+               latencyPercentile(&all, 50) / 1e3, latencyPercentile(&all, 99) / 1e3, all.maxNs / 1e3,
+               (unsigned long long)dropped);
+        free(bench);
+        free(tid);
+    }
+    return 0;
 }
 
+typedef struct {
+    int menuId;
+    int ops;
+    _Atomic int32_t *shared;
+    pthread_barrier_t *start;
+} StockBenchThread;
 
-void listActiveOrders(void) {
-    printf("\nActive Orders:\n");
-    printf("KOT   | Type     | Table | Items | Time\n");
-    printf("----------------------------------------------\n");
-    for (int i=0;i<orderCount;i++) {
-        if (!orders[i].active) continue;
-        printf("%-5d | %-8s | %-5d | %-5d | %s",
-               orders[i].orderId,
-               orders[i].dineIn ? "Dine-In" : "Takeaway",
-               orders[i].tableNumber,
-               orders[i].itemCount,
-               ctime(&orders[i].timestamp));
+/* The naive counter for comparison: every terminal CASes the same word. */
+static void *stockBenchShared(void *arg) {
+    StockBenchThread *t = arg;
+    pthread_barrier_wait(t->start);
+    for (int i=0;i<t->ops;i++) {
+        int32_t have = atomic_load_explicit(t->shared, memory_order_relaxed);
+        while (have >= 1 && !atomic_compare_exchange_weak_explicit(t->shared, &have, have - 1, memory_order_relaxed, memory_order_relaxed)) {}
+        atomic_fetch_add_explicit(t->shared, 1, memory_order_relaxed);
     }
+    return NULL;
 }
 
+static void *stockBenchSharded(void *arg) {
+    StockBenchThread *t = arg;
+    pthread_barrier_wait(t->start);
+    for (int i=0;i<t->ops;i++) {
+        stockReserve(t->menuId, 1);
+        stockRelease(t->menuId, 1);
+    }
+    return NULL;
+}
 
-int findOrderIndexById(int orderId) {
-    for (int i=0;i<orderCount;i++) {
-        if (orders[i].orderId == orderId) return i;
+/* Every thread reserves and releases one portion of the same item: one shared counter against the sharded one. */
+static int runStockBenchmark(int ops) {
+    static const int threadCounts[] = { 1, 2, 4, 8, 16 };
+    char code[CODE_LEN];
+    strcpy(code, menuPin()->items[0].code);
+    menuUnpin();
+    int id = findMenuIndexByCode(code);
+    int64_t *units = calloc(STOCK_MAX, sizeof(int64_t));
+    int r = units ? stockAddResource(code, id) : -1;
+    if (r == -1 || stockAddUse(id, r, 1) != 0) { free(units); printf("Out of memory.\n"); return 1; }
+    units[r] = STOCK_MAX_UNITS;
+    stockInstall(units);
+    free(units);
+    _Alignas(64) _Atomic int32_t shared = STOCK_MAX_UNITS;
+    printf("Stock counter benchmark (%d reserve + release pairs per thread, %d slices)\n", ops, STOCK_SHARDS);
+    printf("%-7s | %-16s | %-16s\n", "Threads", "shared ns/pair", "sharded ns/pair");
+    for (int k=0;k<(int)(sizeof(threadCounts)/sizeof(threadCounts[0]));k++) {
+        int threads = threadCounts[k];
+        double ms[2];
+        for (int mode=0;mode<2;mode++) {
+            StockBenchThread *bench = calloc((size_t)threads, sizeof(StockBenchThread));
+            pthread_t *tid = calloc((size_t)threads, sizeof(pthread_t));
+            if (!bench || !tid) { printf("Out of memory.\n"); return 1; }
+            pthread_barrier_t start;
+            pthread_barrier_init(&start, NULL, (unsigned)threads + 1);
+            for (int i=0;i<threads;i++) {
+                bench[i] = (StockBenchThread){ id, ops, &shared, &start };
+                pthread_create(&tid[i], NULL, mode == 0 ? stockBenchShared : stockBenchSharded, &bench[i]);
+            }
+            struct timespec t0, t1;
+            pthread_barrier_wait(&start);
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            for (int i=0;i<threads;i++) pthread_join(tid[i], NULL);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            pthread_barrier_destroy(&start);
+            ms[mode] = elapsedMs(t0, t1);
+            free(bench);
+            free(tid);
+        }
+        double pairs = (double)ops * threads;
+        printf("%7d | %16.1f | %16.1f\n", threads, ms[0] * 1e6 / pairs, ms[1] * 1e6 / pairs);
     }
-    return -1;
+    if (stockCount(r) != STOCK_MAX_UNITS || shared != STOCK_MAX_UNITS) {
+        printf("Count drifted: %" PRId64 " sharded, %d shared (expected %d).\n", stockCount(r), (int)shared, STOCK_MAX_UNITS);
+        return 1;
+    }
+    return 0;
+}
+
+/* A month of synthetic sales lines in memory, aggregated by each report on one thread and on every core. */
+static int runSalesBenchmark(int rows) {
+    static const char *kinds[] = { "items", "categories", "hourly" };
+    SalesColumns cols;
+    memset(&cols, 0, sizeof(cols));
+    for (int c=0;c<SALES_COLUMNS;c++) {
+        cols.map[c] = malloc((size_t)rows * (size_t)salesColumnSpec[c].width);
+        if (!cols.map[c]) { printf("Out of memory.\n"); return 1; }
+        cols.col[c] = cols.map[c];
+    }
+    cols.rows = rows;
+    cols.dictCount = 500;
+    int64_t *ts = cols.map[SALES_TIME];
+    int32_t *kot = cols.map[SALES_KOT], *qty = cols.map[SALES_QTY];
+    int16_t *table = cols.map[SALES_TABLE];
+    uint16_t *item = cols.map[SALES_ITEM];
+    Money *amount = cols.map[SALES_AMOUNT];
+    uint8_t *category = cols.map[SALES_CATEGORY];
+    time_t start = time(NULL) - 30L * 86400;
+    uint32_t seed = 42;
+    for (int i=0;i<rows;i++) {
+        kot[i] = 9001 + i / 4;
+        ts[i] = start + (int64_t)i * (30L * 86400) / rows;
+        table[i] = (int16_t)(loadgenRandom(&seed) % (FLOOR_DEFAULT_TABLES + 1));
+        item[i] = (uint16_t)(loadgenRandom(&seed) % (uint32_t)cols.dictCount);
+        qty[i] = 1 + (int32_t)(loadgenRandom(&seed) % 4);
+        amount[i] = RUPEES(40 + item[i] % 400) * qty[i];
+        category[i] = (uint8_t)(STARTER + item[i] % 4);
+    }
+    int threads = salesThreadCount();
+    int buckets = salesBucketCount(SALES_BY_ITEM);
+    Money *sum = malloc(sizeof(Money) * (size_t)buckets);
+    int64_t *units = malloc(sizeof(int64_t) * (size_t)buckets);
+    if (!sum || !units) { printf("Out of memory.\n"); return 1; }
+    printf("Sales aggregation benchmark (%d lines over 30 days, %d cores)\n", rows, threads);
+    printf("%-11s | %-9s | %-9s | %-14s | %s\n", "Report", "1 core ms", "all ms", "Mlines/s (all)", "Revenue");
+    for (int k=0;k<3;k++) {
+        SalesQuery q = { &cols, (SalesReportKind)k, INT64_MIN, INT64_MAX, utcOffsetAt(start) };
+        double ms[2] = { 0, 0 };
+        for (int pass=0;pass<2;pass++) {
+            for (int round=0;round<BENCH_ROUNDS;round++) {
+                struct timespec t0, t1;
+                clock_gettime(CLOCK_MONOTONIC, &t0);
+                salesAggregate(&q, pass == 0 ? 1 : threads, sum, units);
+                clock_gettime(CLOCK_MONOTONIC, &t1);
+                if (round == 0 || elapsedMs(t0, t1) < ms[pass]) ms[pass] = elapsedMs(t0, t1);
+            }
+        }
+        Money total = 0;
+        for (int b=0;b<salesBucketCount(q.kind);b++) total += sum[b];
+        char money[MONEY_STR_LEN];
+        printf("%-11s | %9.1f | %9.1f | %14.0f | %s\n", kinds[k], ms[0], ms[1],
+               ms[1] > 0 ? rows / ms[1] / 1e3 : 0.0, formatMoney(total, money));
+    }
+    free(sum);
+    free(units);
+    for (int c=0;c<SALES_COLUMNS;c++) free(cols.map[c]);
+    return 0;
 }
 
 
-void showTableStatus(void) {
-    printf("\nTable Status (1..%d):\n", MAX_TABLES);
-    for (int i=0;i<MAX_TABLES;i++) {
-        if (tableOrderIndex[i] == -1) {
-            printf("Table %2d: Free\n", i+1);
-        } else {
-            int oi = tableOrderIndex[i];
-            printf("Table %2d: Occupied (KOT %d, items %d)\n", i+1, orders[oi].orderId, orders[oi].itemCount);
+static void writeBenchRecord(FILE *f, int type, int orderId, int dineIn, int table, time_t timestamp, const MenuItem *mi, int qty) {
+    JournalRecord r;
+    memset(&r, 0, sizeof(r));
+    r.type = (uint8_t)type;
+    r.dineIn = (uint8_t)dineIn;
+    r.orderId = orderId;
+    r.tableNumber = table;
+    r.qty = qty;
+    r.timestamp = (int64_t)timestamp;
+    if (mi) {
+        memcpy(r.code, mi->code, CODE_LEN);
+        r.category = mi->category;
+        r.price = mi->price;
+    }
+    r.checksum = journalChecksum(&r);
+    fwrite(&r, sizeof(r), 1, f);
+}
+
+/*
+ * Writes `outlets` journals of a week's trade, half to twice CONSOLIDATE_BENCH_ORDERS bills each
+ * with every KOT starting at 9001, and consolidates them on 1, 2, 4... threads (at least 4, so the
+ * stealing is exercised even on a small machine). The files stay in the page cache between runs.
+ */
+static int runConsolidationBenchmark(int outlets) {
+    char dir[] = "/tmp/consolidateXXXXXX";
+    if (!mkdtemp(dir)) { printf("Cannot create a scratch directory.\n"); return 1; }
+    char (*paths)[RECEIPT_PATH_LEN] = malloc(sizeof(*paths) * (size_t)outlets);
+    ConsolidationTask *tasks = calloc((size_t)outlets, sizeof(ConsolidationTask));
+    if (!paths || !tasks) { printf("Out of memory.\n"); return 1; }
+    const MenuCatalog *menu = menuPin();
+    time_t start = time(NULL) - 7L * 86400;
+    off_t bytes = 0;
+    for (int k=0;k<outlets;k++) {
+        snprintf(paths[k], RECEIPT_PATH_LEN, "%s/outlet%03d.journal", dir, k + 1);
+        FILE *f = fopen(paths[k], "wb");
+        if (!f) { printf("Cannot write %s\n", paths[k]); menuUnpin(); return 1; }
+        JournalHeader h = { JOURNAL_MAGIC, 1, 0 };
+        fwrite(&h, sizeof(h), 1, f);
+        uint32_t seed = 7919u * (uint32_t)(k + 1);
+        int orders = CONSOLIDATE_BENCH_ORDERS / 2 + (int)(loadgenRandom(&seed) % (CONSOLIDATE_BENCH_ORDERS * 3 / 2));
+        int kot = 9001;
+        for (int j=0;j<orders;j++) {
+            time_t ts = start + (time_t)((int64_t)j * 7 * 86400 / orders);
+            int dineIn = j % 2, table = dineIn ? 1 + j % FLOOR_DEFAULT_TABLES : 0;
+            /* every tenth dine-in party takes over the next table's order, which is then closed unbilled */
+            int parties = dineIn && j % 20 == 1 ? 2 : 1;
+            int ids[2];
+            for (int p=0;p<parties;p++) {
+                ids[p] = kot++;
+                int seat = p == 0 ? table : table % FLOOR_DEFAULT_TABLES + 1;
+                writeBenchRecord(f, JOURNAL_CREATE, ids[p], dineIn, seat, ts, NULL, 0);
+                int lines = 1 + (int)(loadgenRandom(&seed) % 6);
+                for (int i=0;i<lines;i++) {
+                    const MenuItem *mi = &menu->items[loadgenRandom(&seed) % (uint32_t)menu->itemCount];
+                    writeBenchRecord(f, JOURNAL_ADD, ids[p], dineIn, seat, ts, mi, 1 + (int)(loadgenRandom(&seed) % 3));
+                    if (i == 0 && loadgenRandom(&seed) % 8 == 0) writeBenchRecord(f, JOURNAL_UPDATE, ids[p], dineIn, seat, ts, mi, 4);
+                    if (i == 1 && loadgenRandom(&seed) % 8 == 0) writeBenchRecord(f, JOURNAL_REMOVE, ids[p], dineIn, seat, ts, mi, 0);
+                }
+            }
+            if (parties == 2) {
+                writeBenchRecord(f, JOURNAL_MERGE, ids[0], dineIn, table, ts, NULL, table % FLOOR_DEFAULT_TABLES + 1);
+                writeBenchRecord(f, JOURNAL_CLOSE, ids[1], 0, 0, ts, NULL, 0);
+            }
+            writeBenchRecord(f, JOURNAL_CLOSE, ids[0], dineIn, table, ts, NULL, 0);
+        }
+        bytes += ftello(f);
+        if (fclose(f) != 0) { printf("Cannot write %s\n", paths[k]); menuUnpin(); return 1; }
+        tasks[k].path = paths[k];
+        tasks[k].outlet = k + 1;
+        tasks[k].size = consolidationInputSize(paths[k]);
+    }
+    menuUnpin();
+    int cores = salesThreadCount(), maxThreads = cores < 4 ? 4 : cores;
+    long records = 0, bills = 0;
+    Money baseline = 0;
+    int mismatches = 0;
+    printf("Consolidation benchmark (%d outlet journals, %.1f MB, %d cores)\n", outlets, bytes / 1e6, cores);
+    printf("%-7s | %-9s | %-10s | %-7s | %-6s | %s\n", "Threads", "ms", "Mrec/s", "Speedup", "Steals", "Total");
+    double single = 0;
+    for (int threads=1;threads<=maxThreads;threads*=2) {
+        double best = 0;
+        long steals = 0;
+        Money total = 0;
+        for (int round=0;round<BENCH_ROUNDS;round++) {
+            for (int k=0;k<outlets;k++) resetConsolidationTask(&tasks[k]);
+            struct timespec t0, t1;
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            steals = consolidateParallel(tasks, outlets, threads);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            if (round == 0 || elapsedMs(t0, t1) < best) best = elapsedMs(t0, t1);
+        }
+        records = bills = 0;
+        for (int k=0;k<outlets;k++) {
+            records += tasks[k].records;
+            bills += tasks[k].billCount;
+            for (int i=0;i<tasks[k].billCount;i++) total += tasks[k].bills[i].total;
+            mismatches += tasks[k].failed;
         }
+        if (threads == 1) {
+            single = best;
+            baseline = total;
+        }
+        mismatches += total != baseline;
+        char money[MONEY_STR_LEN];
+        printf("%-7d | %9.1f | %10.2f | %6.2fx | %-6ld | %s\n", threads, best, best > 0 ? records / best / 1e3 : 0.0,
+               best > 0 ? single / best : 0.0, steals, formatMoney(total, money));
+    }
+    printf("%ld records, %ld bills; totals differing from 1 thread: %d\n", records, bills, mismatches);
+    for (int k=0;k<outlets;k++) {
+        resetConsolidationTask(&tasks[k]);
+        unlink(paths[k]);
     }
+    rmdir(dir);
+    free(tasks);
+    free(paths);
+    return mismatches != 0;
 }
 
 
-int main(void) {
+#ifndef BILLING_NO_MAIN
+/* Reads an item code at the menu UI; "?text" lists the available items matching text and asks again. */
+static int promptItemCode(const char *prompt, char *code) {
+    char line[COMMAND_LINE_LEN];
+    while (1) {
+        printf("%s", prompt);
+        if (fgets(line, sizeof(line), stdin) == NULL) return -1;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '?') break;
+        printMenuSearch(stdout, line + 1);
+    }
+    size_t len = strlen(line);
+    if (len >= CODE_LEN) len = 0;
+    memcpy(code, line, len);
+    code[len] = '\0';
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *journalFile = NULL;
+    const char *batchFile = NULL;
+    const char *servePath = NULL;
+    const char *menuFile = NULL;
+    const char *menuExportFile = NULL;
+    const char *salesStoreDir = NULL;
+    const char *floorFile = NULL;
+    const char *pricingFile = NULL;
+    const char *stockFile = NULL;
+    const char *consolidateOut = NULL;
+    int consolidateFirst = 0, consolidateCount = 0;
+#ifdef BILLING_METRICS
+    const char *metricsFile = NULL;
+#endif
+    int batchMode = 0;
+    FsyncPolicy fsyncPolicy = FSYNC_BATCH;
+    ReceiptMode receipts = RECEIPTS_PER_FILE;
     initMenu();
+    kitchenStart();
+    for (int i=1;i<argc;i++) {
+        if (strcmp(argv[i], "--bench-batch") == 0) return runBatchBillingBenchmark();
+        else if (strcmp(argv[i], "--bench-render") == 0) return runRenderBenchmark();
+        else if (strcmp(argv[i], "--bench-scan") == 0) return runScanBenchmark();
+        else if (strcmp(argv[i], "--bench-pricing") == 0) return runPricingBenchmark();
+        else if (strcmp(argv[i], "--bench-menu") == 0) return runMenuBenchmark();
+        else if (strcmp(argv[i], "--menu-compile") == 0 && i+2 < argc) {
+            i += 2;
+            return compileMenuCatalog(argv[i-1], argv[i]);
+        }
+        else if (strcmp(argv[i], "--bench-sales") == 0) {
+            int rows = SALES_BENCH_ROWS;
+            if (i+1 < argc && parseInt(argv[i+1], &rows) == 0) i++;
+            if (rows <= 0) { printf("Rows must be positive.\n"); return 1; }
+            return runSalesBenchmark(rows);
+        }
+        else if (strcmp(argv[i], "--sales-report") == 0 && i+2 < argc) {
+            const char *dir = argv[i+1], *kind = argv[i+2], *from = NULL, *to = NULL;
+            i += 2;
+            if (i+1 < argc && strncmp(argv[i+1], "--", 2) != 0) from = argv[++i];
+            if (i+1 < argc && strncmp(argv[i+1], "--", 2) != 0) to = argv[++i];
+            if (menuFile && menuOpen(menuFile) != 0) { printf("Cannot load menu catalog %s\n", menuFile); return 1; }
+            return runSalesReport(dir, kind, from, to);
+        }
+        else if (strcmp(argv[i], "--bench-consolidate") == 0) {
+            int outlets = CONSOLIDATE_BENCH_OUTLETS;
+            if (i+1 < argc && parseInt(argv[i+1], &outlets) == 0) i++;
+            if (outlets <= 0) { printf("Outlets must be positive.\n"); return 1; }
+            return runConsolidationBenchmark(outlets);
+        }
+        else if (strcmp(argv[i], "--consolidate") == 0 && i+2 < argc) {
+            consolidateOut = argv[++i];
+            consolidateFirst = i + 1;
+            while (i+1 < argc && strncmp(argv[i+1], "--", 2) != 0) i++;
+            consolidateCount = i - consolidateFirst + 1;
+            if (consolidateCount == 0) { printf("No outlets to consolidate.\n"); return 1; }
+        }
+        else if (strcmp(argv[i], "--reprint") == 0 && i+2 < argc) {
+            const char *dir = argv[i+1], *day = NULL;
+            int kot;
+            if (parseInt(argv[i+2], &kot) != 0) { printf("Invalid KOT %s\n", argv[i+2]); return 1; }
+            i += 2;
+            if (i+1 < argc && strncmp(argv[i+1], "--", 2) != 0) day = argv[++i];
+            return reprintReceipt(dir, kot, day, stdout);
+        }
+        else if (strcmp(argv[i], "--bench-kitchen") == 0) {
+            int tickets = KITCHEN_BENCH_TICKETS;
+            if (i+1 < argc && parseInt(argv[i+1], &tickets) == 0) i++;
+            if (tickets <= 0) { printf("Tickets must be positive.\n"); return 1; }
+            return runKitchenBenchmark(tickets);
+        }
+        else if (strcmp(argv[i], "--bench-stock") == 0) {
+            int ops = STOCK_BENCH_OPS;
+            if (i+1 < argc && parseInt(argv[i+1], &ops) == 0) i++;
+            if (ops <= 0) { printf("Ops must be positive.\n"); return 1; }
+            return runStockBenchmark(ops);
+        }
+        else if (strcmp(argv[i], "--kitchen") == 0) kitchenEnabled = 1;
+        else if (strcmp(argv[i], "--metrics") == 0 && i+1 < argc) {
+#ifdef BILLING_METRICS
+            metricsFile = argv[++i];
+#else
+            printf("Metrics are not compiled in (build with -DBILLING_METRICS).\n");
+            return 1;
+#endif
+        }
+        else if (strcmp(argv[i], "--sales") == 0 && i+1 < argc) salesStoreDir = argv[++i];
+        else if (strcmp(argv[i], "--floor") == 0 && i+1 < argc) floorFile = argv[++i];
+        else if (strcmp(argv[i], "--pricing") == 0 && i+1 < argc) pricingFile = argv[++i];
+        else if (strcmp(argv[i], "--stock") == 0 && i+1 < argc) stockFile = argv[++i];
+        else if (strcmp(argv[i], "--menu-export") == 0 && i+1 < argc) menuExportFile = argv[++i];
+        else if (strcmp(argv[i], "--menu") == 0 && i+1 < argc) menuFile = argv[++i];
+        else if (strcmp(argv[i], "--outlet") == 0 && i+1 < argc) {
+            i++;
+            if (parseInt(argv[i], &menuOutlet) != 0 || menuOutlet < 0 || menuOutlet > 65535) {
+                printf("Outlet must be 0..65535.\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--loadgen") == 0 && i+1 < argc) {
+            const char *path = argv[++i];
+            int ops = LOADGEN_DEFAULT_OPS;
+            if (i+1 < argc && parseInt(argv[i+1], &ops) == 0) i++;
+            if (ops <= 0) { printf("Ops per client must be positive.\n"); return 1; }
+            return runLoadgen(path, ops);
+        }
+        else if (strcmp(argv[i], "--serve") == 0 && i+1 < argc) servePath = argv[++i];
+        else if (strcmp(argv[i], "--batch") == 0) {
+            batchMode = 1;
+            if (i+1 < argc && strncmp(argv[i+1], "--", 2) != 0) batchFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--journal") == 0 && i+1 < argc) journalFile = argv[++i];
+        else if (strcmp(argv[i], "--fsync") == 0 && i+1 < argc) {
+            i++;
+            if (strcmp(argv[i], "always") == 0) fsyncPolicy = FSYNC_ALWAYS;
+            else if (strcmp(argv[i], "batch") == 0) fsyncPolicy = FSYNC_BATCH;
+            else if (strcmp(argv[i], "none") == 0) fsyncPolicy = FSYNC_NONE;
+            else { printf("Unknown fsync policy %s (always|batch|none)\n", argv[i]); return 1; }
+        }
+        else if (strcmp(argv[i], "--spool") == 0 && i+1 < argc) {
+            i++;
+            if (strlen(argv[i]) >= SPOOL_DIR_LEN) { printf("Spool path too long.\n"); return 1; }
+            strcpy(spoolDir, argv[i]);
+        }
+        else if (strcmp(argv[i], "--receipts") == 0 && i+1 < argc) {
+            i++;
+            if (strcmp(argv[i], "file") == 0) receipts = RECEIPTS_PER_FILE;
+            else if (strcmp(argv[i], "segment") == 0) receipts = RECEIPTS_SEGMENT;
+            else if (strcmp(argv[i], "archive") == 0) receipts = RECEIPTS_ARCHIVE;
+            else { printf("Unknown receipts mode %s (file|segment|archive)\n", argv[i]); return 1; }
+        }
+        else { printf("Unknown option %s\n", argv[i]); return 1; }
+    }
+#ifdef BILLING_METRICS
+    if (metricsFile && metricsStart(metricsFile) != 0) { printf("Cannot start metrics for %s\n", metricsFile); return 1; }
+#endif
+    if (menuFile && menuOpen(menuFile) != 0) { printf("Cannot load menu catalog %s\n", menuFile); return 1; }
+    if (menuExportFile) return exportMenuSource(menuExportFile);
+    if (floorFile && loadFloorMap(floorFile, menuOutlet) != 0) return 1;
+    if (pricingFile && loadPricingRules(pricingFile, menuOutlet) != 0) return 1;
+    if (consolidateOut) return runConsolidation(consolidateOut, argv + consolidateFirst, consolidateCount);
+    if (salesStoreDir && salesOpen(salesStoreDir) != 0) { printf("Cannot open sales store %s\n", salesStoreDir); return 1; }
+    if (journalFile && journalOpen(journalFile, fsyncPolicy) != 0) return 1;
+    /* after recovery, so the reopened orders' lines come off the counts */
+    if (stockFile && stockOpen(stockFile, menuOutlet) != 0) return 1;
+    if (receiptWriterStart(receipts) != 0) printf("Receipt writer unavailable; saving receipts inline.\n");
+    if (receipts != RECEIPTS_ARCHIVE) addReceiptSink(archiveReceiptSink, NULL);
+    if (spoolDir[0]) addReceiptSink(spoolReceiptSink, NULL);
+    if (servePath) {
+        int ret = runServer(servePath);
+        metricsStop();
+        menuClose();
+        stockClose();
+        salesClose();
+        receiptWriterStop();
+        journalClose();
+        return ret;
+    }
+    if (batchMode) {
+        FILE *in = stdin;
+        if (batchFile && strcmp(batchFile, "-") != 0) {
+            in = fopen(batchFile, "r");
+            if (!in) { printf("Cannot open %s\n", batchFile); return 1; }
+        }
+        runBatch(in, stdout);
+        if (in != stdin) fclose(in);
+        metricsStop();
+        menuClose();
+        stockClose();
+        salesClose();
+        receiptWriterStop();
+        journalClose();
+        return 0;
+    }
 
     while (1) {
+        journalSync();
         printf("\n====== Restaurant Management System ======\n");
         printf("1. View Full Menu\n");
         printf("2. Create New Order (Dine-in / Takeaway)\n");
         printf("3. Modify Existing Order (Add / Remove / Update qty)\n");
         printf("4. Generate Bill & Close Order (KOT -> Receipt)\n");
         printf("5. List Active Orders\n");
-        printf("6. Table Status (50 tables)\n");
+        printf("6. Table Status\n");
         printf("7. Toggle Item Availability (Admin)\n");
         printf("8. Exit\n");
         printf("Choose option: ");
@@ -448,7 +7315,7 @@ int main(void) {
         clearInputBuffer();
 
         if (opt == 1) {
-            printMenuAll();
+            printMenuAll(stdout);
         }
         else if (opt == 2) {
             printf("Dine-In (1) or Takeaway (0)? ");
@@ -457,25 +7324,23 @@ int main(void) {
             clearInputBuffer();
             int tableNo = 0;
             if (dineIn == 1) {
-                printf("Enter table number (1..%d): ", MAX_TABLES);
+                printf("Enter table number (1..%d): ", floorTableCount);
                 if (scanf("%d", &tableNo) != 1) { clearInputBuffer(); printf("Invalid.\n"); continue; }
                 clearInputBuffer();
-                if (tableNo < 1 || tableNo > MAX_TABLES) { printf("Invalid table.\n"); continue; }
-                if (tableOrderIndex[tableNo-1] != -1) { printf("Table occupied.\n"); continue; }
+                if (tableNo < 1 || tableNo > floorTableCount) { printf("Invalid table.\n"); continue; }
+                if (tableOccupied(tableNo)) { printf("Table occupied.\n"); continue; }
             } else {
                 dineIn = 0;
             }
             int idx = createOrder(dineIn, tableNo);
             if (idx == -1) { printf("Failed to create order.\n"); continue; }
-            printf("Created Order KOT: %d\n", orders[idx].orderId);
+            printf("Created Order KOT: %d\n", orderAt(idx)->orderId);
 
-            
+            printMenuAll(stdout);
             while (1) {
-                printMenuAll();
+                journalSync();
                 char code[CODE_LEN];
-                printf("Enter item code to add (or 0 to finish): ");
-                if (fgets(code, sizeof(code), stdin) == NULL) break;
-                code[strcspn(code, "\n")] = '\0';
+                if (promptItemCode("Enter item code to add (?text to search, 0 to finish): ", code) != 0) break;
                 if (strcmp(code, "0") == 0) break;
                 int midx = findMenuIndexByCode(code);
                 if (midx == -1) {
@@ -489,10 +7354,11 @@ int main(void) {
                 int ret = addItemToOrder(idx, code, qty);
                 if (ret == 0) printf("Added.\n");
                 else if (ret == -2) { printf("Order items full.\n"); break; }
+                else if (ret == -3) printf("Out of stock.\n");
                 else printf("Failed to add item.\n");
             }
 
-            printf("Order saved. KOT: %d\n", orders[idx].orderId);
+            printf("Order saved. KOT: %d\n", orderAt(idx)->orderId);
         }
         else if (opt == 3) {
             printf("Enter KOT (order id) to modify: ");
@@ -501,9 +7367,10 @@ int main(void) {
             clearInputBuffer();
             int oidx = findOrderIndexById(kot);
             if (oidx == -1) { printf("Order not found.\n"); continue; }
-            if (!orders[oidx].active) { printf("Order already closed.\n"); continue; }
+            if (!orderAt(oidx)->active) { printf("Order already closed.\n"); continue; }
 
             while (1) {
+                journalSync();
                 printf("\nModify Order KOT %d\n", kot);
                 printf("1. Add Item\n2. Remove Item\n3. Update Item Quantity\n4. Show Order Details\n5. Back\n");
                 printf("Choice: ");
@@ -511,24 +7378,25 @@ int main(void) {
                 if (scanf("%d", &mopt) != 1) { clearInputBuffer(); printf("Invalid.\n"); continue; }
                 clearInputBuffer();
                 if (mopt == 1) {
-                    printMenuAll();
                     char code[CODE_LEN];
-                    printf("Item code to add: ");
-                    if (fgets(code, sizeof(code), stdin) == NULL) continue;
-                    code[strcspn(code, "\n")] = '\0';
+                    if (promptItemCode("Item code to add (?text to search): ", code) != 0) continue;
                     int qty;
                     printf("Quantity: ");
                     if (scanf("%d", &qty) != 1) { clearInputBuffer(); printf("Invalid.\n"); continue; }
                     clearInputBuffer();
                     int res = addItemToOrder(oidx, code, qty);
                     if (res == 0) printf("Added.\n");
+                    else if (res == -3) printf("Out of stock.\n");
+                    else if (res == -4) printf("That line is already paid.\n");
                     else printf("Failed to add item.\n");
                 } else if (mopt == 2) {
                     printf("Enter item code to remove: ");
                     char code[CODE_LEN];
                     if (fgets(code, sizeof(code), stdin) == NULL) continue;
                     code[strcspn(code, "\n")] = '\0';
-                    if (removeItemFromOrder(oidx, code) == 0) printf("Removed.\n");
+                    int res = removeItemFromOrder(oidx, code);
+                    if (res == 0) printf("Removed.\n");
+                    else if (res == -4) printf("That line is already paid.\n");
                     else printf("Item not found.\n");
                 } else if (mopt == 3) {
                     printf("Enter item code to update: ");
@@ -539,24 +7407,13 @@ int main(void) {
                     int nq;
                     if (scanf("%d", &nq) != 1) { clearInputBuffer(); printf("Invalid.\n"); continue; }
                     clearInputBuffer();
-                    if (updateItemQtyInOrder(oidx, code, nq) == 0) printf("Updated.\n");
+                    int res = updateItemQtyInOrder(oidx, code, nq);
+                    if (res == 0) printf("Updated.\n");
+                    else if (res == -3) printf("Out of stock.\n");
+                    else if (res == -4) printf("That line is already paid.\n");
                     else printf("Item not found.\n");
                 } else if (mopt == 4) {
-                    Order *o = &orders[oidx];
-                    printf("\nOrder KOT: %d | Type: %s | Table: %d | Items: %d\n",
-                           o->orderId, o->dineIn ? "Dine-In" : "Takeaway", o->tableNumber, o->itemCount);
-                    if (o->itemCount == 0) printf("No items.\n");
-                    else {
-                        printf("%-6s %-25s %-6s %-8s\n","Code","Item","Qty","Amount");
-                        for (int i=0;i<o->itemCount;i++) {
-                            int m = findMenuIndexByCode(o->items[i].code);
-                            if (m==-1) continue;
-                            printf("%-6s %-25s %-6d %-8.2f\n", menuList[m].code, menuList[m].name, o->items[i].qty, menuList[m].price * o->items[i].qty);
-                        }
-                        Bill b = calculateBill(oidx);
-                        printf("Subtotal: %.2f | GST: %.2f | Service: %.2f | Discount: %.2f | Total: %.2f\n",
-                               b.subtotal, b.gst, b.serviceCharge, b.discount, b.total);
-                    }
+                    printOrderDetails(stdout, oidx);
                 } else if (mopt == 5) break;
                 else printf("Invalid choice.\n");
             }
@@ -568,29 +7425,43 @@ int main(void) {
             clearInputBuffer();
             int idx = findOrderIndexById(kot);
             if (idx == -1) { printf("Order not found.\n"); continue; }
-            if (orders[idx].itemCount == 0) { printf("Order has no items.\n"); continue; }
-            printBill(idx); 
+            if (orderAt(idx)->itemCount == 0) { printf("Order has no items.\n"); continue; }
+            const PricingCoupon *coupon = NULL;
+            if (pricing->couponCount > 0) {
+                char code[COMMAND_LINE_LEN];
+                printf("Coupon code (Enter for none): ");
+                if (!fgets(code, sizeof(code), stdin)) code[0] = '\0';
+                code[strcspn(code, "\r\n")] = '\0';
+                if (code[0] && (coupon = findCoupon(code)) == NULL) { printf("Unknown coupon.\n"); continue; }
+            }
+            printBillWithCoupon(stdout, idx, coupon);
         }
         else if (opt == 5) {
-            listActiveOrders();
+            listActiveOrders(stdout);
         }
         else if (opt == 6) {
-            showTableStatus();
+            showTableStatus(stdout);
         }
         else if (opt == 7) {
             
-            printMenuAll();
+            printMenuAll(stdout);
             printf("Enter item code to toggle availability: ");
             char code[CODE_LEN];
             if (fgets(code, sizeof(code), stdin) == NULL) continue;
             code[strcspn(code, "\n")] = '\0';
-            int m = findMenuIndexByCode(code);
-            if (m == -1) { printf("Invalid code.\n"); continue; }
-            menuList[m].available = !menuList[m].available;
-            printf("%s now %s\n", menuList[m].name, menuList[m].available ? "Available" : "Unavailable");
+            char name[NAME_LEN];
+            int available = toggleMenuItem(code, name);
+            if (available == -1) { printf("Invalid code.\n"); continue; }
+            printf("%s now %s\n", name, available ? "Available" : "Unavailable");
         }
         else if (opt == 8) {
             printf("Exiting...\n");
+            metricsStop();
+            menuClose();
+            stockClose();
+            salesClose();
+            receiptWriterStop();
+            journalClose();
             break;
         }
         else {
@@ -599,4 +7470,5 @@ int main(void) {
     }
 
     return 0;
-}
\ No newline at end of file
+}
+#endif